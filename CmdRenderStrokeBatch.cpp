@@ -0,0 +1,90 @@
+#include "pch.h"
+#include "CmdRenderStrokeBatch.h"
+#include "debug_message.h"
+
+vk::UniqueDescriptorSet CmdRenderStrokeBatch::create_descr(const vk::UniqueDevice& m_dev,
+    const vk::UniqueDescriptorPool& m_descr_pool, const vk::UniqueDescriptorSetLayout& m_descr_layout,
+    const vk::UniqueSampler& m_sampler, const vk::UniqueImageView& m_brush_view)
+{
+    auto descr_info = vk::DescriptorSetAllocateInfo(*m_descr_pool, 1, &m_descr_layout.get());
+    vk::UniqueDescriptorSet descr = std::move(m_dev->allocateDescriptorSetsUnique(descr_info).front());
+    write_descr(m_dev, *descr, m_sampler, m_brush_view);
+    return descr;
+}
+
+void CmdRenderStrokeBatch::write_descr(const vk::UniqueDevice& m_dev, vk::DescriptorSet descr,
+    const vk::UniqueSampler& m_sampler, const vk::UniqueImageView& m_brush_view)
+{
+    auto descr_image_info_brush = vk::DescriptorImageInfo(*m_sampler,
+        *m_brush_view, vk::ImageLayout::eShaderReadOnlyOptimal);
+    std::array<vk::WriteDescriptorSet, 1> descr_write = {
+        // tex_brush
+        vk::WriteDescriptorSet(descr, 0, 0, 1,
+            vk::DescriptorType::eCombinedImageSampler, &descr_image_info_brush, nullptr, nullptr),
+    };
+    m_dev->updateDescriptorSets(descr_write, nullptr);
+}
+
+bool CmdRenderStrokeBatch::create(const vk::UniqueDevice& m_dev, MemoryAllocator& m_allocator, const vk::UniqueCommandPool& m_cmd_pool,
+    const vk::UniqueDescriptorSet& descr, const vk::UniqueRenderPass& renderpass,
+    const vk::UniqueFramebuffer& framebuffer, const vk::UniquePipeline& pipeline,
+    const vk::UniquePipelineLayout& pipeline_layout, const vk::Extent2D extent, ImageState& fb_state, uint32_t capacity)
+{
+    m_descr = *descr;
+    m_renderpass = *renderpass;
+    m_framebuffer = *framebuffer;
+    m_pipeline = *pipeline;
+    m_pipeline_layout = *pipeline_layout;
+    m_fb_state = &fb_state;
+    m_extent = extent;
+    m_size = { extent.width, extent.height };
+    m_capacity = capacity;
+    m_count = 0;
+    m_dirty.clear();
+
+    // instance buffer, mapped for the whole lifetime of the batch
+    auto buf_info = vk::BufferCreateInfo({}, sizeof(dab_t) * capacity, vk::BufferUsageFlagBits::eVertexBuffer);
+    m_dabs_buffer = m_dev->createBufferUnique(buf_info);
+    debug_name(m_dabs_buffer, "CmdRenderStrokeBatch::m_dabs_buffer");
+    m_dabs_memory = m_allocator.bind(m_dabs_buffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    m_dabs = static_cast<dab_t*>(m_dabs_memory.m_ptr);
+
+    auto cmd_info = vk::CommandBufferAllocateInfo(*m_cmd_pool, vk::CommandBufferLevel::ePrimary, 1);
+    m_cmd = std::move(m_dev->allocateCommandBuffersUnique(cmd_info).front());
+    debug_name(m_cmd, "CmdRenderStrokeBatch::m_cmd");
+
+    return true;
+}
+
+void CmdRenderStrokeBatch::add_pass(RenderGraph& graph)
+{
+    // the content is kept: loadOp is eLoad and the graph never transitions
+    // the canvas from eUndefined. Image barriers cannot be limited to a 2D
+    // region, the render area does that.
+    graph.add_pass("strokes", { RenderGraph::color_attachment(*m_fb_state) }, [this](vk::CommandBuffer cmd) {
+        // pixels outside the render area are left untouched
+        vk::Rect2D area = dirty().rect();
+        auto begin_info = vk::RenderPassBeginInfo(m_renderpass, m_framebuffer, area, 0, nullptr);
+
+        auto pipeline_vp = vk::Viewport(0, 0, m_extent.width, m_extent.height, 0, 1);
+        auto pipeline_vpscissor = area;
+
+        cmd.debugMarkerBeginEXT({ "Render Stroke Batch" });
+        cmd.setViewport(0, pipeline_vp);
+        cmd.setScissor(0, pipeline_vpscissor);
+
+        cmd.beginRenderPass(begin_info, vk::SubpassContents::eInline);
+        cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline);
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+            m_pipeline_layout, 0, m_descr, nullptr);
+        vk::DeviceSize dabs_offset = 0;
+        cmd.bindVertexBuffers(0, 1, &m_dabs_buffer.get(), &dabs_offset);
+
+        cmd.debugMarkerInsertEXT({ "Draw Dabs" });
+        cmd.draw(6, m_count, 0, 0);
+
+        cmd.debugMarkerEndEXT();
+        cmd.endRenderPass();
+    });
+}
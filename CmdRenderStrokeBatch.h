@@ -0,0 +1,68 @@
+#pragma once
+#include "utils.h"
+#include "rendergraph.h"
+
+// Draws a whole block of dabs with one instanced draw inside one render pass.
+// Dabs are read from a persistently mapped instance buffer and mixed with the
+// canvas by the blender, so the draw order is the dab order.
+class CmdRenderStrokeBatch
+{
+public:
+    struct dab_t {
+        glm::vec2 pos;
+        float scale;
+        float pressure;
+        glm::vec3 col;
+        // layer of the BrushLibrary array
+        uint32_t tip;
+
+        // pixels covered by the dab quad on a canvas of the given size
+        DirtyRect bounds(glm::ivec2 size) const
+        {
+            glm::vec2 sz = size;
+            DirtyRect r;
+            r.add(glm::ivec2(glm::floor(((pos - scale) * 0.5f + 0.5f) * sz)),
+                glm::ivec2(glm::ceil(((pos + scale) * 0.5f + 0.5f) * sz)));
+            return r;
+        }
+    };
+
+    vk::UniqueCommandBuffer m_cmd;
+    // tex_brush only, the same set for every batch, see create_descr()
+    vk::DescriptorSet m_descr;
+    vk::UniqueBuffer m_dabs_buffer;
+    Allocation m_dabs_memory;
+    dab_t* m_dabs = nullptr;
+    uint32_t m_capacity = 0;
+    uint32_t m_count = 0;
+    DirtyRect m_dirty;
+
+    vk::RenderPass m_renderpass;
+    vk::Framebuffer m_framebuffer;
+    vk::Pipeline m_pipeline;
+    vk::PipelineLayout m_pipeline_layout;
+    ImageState* m_fb_state = nullptr;
+    vk::Extent2D m_extent;
+    glm::ivec2 m_size;
+
+    // the set shared by the batches drawing with this brush
+    static vk::UniqueDescriptorSet create_descr(const vk::UniqueDevice& m_dev, const vk::UniqueDescriptorPool& m_descr_pool,
+        const vk::UniqueDescriptorSetLayout& m_descr_layout, const vk::UniqueSampler& m_sampler,
+        const vk::UniqueImageView& m_brush_view);
+    // points the set at another brush, no submission may use it
+    static void write_descr(const vk::UniqueDevice& m_dev, vk::DescriptorSet descr, const vk::UniqueSampler& m_sampler,
+        const vk::UniqueImageView& m_brush_view);
+    bool create(const vk::UniqueDevice& m_dev, MemoryAllocator& m_allocator, const vk::UniqueCommandPool& m_cmd_pool,
+        const vk::UniqueDescriptorSet& descr, const vk::UniqueRenderPass& renderpass,
+        const vk::UniqueFramebuffer& framebuffer, const vk::UniquePipeline& pipeline,
+        const vk::UniquePipelineLayout& pipeline_layout, const vk::Extent2D extent, ImageState& fb_state, uint32_t capacity);
+    void clear() { m_count = 0; m_dirty.clear(); }
+    bool full() const { return m_count == m_capacity; }
+    void add(const dab_t& dab) { m_dabs[m_count++] = dab; m_dirty.add(dab.bounds(m_size)); }
+    // canvas pixels touched by the dabs added since the last clear()
+    DirtyRect dirty() const { return m_dirty.clamp(m_size); }
+    // the pass drawing the dabs added since the last clear(), the render area
+    // and the scissor are limited to their bounding box. Recorded by
+    // graph.execute(), in m_cmd by the stroke thread.
+    void add_pass(RenderGraph& graph);
+};
@@ -0,0 +1,204 @@
+#include "pch.h"
+#include "CmdRenderStrokeCompute.h"
+#include "tiledcanvas.h"
+#include "debug_message.h"
+
+bool ComputeStrokeSet::create(const vk::PhysicalDevice& pd, MemoryAllocator& allocator, const vk::UniqueDevice& dev,
+    const vk::UniqueDescriptorPool& descr_pool, const vk::UniqueDescriptorSetLayout& descr_layout,
+    uint32_t slots, const vk::UniqueSampler& sampler, const vk::UniqueImageView& brush_view,
+    const vk::UniqueImageView& target_view, vk::Buffer pages)
+{
+    using Cmd = CmdRenderStrokeCompute;
+    m_slots = slots;
+    // dynamic offsets are multiples of the storage buffer alignment
+    vk::DeviceSize align = pd.getProperties().limits.minStorageBufferOffsetAlignment;
+    m_dabs_stride = (sizeof(Cmd::dab_t) * Cmd::max_dabs + align - 1) / align * align;
+    m_tiles_stride = (sizeof(uint32_t) * Cmd::mask_words * Cmd::max_tiles + align - 1) / align * align;
+
+    // dabs, mapped for the whole lifetime of the set
+    auto dabs_info = vk::BufferCreateInfo({}, m_dabs_stride * slots, vk::BufferUsageFlagBits::eStorageBuffer);
+    m_dabs_buffer = dev->createBufferUnique(dabs_info);
+    debug_name(m_dabs_buffer, "ComputeStrokeSet::m_dabs_buffer");
+    m_dabs_memory = allocator.bind(m_dabs_buffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+
+    // per tile dabs bitmask, only touched by the GPU
+    auto tiles_info = vk::BufferCreateInfo({}, m_tiles_stride * slots,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
+    m_tiles_buffer = dev->createBufferUnique(tiles_info);
+    debug_name(m_tiles_buffer, "ComputeStrokeSet::m_tiles_buffer");
+    m_tiles_memory = allocator.bind(m_tiles_buffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    auto descr_info = vk::DescriptorSetAllocateInfo(*descr_pool, 1, &descr_layout.get());
+    m_descr = std::move(dev->allocateDescriptorSetsUnique(descr_info).front());
+
+    auto descr_image_info_fb = vk::DescriptorImageInfo(nullptr,
+        *target_view, vk::ImageLayout::eGeneral);
+    auto descr_image_info_brush = vk::DescriptorImageInfo(*sampler,
+        *brush_view, vk::ImageLayout::eShaderReadOnlyOptimal);
+    auto descr_dabs_info = vk::DescriptorBufferInfo(*m_dabs_buffer, 0, sizeof(Cmd::dab_t) * Cmd::max_dabs);
+    auto descr_tiles_info = vk::DescriptorBufferInfo(*m_tiles_buffer, 0,
+        sizeof(uint32_t) * Cmd::mask_words * Cmd::max_tiles);
+    auto descr_pages_info = vk::DescriptorBufferInfo(pages, 0, VK_WHOLE_SIZE);
+    std::array<vk::WriteDescriptorSet, 5> descr_write = {
+        // canvas or pages pool
+        vk::WriteDescriptorSet(*m_descr, 0, 0, 1,
+            vk::DescriptorType::eStorageImage, &descr_image_info_fb, nullptr, nullptr),
+        // tex_brush
+        vk::WriteDescriptorSet(*m_descr, 1, 0, 1,
+            vk::DescriptorType::eCombinedImageSampler, &descr_image_info_brush, nullptr, nullptr),
+        // dabs
+        vk::WriteDescriptorSet(*m_descr, 2, 0, 1,
+            vk::DescriptorType::eStorageBufferDynamic, nullptr, &descr_dabs_info, nullptr),
+        // tiles mask
+        vk::WriteDescriptorSet(*m_descr, 3, 0, 1,
+            vk::DescriptorType::eStorageBufferDynamic, nullptr, &descr_tiles_info, nullptr),
+        // page table
+        vk::WriteDescriptorSet(*m_descr, 4, 0, 1,
+            vk::DescriptorType::eStorageBuffer, nullptr, &descr_pages_info, nullptr),
+    };
+    dev->updateDescriptorSets(vk::ArrayProxy<const vk::WriteDescriptorSet>(pages ? 5 : 4, descr_write.data()), nullptr);
+
+    return true;
+}
+
+void ComputeStrokeSet::set_brush(const vk::UniqueDevice& dev, const vk::UniqueSampler& sampler,
+    const vk::UniqueImageView& brush_view)
+{
+    auto descr_image_info_brush = vk::DescriptorImageInfo(*sampler,
+        *brush_view, vk::ImageLayout::eShaderReadOnlyOptimal);
+    // tex_brush
+    dev->updateDescriptorSets(vk::WriteDescriptorSet(*m_descr, 1, 0, 1,
+        vk::DescriptorType::eCombinedImageSampler, &descr_image_info_brush, nullptr, nullptr), nullptr);
+}
+
+void ComputeStrokeSet::set_target(const vk::UniqueDevice& dev, const vk::UniqueImageView& target_view)
+{
+    auto descr_image_info_fb = vk::DescriptorImageInfo(nullptr, *target_view, vk::ImageLayout::eGeneral);
+    // canvas or pages pool
+    dev->updateDescriptorSets(vk::WriteDescriptorSet(*m_descr, 0, 0, 1,
+        vk::DescriptorType::eStorageImage, &descr_image_info_fb, nullptr, nullptr), nullptr);
+}
+
+void CmdRenderStrokeCompute::create_cmd(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& m_cmd_pool,
+    const ComputeStrokeSet& set, uint32_t slot)
+{
+    clear();
+
+    m_descr = *set.m_descr;
+    m_tiles_buffer = *set.m_tiles_buffer;
+    m_offsets = { (uint32_t)(set.m_dabs_stride * slot), (uint32_t)(set.m_tiles_stride * slot) };
+    m_dabs = reinterpret_cast<dab_t*>(static_cast<uint8_t*>(set.m_dabs_memory.m_ptr) + m_offsets[0]);
+
+    auto cmd_info = vk::CommandBufferAllocateInfo(*m_cmd_pool, vk::CommandBufferLevel::ePrimary, 1);
+    m_cmd = std::move(m_dev->allocateCommandBuffersUnique(cmd_info).front());
+    debug_name(m_cmd, "CmdRenderStrokeCompute::m_cmd");
+}
+
+bool CmdRenderStrokeCompute::create(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& m_cmd_pool,
+    const ComputeStrokeSet& set, uint32_t slot, const vk::UniquePipeline& bin_pipeline,
+    const vk::UniquePipeline& raster_pipeline, const vk::UniquePipelineLayout& pipeline_layout,
+    glm::ivec2 size, ImageState& fb_state)
+{
+    m_bin_pipeline = *bin_pipeline;
+    m_raster_pipeline = *raster_pipeline;
+    m_pipeline_layout = *pipeline_layout;
+    m_fb_state = &fb_state;
+    m_canvas = nullptr;
+    m_size = size;
+    create_cmd(m_dev, m_cmd_pool, set, slot);
+    return true;
+}
+
+bool CmdRenderStrokeCompute::create(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& m_cmd_pool,
+    const ComputeStrokeSet& set, uint32_t slot, TiledCanvas& canvas)
+{
+    m_bin_pipeline = *canvas.m_bin_pipeline;
+    m_raster_pipeline = *canvas.m_raster_pipeline;
+    m_pipeline_layout = *canvas.m_compute_layout;
+    m_fb_state = &canvas.m_pool_state;
+    m_canvas = &canvas;
+    m_size = canvas.m_size;
+    create_cmd(m_dev, m_cmd_pool, set, slot);
+    return true;
+}
+
+bool CmdRenderStrokeCompute::can_add(const dab_t& dab) const
+{
+    if (full())
+        return false;
+    DirtyRect r = m_dirty;
+    r.add(dab.bounds(m_size));
+    r = r.clamp(m_size);
+    if (r.empty())
+        return true;
+    glm::ivec2 tiles = (r.max + glm::ivec2(tile_size - 1)) / glm::ivec2(tile_size) - r.min / glm::ivec2(tile_size);
+    return (uint32_t)(tiles.x * tiles.y) <= max_tiles;
+}
+
+void CmdRenderStrokeCompute::add(const dab_t& dab)
+{
+    DirtyRect r = dab.bounds(m_size);
+    m_dabs[m_count++] = dab;
+    m_dirty.add(r);
+    if (m_canvas && !m_canvas->touch(r) && !m_exhausted)
+    {
+        std::cout << "canvas pages pool exhausted\n";
+        m_exhausted = true;
+    }
+}
+
+void CmdRenderStrokeCompute::add_pass(RenderGraph& graph)
+{
+    // the pages pool is also cleared by a transfer at the start of the pass
+    auto use = RenderGraph::storage(*m_fb_state);
+    if (m_canvas)
+    {
+        use.access |= vk::AccessFlagBits::eTransferWrite;
+        use.stages |= vk::PipelineStageFlagBits::eTransfer;
+    }
+
+    graph.add_pass("strokes compute", { use }, [this](vk::CommandBuffer cmd) {
+        DirtyRect area = dirty();
+        glm::ivec2 tile_min = area.empty() ? glm::ivec2(0) : area.min / glm::ivec2(tile_size);
+        glm::ivec2 tile_max = area.empty() ? glm::ivec2(0) : (area.max + glm::ivec2(tile_size - 1)) / glm::ivec2(tile_size);
+
+        push_t push;
+        push.canvas_size = m_size;
+        push.tiles = tile_max - tile_min;
+        push.tile_offset = tile_min;
+        push.dab_count = m_count;
+        vk::DeviceSize tiles_bytes = sizeof(uint32_t) * mask_words * std::max(push.tiles.x * push.tiles.y, 1);
+
+        cmd.debugMarkerBeginEXT({ "Render Stroke Compute" });
+        if (m_canvas)
+            m_canvas->record_clears(cmd);
+
+        cmd.fillBuffer(m_tiles_buffer, m_offsets[1], tiles_bytes, 0);
+        vk::BufferMemoryBarrier bmb;
+        bmb.srcQueueFamilyIndex = bmb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bmb.buffer = m_tiles_buffer;
+        bmb.offset = m_offsets[1];
+        bmb.size = tiles_bytes;
+        bmb.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        bmb.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader,
+            {}, 0, nullptr, 1, &bmb, 0, nullptr);
+
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_pipeline_layout, 0, m_descr, m_offsets);
+        cmd.pushConstants(m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(push), &push);
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, m_bin_pipeline);
+        cmd.debugMarkerInsertEXT({ "Bin Dabs" });
+        cmd.dispatch((m_count + 63) / 64, 1, 1);
+
+        bmb.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+        bmb.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader,
+            {}, 0, nullptr, 1, &bmb, 0, nullptr);
+
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, m_raster_pipeline);
+        cmd.debugMarkerInsertEXT({ "Raster Tiles" });
+        cmd.dispatch(push.tiles.x, push.tiles.y, 1);
+        cmd.debugMarkerEndEXT();
+    });
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "utils.h"
+#include "CmdRenderStrokeBatch.h"
+#include "rendergraph.h"
+
+class TiledCanvas;
+class ComputeStrokeSet;
+
+// Compute stroke backend: dabs are binned to canvas tiles (shader-bin.comp) and
+// every tile composites its dabs in order (shader-raster.comp), writing the
+// canvas as a storage image. No per-dab barriers and no framebuffer feedback.
+// The target is either a RenderTarget image or the pages of a TiledCanvas.
+class CmdRenderStrokeCompute
+{
+public:
+    using dab_t = CmdRenderStrokeBatch::dab_t;
+    static constexpr uint32_t tile_size = 16;
+    static constexpr uint32_t max_dabs = 1024;
+    static constexpr uint32_t mask_words = max_dabs / 32;
+    // tiles binned per batch, the dirty rect of a batch is kept under this
+    static constexpr uint32_t max_tiles = 256 * 256;
+
+    struct push_t {
+        glm::ivec2 canvas_size;
+        glm::ivec2 tiles;
+        glm::ivec2 tile_offset;
+        uint32_t dab_count;
+    };
+
+    vk::UniqueCommandBuffer m_cmd;
+    // shared with the other slots, m_offsets select the ranges of this one
+    vk::DescriptorSet m_descr;
+    vk::Buffer m_tiles_buffer;
+    std::array<uint32_t, 2> m_offsets;
+    dab_t* m_dabs = nullptr;
+    uint32_t m_capacity = max_dabs;
+    uint32_t m_count = 0;
+    DirtyRect m_dirty;
+    // a dab of this batch found no free page, reported once
+    bool m_exhausted = false;
+
+    vk::Pipeline m_bin_pipeline;
+    vk::Pipeline m_raster_pipeline;
+    vk::PipelineLayout m_pipeline_layout;
+    ImageState* m_fb_state = nullptr;
+    TiledCanvas* m_canvas = nullptr;
+    glm::ivec2 m_size;
+
+    // slot: the range of the set buffers used by this command
+    bool create(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& m_cmd_pool,
+        const ComputeStrokeSet& set, uint32_t slot, const vk::UniquePipeline& bin_pipeline,
+        const vk::UniquePipeline& raster_pipeline, const vk::UniquePipelineLayout& pipeline_layout,
+        glm::ivec2 size, ImageState& fb_state);
+    bool create(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& m_cmd_pool,
+        const ComputeStrokeSet& set, uint32_t slot, TiledCanvas& canvas);
+    void clear() { m_count = 0; m_dirty.clear(); m_exhausted = false; }
+    bool full() const { return m_count == m_capacity; }
+    // false when the dab would not fit in this batch, record and submit first
+    bool can_add(const dab_t& dab) const;
+    void add(const dab_t& dab);
+    // canvas pixels touched by the dabs added since the last clear()
+    DirtyRect dirty() const { return m_dirty.clamp(m_size); }
+    // the pass compositing the dabs added since the last clear(), only the
+    // tiles overlapping their bounding box are binned and composited
+    void add_pass(RenderGraph& graph);
+private:
+    void create_cmd(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& m_cmd_pool,
+        const ComputeStrokeSet& set, uint32_t slot);
+};
+
+// The dabs and tiles buffers of all the compute slots of a target and the one
+// descriptor set they are bound with. Every slot has its range of the buffers,
+// given as dynamic offsets when binding the set, so the set is allocated and
+// written once whatever the number of slots.
+class ComputeStrokeSet
+{
+public:
+    vk::UniqueDescriptorSet m_descr;
+    vk::UniqueBuffer m_dabs_buffer;
+    Allocation m_dabs_memory;
+    vk::UniqueBuffer m_tiles_buffer;
+    Allocation m_tiles_memory;
+    vk::DeviceSize m_dabs_stride = 0;
+    vk::DeviceSize m_tiles_stride = 0;
+    uint32_t m_slots = 0;
+
+    // target_view is the canvas storage image, pages the page table of a
+    // TiledCanvas (binding 4 of its layout)
+    bool create(const vk::PhysicalDevice& pd, MemoryAllocator& allocator, const vk::UniqueDevice& dev,
+        const vk::UniqueDescriptorPool& descr_pool, const vk::UniqueDescriptorSetLayout& descr_layout,
+        uint32_t slots, const vk::UniqueSampler& sampler, const vk::UniqueImageView& brush_view,
+        const vk::UniqueImageView& target_view, vk::Buffer pages = nullptr);
+    // points the set at another brush, no submission may use it
+    void set_brush(const vk::UniqueDevice& dev, const vk::UniqueSampler& sampler, const vk::UniqueImageView& brush_view);
+    // points the set at another target, e.g. a grown pages pool, no submission may use it
+    void set_target(const vk::UniqueDevice& dev, const vk::UniqueImageView& target_view);
+};
@@ -0,0 +1,67 @@
+#include "pch.h"
+#include "CmdRenderStrokeSegments.h"
+#include "debug_message.h"
+
+bool CmdRenderStrokeSegments::create(const vk::UniqueDevice& m_dev, MemoryAllocator& m_allocator, const vk::UniqueCommandPool& m_cmd_pool,
+    const vk::UniqueRenderPass& renderpass, const vk::UniqueFramebuffer& framebuffer, const vk::UniquePipeline& pipeline,
+    const vk::UniquePipelineLayout& pipeline_layout, const vk::Extent2D extent, ImageState& fb_state,
+    uint32_t capacity)
+{
+    m_renderpass = *renderpass;
+    m_framebuffer = *framebuffer;
+    m_pipeline = *pipeline;
+    m_pipeline_layout = *pipeline_layout;
+    m_fb_state = &fb_state;
+    m_extent = extent;
+    m_size = { extent.width, extent.height };
+    m_capacity = capacity;
+    m_count = 0;
+    m_dirty.clear();
+
+    // instance buffer, mapped for the whole lifetime of the batch
+    auto buf_info = vk::BufferCreateInfo({}, sizeof(segment_t) * capacity, vk::BufferUsageFlagBits::eVertexBuffer);
+    m_segments_buffer = m_dev->createBufferUnique(buf_info);
+    debug_name(m_segments_buffer, "CmdRenderStrokeSegments::m_segments_buffer");
+    m_segments_memory = m_allocator.bind(m_segments_buffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    m_segments = static_cast<segment_t*>(m_segments_memory.m_ptr);
+
+    auto cmd_info = vk::CommandBufferAllocateInfo(*m_cmd_pool, vk::CommandBufferLevel::ePrimary, 1);
+    m_cmd = std::move(m_dev->allocateCommandBuffersUnique(cmd_info).front());
+    debug_name(m_cmd, "CmdRenderStrokeSegments::m_cmd");
+
+    return true;
+}
+
+void CmdRenderStrokeSegments::add_pass(RenderGraph& graph)
+{
+    // same use of the canvas as CmdRenderStrokeBatch, the content is kept
+    graph.add_pass("segments", { RenderGraph::color_attachment(*m_fb_state) }, [this](vk::CommandBuffer cmd) {
+        // loadOp is eLoad, pixels outside the render area are left untouched
+        vk::Rect2D area = dirty().rect();
+        auto begin_info = vk::RenderPassBeginInfo(m_renderpass, m_framebuffer, area, 0, nullptr);
+
+        auto pipeline_vp = vk::Viewport(0, 0, m_extent.width, m_extent.height, 0, 1);
+        auto pipeline_vpscissor = area;
+
+        push_t push;
+        push.half_size = glm::vec2(m_size) * 0.5f;
+
+        cmd.debugMarkerBeginEXT({ "Render Stroke Segments" });
+        cmd.setViewport(0, pipeline_vp);
+        cmd.setScissor(0, pipeline_vpscissor);
+
+        cmd.beginRenderPass(begin_info, vk::SubpassContents::eInline);
+        cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline);
+        cmd.pushConstants(m_pipeline_layout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+            0, sizeof(push_t), &push);
+        vk::DeviceSize segments_offset = 0;
+        cmd.bindVertexBuffers(0, 1, &m_segments_buffer.get(), &segments_offset);
+
+        cmd.debugMarkerInsertEXT({ "Draw Segments" });
+        cmd.draw(6, m_count, 0, 0);
+
+        cmd.debugMarkerEndEXT();
+        cmd.endRenderPass();
+    });
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "utils.h"
+#include "rendergraph.h"
+
+// Hard round strokes as analytic capsules: every segment of the input path is
+// one instanced quad and shader-segment.frag computes its coverage from the
+// signed distance, so there is no dab spacing along the segment.
+class CmdRenderStrokeSegments
+{
+public:
+    struct segment_t {
+        glm::vec2 a;
+        glm::vec2 b;
+        glm::vec2 radius; // at a and b
+        glm::vec4 col;
+        // the previous segment of the stroke, from prev.xy to a, prev.z is its
+        // radius at prev.xy. prev.w is 0 when the segment starts the stroke.
+        glm::vec4 prev;
+
+        // pixels covered by the segment quad on a canvas of the given size
+        DirtyRect bounds(glm::ivec2 size) const
+        {
+            glm::vec2 sz = size;
+            float r = glm::max(radius.x, radius.y) + 2.f / glm::min(sz.x, sz.y);
+            glm::vec2 pmin = glm::min(a, b) - r;
+            glm::vec2 pmax = glm::max(a, b) + r;
+            DirtyRect d;
+            d.add(glm::ivec2(glm::floor((pmin * 0.5f + 0.5f) * sz)),
+                glm::ivec2(glm::ceil((pmax * 0.5f + 0.5f) * sz)));
+            return d;
+        }
+    };
+
+    struct push_t {
+        glm::vec2 half_size;
+    };
+
+    vk::UniqueCommandBuffer m_cmd;
+    vk::UniqueBuffer m_segments_buffer;
+    Allocation m_segments_memory;
+    segment_t* m_segments = nullptr;
+    uint32_t m_capacity = 0;
+    uint32_t m_count = 0;
+    DirtyRect m_dirty;
+
+    vk::RenderPass m_renderpass;
+    vk::Framebuffer m_framebuffer;
+    vk::Pipeline m_pipeline;
+    vk::PipelineLayout m_pipeline_layout;
+    ImageState* m_fb_state = nullptr;
+    vk::Extent2D m_extent;
+    glm::ivec2 m_size;
+
+    bool create(const vk::UniqueDevice& m_dev, MemoryAllocator& m_allocator, const vk::UniqueCommandPool& m_cmd_pool,
+        const vk::UniqueRenderPass& renderpass, const vk::UniqueFramebuffer& framebuffer, const vk::UniquePipeline& pipeline,
+        const vk::UniquePipelineLayout& pipeline_layout, const vk::Extent2D extent, ImageState& fb_state,
+        uint32_t capacity);
+    void clear() { m_count = 0; m_dirty.clear(); }
+    bool full() const { return m_count == m_capacity; }
+    void add(const segment_t& seg) { m_segments[m_count++] = seg; m_dirty.add(seg.bounds(m_size)); }
+    // canvas pixels touched by the segments added since the last clear()
+    DirtyRect dirty() const { return m_dirty.clamp(m_size); }
+    // the pass drawing the segments added since the last clear(), the render
+    // area and the scissor are limited to their bounding box
+    void add_pass(RenderGraph& graph);
+};
@@ -1,51 +1,79 @@
 #include "pch.h"
 #include "CmdRenderToScreen.h"
 
-bool CmdRenderToScreen::create(const vk::UniqueDevice& m_dev, const vk::PhysicalDevice& m_pd, const vk::UniqueCommandPool& m_cmd_pool, 
-    const vk::UniqueDescriptorPool& m_descr_pool, const vk::UniqueDescriptorSetLayout& m_descr_layout, 
-    const vk::UniqueRenderPass& m_renderpass, const vk::UniqueFramebuffer& m_framebuffer, const vk::UniquePipeline& m_pipeline, 
-    const vk::UniquePipelineLayout& m_pipeline_layout, const vk::UniqueSampler& m_sampler, 
-    const vk::Extent2D m_swapchain_extent, const vk::UniqueImageView& m_tex_view, glm::vec3 clear_color)
+vk::UniqueDescriptorSet CmdRenderToScreen::create_descr(const vk::UniqueDevice& m_dev,
+    const vk::UniqueDescriptorPool& m_descr_pool, const vk::UniqueDescriptorSetLayout& m_descr_layout,
+    const vk::UniqueSampler& m_sampler, const vk::UniqueImageView& m_tex_view, vk::Buffer m_pages)
 {
-    m_ubo.create(m_pd, m_dev);
-
-    auto cmd_info = vk::CommandBufferAllocateInfo(*m_cmd_pool, vk::CommandBufferLevel::ePrimary, 1);
-    m_cmd = std::move(m_dev->allocateCommandBuffersUnique(cmd_info).front());
-
     auto descr_info = vk::DescriptorSetAllocateInfo(*m_descr_pool, 1, &m_descr_layout.get());
-    m_descr.release();
-    m_descr = std::move(m_dev->allocateDescriptorSetsUnique(descr_info).front());
+    vk::UniqueDescriptorSet descr = std::move(m_dev->allocateDescriptorSetsUnique(descr_info).front());
+    write_descr(m_dev, *descr, m_sampler, m_tex_view, m_pages);
+    return descr;
+}
 
-    auto descr_vert_buffer_info = vk::DescriptorBufferInfo(*m_ubo.m_buffer, 0, VK_WHOLE_SIZE);
+void CmdRenderToScreen::write_descr(const vk::UniqueDevice& m_dev, vk::DescriptorSet descr,
+    const vk::UniqueSampler& m_sampler, const vk::UniqueImageView& m_tex_view, vk::Buffer m_pages)
+{
+    // a sparse canvas (m_pages set) keeps its pages pool in eGeneral
     auto descr_image_info_fb = vk::DescriptorImageInfo(*m_sampler,
-        *m_tex_view, vk::ImageLayout::eShaderReadOnlyOptimal);
+        *m_tex_view, m_pages ? vk::ImageLayout::eGeneral : vk::ImageLayout::eShaderReadOnlyOptimal);
+    auto descr_pages_info = vk::DescriptorBufferInfo(m_pages, 0, VK_WHOLE_SIZE);
     std::array<vk::WriteDescriptorSet, 2> descr_write = {
-        vk::WriteDescriptorSet(*m_descr, 0, 0, 1,
-            vk::DescriptorType::eUniformBuffer, nullptr, &descr_vert_buffer_info, nullptr),
-        vk::WriteDescriptorSet(*m_descr, 1, 0, 1,
+        vk::WriteDescriptorSet(descr, 1, 0, 1,
             vk::DescriptorType::eCombinedImageSampler, &descr_image_info_fb, nullptr, nullptr),
+        vk::WriteDescriptorSet(descr, 2, 0, 1,
+            vk::DescriptorType::eStorageBuffer, nullptr, &descr_pages_info, nullptr),
     };
-    m_dev->updateDescriptorSets(descr_write, nullptr);
+    m_dev->updateDescriptorSets(vk::ArrayProxy<const vk::WriteDescriptorSet>(m_pages ? 2 : 1, descr_write.data()), nullptr);
+}
+
+bool CmdRenderToScreen::create(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& m_cmd_pool,
+    const vk::UniqueDescriptorSet& m_descr, const vk::UniqueRenderPass& m_renderpass,
+    const vk::UniqueRenderPass& m_renderpass_load, const vk::UniqueFramebuffer& m_framebuffer,
+    const vk::UniquePipeline& m_pipeline, const vk::UniquePipelineLayout& m_pipeline_layout,
+    const vk::Extent2D m_swapchain_extent, glm::vec3 clear_color)
+{
+    this->m_descr = *m_descr;
+    this->m_renderpass = *m_renderpass;
+    this->m_renderpass_load = *m_renderpass_load;
+    this->m_framebuffer = *m_framebuffer;
+    this->m_pipeline = *m_pipeline;
+    this->m_pipeline_layout = *m_pipeline_layout;
+    m_extent = m_swapchain_extent;
+    m_clear_color = clear_color;
 
-    vk::ClearValue clearColor(std::array<float, 4>{ clear_color.r, clear_color.g, clear_color.b, 1.f });
-    auto begin_info = vk::RenderPassBeginInfo(*m_renderpass, *m_framebuffer,
-        vk::Rect2D({ 0, 0 }, m_swapchain_extent), 1, &clearColor);
+    auto cmd_info = vk::CommandBufferAllocateInfo(*m_cmd_pool, vk::CommandBufferLevel::ePrimary, 1);
+    m_cmd = std::move(m_dev->allocateCommandBuffersUnique(cmd_info).front());
 
-    auto pipeline_vp = vk::Viewport(0, 0, m_swapchain_extent.width, m_swapchain_extent.height, 0, 1);
-    auto pipeline_vpscissor = vk::Rect2D({ 0, 0 }, m_swapchain_extent);
+    return true;
+}
 
-    m_cmd->begin(vk::CommandBufferBeginInfo());
+void CmdRenderToScreen::record(const push_t& push, const DirtyRect& area, const push_t* navigator)
+{
+    bool partial = !area.empty();
+    vk::ClearValue clearColor(std::array<float, 4>{ m_clear_color.r, m_clear_color.g, m_clear_color.b, 1.f });
+    auto pipeline_vpscissor = partial ? area.rect() : vk::Rect2D({ 0, 0 }, m_extent);
+    auto begin_info = vk::RenderPassBeginInfo(partial ? m_renderpass_load : m_renderpass, m_framebuffer,
+        pipeline_vpscissor, partial ? 0 : 1, &clearColor);
+
+    auto pipeline_vp = vk::Viewport(0, 0, m_extent.width, m_extent.height, 0, 1);
+
+    m_cmd->begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
     m_cmd->setViewport(0, pipeline_vp);
     m_cmd->setScissor(0, pipeline_vpscissor);
 
     m_cmd->beginRenderPass(begin_info, vk::SubpassContents::eInline);
-    m_cmd->bindPipeline(vk::PipelineBindPoint::eGraphics, *m_pipeline);
+    m_cmd->bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline);
     m_cmd->bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
-        *m_pipeline_layout, 0, *m_descr, nullptr);
+        m_pipeline_layout, 0, m_descr, nullptr);
+    m_cmd->pushConstants(m_pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(push_t), &push);
     m_cmd->draw(6, 1, 0, 0);
+    if (navigator)
+    {
+        m_cmd->pushConstants(m_pipeline_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(push_t), navigator);
+        m_cmd->draw(6, 1, 0, 0);
+    }
 
     m_cmd->endRenderPass();
     m_cmd->end();
-
-    return true;
 }
@@ -4,17 +4,48 @@
 class CmdRenderToScreen
 {
 public:
-    struct vert_ubo_t {
+    // push constants of shader-fill.vert
+    struct push_t {
         glm::mat4 mvp;
     };
 
     vk::UniqueCommandBuffer m_cmd;
-    vk::UniqueDescriptorSet m_descr;
-    UBO<vert_ubo_t> m_ubo;
+    // the display source, shared by the passes of all the swapchain images
+    vk::DescriptorSet m_descr;
 
-    bool create(const vk::UniqueDevice& m_dev, const vk::PhysicalDevice& m_pd, const vk::UniqueCommandPool& m_cmd_pool,
-        const vk::UniqueDescriptorPool& m_descr_pool, const vk::UniqueDescriptorSetLayout& m_descr_layout, 
-        const vk::UniqueRenderPass& m_renderpass, const vk::UniqueFramebuffer& m_framebuffer, const vk::UniquePipeline& m_pipeline, 
-        const vk::UniquePipelineLayout& m_pipeline_layout, const vk::UniqueSampler& m_sampler, 
-        const vk::Extent2D m_swapchain_extent, const vk::UniqueImageView& m_tex_view, glm::vec3 clear_color = glm::vec3(1, 0, 0));
+    vk::RenderPass m_renderpass;
+    vk::RenderPass m_renderpass_load;
+    vk::Framebuffer m_framebuffer;
+    vk::Pipeline m_pipeline;
+    vk::PipelineLayout m_pipeline_layout;
+    vk::Extent2D m_extent;
+    glm::vec3 m_clear_color;
+
+    // the set sampling m_tex_view, a sparse canvas also binds its page table
+    // (m_pages) and keeps its pages pool in eGeneral. Written once, swapchain
+    // images and resizes reuse it.
+    static vk::UniqueDescriptorSet create_descr(const vk::UniqueDevice& m_dev, const vk::UniqueDescriptorPool& m_descr_pool,
+        const vk::UniqueDescriptorSetLayout& m_descr_layout, const vk::UniqueSampler& m_sampler,
+        const vk::UniqueImageView& m_tex_view, vk::Buffer m_pages = nullptr);
+    // points the set at another view, no submission may use it
+    static void write_descr(const vk::UniqueDevice& m_dev, vk::DescriptorSet descr, const vk::UniqueSampler& m_sampler,
+        const vk::UniqueImageView& m_tex_view, vk::Buffer m_pages = nullptr);
+    // m_cmd_pool needs eResetCommandBuffer, m_cmd is re-recorded for every frame.
+    // m_renderpass clears the whole image, m_renderpass_load keeps the
+    // presented content for partial redraws.
+    bool create(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& m_cmd_pool,
+        const vk::UniqueDescriptorSet& m_descr, const vk::UniqueRenderPass& m_renderpass,
+        const vk::UniqueRenderPass& m_renderpass_load, const vk::UniqueFramebuffer& m_framebuffer,
+        const vk::UniquePipeline& m_pipeline, const vk::UniquePipelineLayout& m_pipeline_layout,
+        const vk::Extent2D m_swapchain_extent, glm::vec3 clear_color = glm::vec3(1, 0, 0));
+    // a new swapchain, the descriptor set and command buffer are kept
+    void resize(const vk::UniqueFramebuffer& framebuffer, vk::Extent2D extent)
+    {
+        m_framebuffer = *framebuffer;
+        m_extent = extent;
+    }
+    // redraws area only when it is not empty, the image must hold its last
+    // presented frame then. navigator draws the canvas a second time on top,
+    // small enough to be read from its low mips.
+    void record(const push_t& push, const DirtyRect& area = DirtyRect(), const push_t* navigator = nullptr);
 };
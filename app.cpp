@@ -37,31 +37,41 @@ bool App::init_vulkan()
     init_debug_message(m_instance);
 #endif
 
-    create_window();
-    WacomTablet::I.init(m_wnd);
+    if (!m_headless)
+    {
+        create_window();
+        WacomTablet::I.init(m_wnd);
 
-    auto surf_info = vk::Win32SurfaceCreateInfoKHR({}, GetModuleHandle(0), m_wnd);
-    m_surf = m_instance->createWin32SurfaceKHRUnique(surf_info);
+        auto surf_info = vk::Win32SurfaceCreateInfoKHR({}, GetModuleHandle(0), m_wnd);
+        m_surf = m_instance->createWin32SurfaceKHRUnique(surf_info);
+    }
 
     std::tie(m_pd, m_dev, m_family_idx) = find_device();
+    m_allocator.create(m_pd, m_dev);
 
     // set window title to device name
     auto props = m_pd.getProperties();
     m_device_name = props.deviceName;
     std::string title = fmt::format("Vulkan {}", m_device_name);
-    SetWindowTextA(m_wnd, title.c_str());
+    if (m_wnd)
+        SetWindowTextA(m_wnd, title.c_str());
 
-    m_main_queue = m_dev->getQueue(m_family_idx, 0);
+    m_queues.create(m_dev, m_queue_families);
     auto cmd_pool_info = vk::CommandPoolCreateInfo({}, m_family_idx);
     m_cmd_pool = m_dev->createCommandPoolUnique(cmd_pool_info);
+    m_submit.create(m_dev, m_queues, QueueKind::graphics);
+    m_frame_submit.create(m_dev, m_queues, QueueKind::graphics);
+    if (m_headless)
+        return true;
 
+    // long lived sets only, the display source: swapchain images share it
     std::array<vk::DescriptorPoolSize, 2> descr_pool_size = {
-        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, 1000),
-        vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 1000),
+        vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 4),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 4),
     };
     auto descr_pool_info = vk::DescriptorPoolCreateInfo(
         vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-        2000, descr_pool_size.size(), descr_pool_size.data());
+        4, descr_pool_size.size(), descr_pool_size.data());
     m_descr_pool = m_dev->createDescriptorPoolUnique(descr_pool_info);
 
     init_pipeline();
@@ -101,16 +111,16 @@ bool App::init_pipeline()
     auto pipeline_dyn = vk::PipelineDynamicStateCreateInfo({},
         pipeline_dyn_states.size(), pipeline_dyn_states.data());
 
-    std::array<vk::DescriptorSetLayoutBinding, 2> pipeline_layout_bind = {
-        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eUniformBuffer,
-            1, vk::ShaderStageFlagBits::eVertex, nullptr),
+    // the mvp is a push constant
+    std::array<vk::DescriptorSetLayoutBinding, 1> pipeline_layout_bind = {
         vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eCombinedImageSampler,
             1, vk::ShaderStageFlagBits::eFragment, nullptr),
     };
     auto pipeline_layout_descr_info = vk::DescriptorSetLayoutCreateInfo({},
         pipeline_layout_bind.size(), pipeline_layout_bind.data());
     m_descr_layout = m_dev->createDescriptorSetLayoutUnique(pipeline_layout_descr_info);
-    auto pipeline_layout_info = vk::PipelineLayoutCreateInfo({}, 1, &m_descr_layout.get(), 0, nullptr);
+    auto pipeline_push_range = vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4));
+    auto pipeline_layout_info = vk::PipelineLayoutCreateInfo({}, 1, &m_descr_layout.get(), 1, &pipeline_push_range);
     m_pipeline_layout = m_dev->createPipelineLayoutUnique(pipeline_layout_info);
 
     auto pipeline_renderpass_fb = vk::AttachmentDescription({}, vk::Format::eB8G8R8A8Unorm,
@@ -121,6 +131,9 @@ bool App::init_pipeline()
     auto pipeline_subpass = vk::SubpassDescription({}, vk::PipelineBindPoint::eGraphics, 0, nullptr, 1, &pipeline_subpass_color_ref);
     auto pipeline_renderpass_info = vk::RenderPassCreateInfo({}, 1, &pipeline_renderpass_fb, 1, &pipeline_subpass, 0, nullptr);
     m_renderpass = m_dev->createRenderPassUnique(pipeline_renderpass_info);
+    pipeline_renderpass_fb.loadOp = vk::AttachmentLoadOp::eLoad;
+    pipeline_renderpass_fb.initialLayout = vk::ImageLayout::ePresentSrcKHR;
+    m_renderpass_load = m_dev->createRenderPassUnique(pipeline_renderpass_info);
 
     auto pipeline_info = vk::GraphicsPipelineCreateInfo({},
         2, pipeline_stages,
@@ -148,10 +161,19 @@ std::tuple<vk::PhysicalDevice, vk::UniqueDevice, uint32_t> App::find_device()
         auto qf_props = pd.getQueueFamilyProperties();
         for (int idx = 0; idx < qf_props.size(); idx++)
         {
-            if (qf_props[idx].queueFlags & vk::QueueFlagBits::eGraphics && pd.getSurfaceSupportKHR(idx, *m_surf))
+            if (qf_props[idx].queueFlags & vk::QueueFlagBits::eGraphics &&
+                (!m_surf || pd.getSurfaceSupportKHR(idx, *m_surf)))
             {
+                // one queue per distinct family, kinds without a dedicated one share graphics
                 float priority = 0.0f;
-                auto queue_info = vk::DeviceQueueCreateInfo({}, idx, 1u, &priority);
+                m_queue_families = QueueArbiter::find_families(pd, idx);
+                std::vector<vk::DeviceQueueCreateInfo> queue_info;
+                for (uint32_t family : m_queue_families.idx)
+                {
+                    if (std::none_of(queue_info.begin(), queue_info.end(),
+                        [&](const vk::DeviceQueueCreateInfo& qi) { return qi.queueFamilyIndex == family; }))
+                        queue_info.emplace_back(vk::DeviceQueueCreateFlags(), family, 1u, &priority);
+                }
                 std::vector<const char*> inst_layers;
                 std::vector<const char*> inst_ext{ 
                     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -159,10 +181,16 @@ std::tuple<vk::PhysicalDevice, vk::UniqueDevice, uint32_t> App::find_device()
                     VK_EXT_DEBUG_MARKER_EXTENSION_NAME,
 #endif
                 };
+                // optional, lets the compositor copy only the redrawn region
+                auto dev_ext = pd.enumerateDeviceExtensionProperties();
+                m_incremental_present = std::any_of(dev_ext.begin(), dev_ext.end(),
+                    [](const vk::ExtensionProperties& e) { return strcmp(e.extensionName, VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME) == 0; });
+                if (m_incremental_present)
+                    inst_ext.push_back(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
                 vk::PhysicalDeviceFeatures dev_feat;
                 dev_feat.samplerAnisotropy = true;
                 dev_feat.sampleRateShading = true;
-                auto dev_info = vk::DeviceCreateInfo({}, 1, &queue_info,
+                auto dev_info = vk::DeviceCreateInfo({}, queue_info.size(), queue_info.data(),
                     inst_layers.size(), inst_layers.data(), inst_ext.size(), inst_ext.data(), &dev_feat);
                 if (auto dev = pd.createDeviceUnique(dev_info))
                 {
@@ -179,31 +207,69 @@ void App::create_swapchain()
     auto surface_formats = m_pd.getSurfaceFormatsKHR(*m_surf);
     auto surface_caps = m_pd.getSurfaceCapabilitiesKHR(*m_surf);
 
-    if (surface_caps.currentExtent == m_swapchain_extent)
-        return;
-
+    // both the ui and the render thread may call it, the check is under the lock
     std::lock_guard lock(m_swapchain_mutex);
 
+    // minimized windows have no extent, the swapchain is kept until restored
+    // and stays lost if it was
+    if ((!m_swapchain_lost && surface_caps.currentExtent == m_swapchain_extent) ||
+        surface_caps.currentExtent.width == 0 || surface_caps.currentExtent.height == 0)
+        return;
+
+    // the frames in flight and their presents still use the old images: they
+    // are destroyed once the first frame of the new swapchain is done, the
+    // canvas thread keeps submitting meanwhile
+    release_retired();
+    if (m_swapchain)
+    {
+        retired_t retired;
+        retired.submit_id = m_frame_submit.last_id() + 1;
+        retired.swapchain = std::move(m_swapchain);
+        retired.views = std::move(m_swapchain_views);
+        retired.framebuffers = std::move(m_framebuffers);
+        retired.render_finished = std::move(m_render_finished);
+        m_retired.push_back(std::move(retired));
+    }
     m_swapchain_views.clear();
     m_framebuffers.clear();
+    m_render_finished.clear();
     m_swapchain_images.clear();
-    m_swapchain.reset();
 
-    auto swap_info = vk::SwapchainCreateInfoKHR({}, *m_surf, surface_caps.minImageCount,
+    // fifo is the only mode every surface supports
+    auto present_modes = m_pd.getSurfacePresentModesKHR(*m_surf);
+    vk::PresentModeKHR present_mode = vk::PresentModeKHR::eFifo;
+    if (std::find(present_modes.begin(), present_modes.end(), m_present_mode) != present_modes.end())
+        present_mode = m_present_mode;
+    else
+        std::cout << "present mode " << vk::to_string(m_present_mode) << " not supported, using fifo\n";
+
+    // maxImageCount 0 means no limit
+    uint32_t images_count = m_low_latency ? surface_caps.minImageCount :
+        std::max(m_swapchain_images_count, surface_caps.minImageCount);
+    if (surface_caps.maxImageCount > 0)
+        images_count = std::min(images_count, surface_caps.maxImageCount);
+
+    auto swap_info = vk::SwapchainCreateInfoKHR({}, *m_surf, images_count,
         vk::Format::eB8G8R8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear, surface_caps.currentExtent, 1,
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::SharingMode::eExclusive, 0, nullptr,
         vk::SurfaceTransformFlagBitsKHR::eIdentity, vk::CompositeAlphaFlagBitsKHR::eOpaque,
-        vk::PresentModeKHR::eFifo, true, nullptr);
+        present_mode, true, m_retired.empty() ? nullptr : *m_retired.back().swapchain);
     m_swapchain = m_dev->createSwapchainKHRUnique(swap_info);
     m_swapchain_extent = surface_caps.currentExtent;
+    m_swapchain_lost = false;
 
     m_swapchain_images = m_dev->getSwapchainImagesKHR(*m_swapchain);
     m_swapchain_views.resize(m_swapchain_images.size());
     m_framebuffers.resize(m_swapchain_images.size());
-
-//     m_dev->resetDescriptorPool(*m_descr_pool);
-//     m_dev->resetCommandPool(*m_cmd_pool, vk::CommandPoolResetFlags());
+    // the per image command buffers are kept by index, the ones dropped by a
+    // smaller swapchain must be idle before they are freed
+    for (size_t i = m_swapchain_images.size(); i < m_image_submit.size(); i++)
+        m_frame_submit.wait(m_image_submit[i]);
+    m_image_submit.resize(m_swapchain_images.size(), 0);
+    m_render_finished.resize(m_swapchain_images.size());
+    for (auto& sem : m_render_finished)
+        sem = m_dev->createSemaphoreUnique(vk::SemaphoreCreateInfo());
 
     for (size_t image_index = 0; image_index < m_swapchain_images.size(); image_index++)
     {
@@ -217,6 +283,60 @@ void App::create_swapchain()
             m_swapchain_extent.width, m_swapchain_extent.height, 1);
         m_framebuffers[image_index] = m_dev->createFramebufferUnique(fb_info);
     }
+    on_swapchain_images();
+}
+
+void App::release_retired()
+{
+    while (!m_retired.empty() && m_frame_submit.done(m_retired.front().submit_id))
+        m_retired.pop_front();
+}
+
+bool App::acquire_frame(uint32_t& image_idx, vk::Semaphore& acquired)
+{
+    release_retired();
+    if (m_swapchain_lost)
+        return false;
+
+    // bounds the CPU lead over the GPU, the queue mutex is not held meanwhile
+    uint32_t frames = m_low_latency ? 1 : std::max(m_frames_in_flight, 1u);
+    while (m_frames_pending.size() >= frames)
+    {
+        m_frame_submit.wait(m_frames_pending.front());
+        m_frames_pending.pop_front();
+    }
+
+    acquired = m_frame_submit.semaphore();
+    try
+    {
+        image_idx = m_dev->acquireNextImageKHR(*m_swapchain, UINT64_MAX, acquired, nullptr).value;
+    }
+    catch (const vk::SystemError& err)
+    {
+        // nothing will signal the semaphore, it goes back to the free ones
+        std::cout << err.what() << "\n";
+        m_frame_submit.release_semaphore(acquired);
+        m_swapchain_lost = true;
+        return false;
+    }
+
+    // the image may still be used by a frame older than the ones waited above
+    m_frame_submit.wait(m_image_submit[image_idx]);
+    return true;
+}
+
+void App::present_frame(uint32_t image_idx, vk::Semaphore acquired, vk::CommandBuffer cmd, const DirtyRect& region)
+{
+    vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eTopOfPipe;
+    auto submit_info = vk::SubmitInfo(1, &acquired, &wait_stage, 1, &cmd, 1, &m_render_finished[image_idx].get());
+    uint64_t id = m_frame_submit.submit(submit_info);
+    m_image_submit[image_idx] = id;
+    m_frames_pending.push_back(id);
+
+    if (m_incremental_present && !region.empty())
+        m_queues.present(*m_swapchain, image_idx, *m_render_finished[image_idx], &region);
+    else
+        m_queues.present(*m_swapchain, image_idx, *m_render_finished[image_idx]);
 }
 
 void App::create_window()
@@ -237,47 +357,31 @@ void App::create_window()
         r.right - r.left, r.bottom - r.top, NULL, NULL, wc.hInstance, this);
 }
 
-void App::save_image(const vk::UniqueImage& img, const glm::ivec2 sz, const std::filesystem::path& path, vk::Format format)
+std::vector<uint8_t> App::read_image(const vk::UniqueImage& img, const glm::ivec2 sz, uint32_t texel_size,
+    vk::ImageLayout layout)
 {
-    std::cout << "saving to " << path << " ... ";
-    int bpp = 1;
-    switch (format)
-    {
-    case vk::Format::eR8G8B8A8Unorm:
-        bpp = 1;
-        break;
-    case vk::Format::eR32G32B32A32Sfloat:
-        bpp = sizeof(float);
-        break;
-    default:
-        throw std::runtime_error("unsupported format " + vk::to_string(format));
-    }
-    vk::DeviceSize pix_sz = sz.x * sz.y * 4 * bpp;
+    vk::DeviceSize pix_sz = sz.x * sz.y * (vk::DeviceSize)texel_size;
 
     // staging buffer
     vk::BufferCreateInfo buf_info;
     buf_info.size = pix_sz;
     buf_info.usage = vk::BufferUsageFlagBits::eTransferDst;
     vk::UniqueBuffer buf = m_dev->createBufferUnique(buf_info);
-    vk::MemoryRequirements buf_req = m_dev->getBufferMemoryRequirements(*buf);
-    uint32_t buf_mem_idx = find_memory(m_pd, buf_req, vk::MemoryPropertyFlagBits::eHostVisible |
-        vk::MemoryPropertyFlagBits::eHostCoherent);
-    vk::UniqueDeviceMemory buf_mem = m_dev->allocateMemoryUnique({ buf_req.size, buf_mem_idx });
-    m_dev->bindBufferMemory(*buf, *buf_mem, 0);
-
-    vk::UniqueCommandBuffer cmd = std::move(m_dev->allocateCommandBuffersUnique(
-        { *m_cmd_pool, vk::CommandBufferLevel::ePrimary, 1 }).front());
-    cmd->begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
-    {
+    Allocation buf_mem = m_allocator.bind(buf, vk::MemoryPropertyFlagBits::eHostVisible |
+        vk::MemoryPropertyFlagBits::eHostCoherent, MemoryAllocator::Strategy::linear);
+
+    m_submit.run([&](vk::CommandBuffer cmd) {
+        // the content is kept: never from eUndefined, and after any writer
         vk::ImageMemoryBarrier imb;
-        imb.srcAccessMask = vk::AccessFlags();
+        imb.srcAccessMask = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eColorAttachmentWrite |
+            vk::AccessFlagBits::eTransferWrite;
         imb.dstAccessMask = vk::AccessFlagBits::eTransferRead;
-        imb.oldLayout = vk::ImageLayout::eUndefined;
+        imb.oldLayout = layout;
         imb.newLayout = vk::ImageLayout::eTransferSrcOptimal;
         imb.srcQueueFamilyIndex = imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
         imb.image = *img;
         imb.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-        cmd->pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
             vk::PipelineStageFlagBits::eTransfer, {}, 0, nullptr, 0, nullptr, 1, &imb);
 
         vk::BufferImageCopy bic;
@@ -287,45 +391,21 @@ void App::save_image(const vk::UniqueImage& img, const glm::ivec2 sz, const std:
         bic.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
         bic.imageOffset = vk::Offset3D();
         bic.imageExtent = vk::Extent3D(sz.x, sz.y, 1);
-        //cmd->copyBufferToImage(*buf, *img, vk::ImageLayout::eTransferDstOptimal, bic);
-        cmd->copyImageToBuffer(*img, vk::ImageLayout::eTransferSrcOptimal, *buf, bic);
+        cmd.copyImageToBuffer(*img, vk::ImageLayout::eTransferSrcOptimal, *buf, bic);
 
         imb.srcAccessMask = vk::AccessFlagBits::eTransferRead;
         imb.dstAccessMask = vk::AccessFlagBits::eShaderRead;
         imb.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
-        imb.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        imb.newLayout = layout;
         imb.srcQueueFamilyIndex = imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
         imb.image = *img;
         imb.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-        cmd->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
             vk::PipelineStageFlagBits::eFragmentShader, {}, 0, nullptr, 0, nullptr, 1, &imb);
-    }
-    cmd->end();
-
-    vk::SubmitInfo si;
-    si.commandBufferCount = 1;
-    si.pCommandBuffers = &cmd.get();
-    vk::UniqueFence submit_fence = m_dev->createFenceUnique(vk::FenceCreateInfo());
-    {
-        std::lock_guard lock(m_main_queue_mutex);
-        m_main_queue.submit(si, *submit_fence);
-    }
-    m_dev->waitForFences(*submit_fence, true, UINT64_MAX);
+    });
 
-    stbi_flip_vertically_on_write(true);
-    if (format == vk::Format::eR32G32B32A32Sfloat)
-    {
-        float* ptr = reinterpret_cast<float*>(m_dev->mapMemory(*buf_mem, 0, pix_sz));
-        stbi_write_hdr((path.string() + ".hdr").c_str(), sz.x, sz.y, 4, ptr);
-        m_dev->unmapMemory(*buf_mem);
-    }
-    else if (format == vk::Format::eR8G8B8A8Unorm)
-    {
-        uint8_t* ptr = reinterpret_cast<uint8_t*>(m_dev->mapMemory(*buf_mem, 0, pix_sz));
-        stbi_write_jpg((path.string() + ".jpg").c_str(), sz.x, sz.y, 4, ptr, 100);
-        m_dev->unmapMemory(*buf_mem);
-    }
-    std::cout << "done\n";
+    const uint8_t* ptr = static_cast<const uint8_t*>(buf_mem.m_ptr);
+    return std::vector<uint8_t>(ptr, ptr + pix_sz);
 }
 
 void App::run_loop()
@@ -347,7 +427,8 @@ void App::run_loop()
     }
     m_running = false;
     on_terminate();
-    m_dev->waitIdle();
+    m_queues.wait_idle();
+    m_queues.destroy();
 }
 
 App* App::I;
@@ -364,10 +445,7 @@ LRESULT CALLBACK App::wnd_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPara
         break;
     case WM_SIZE:
         if (I->m_surf)
-        {
-            I->m_dev->waitIdle();
             I->on_resize();
-        }
         break;
     case WM_MOUSEWHEEL:
         I->on_mouse_wheel({ GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) },
@@ -1,5 +1,6 @@
 #pragma once
 #include "CmdRenderToScreen.h"
+#include "submitcontext.h"
 
 class App 
 {
@@ -8,6 +9,8 @@ public:
     vk::UniqueInstance m_instance;
     vk::UniqueSurfaceKHR m_surf;
     vk::UniqueDevice m_dev;
+    // every buffer and image memory, released before the device
+    MemoryAllocator m_allocator;
     uint32_t m_family_idx;
 
     vk::UniqueSwapchainKHR m_swapchain;
@@ -16,13 +19,18 @@ public:
     vk::UniqueShaderModule m_frag_module;
     vk::UniquePipeline m_pipeline;
     vk::UniqueRenderPass m_renderpass;
+    // same attachment as m_renderpass, loads the last presented content
+    vk::UniqueRenderPass m_renderpass_load;
     vk::UniquePipelineLayout m_pipeline_layout;
     vk::UniqueDescriptorSetLayout m_descr_layout;
 
-    std::mutex m_main_queue_mutex;
-    vk::Queue m_main_queue;
+    // every submit and present goes through the arbiter thread
+    QueueArbiter::families_t m_queue_families;
+    QueueArbiter m_queues;
 
     vk::UniqueCommandPool m_cmd_pool;
+    // one-shot work of the ui thread
+    SubmitContext m_submit;
     vk::UniqueDescriptorPool m_descr_pool;
 
     std::vector<vk::Image> m_swapchain_images;
@@ -30,6 +38,38 @@ public:
     std::vector<vk::UniqueFramebuffer> m_framebuffers;
     std::mutex m_swapchain_mutex;
 
+    // presentation settings, read by create_swapchain(). Fifo unless asked
+    // otherwise (--present=mailbox), other modes fall back to it when the
+    // surface does not support them. Low latency keeps a single frame
+    // queued on the smallest swapchain.
+    vk::PresentModeKHR m_present_mode = vk::PresentModeKHR::eFifo;
+    uint32_t m_swapchain_images_count = 3;
+    uint32_t m_frames_in_flight = 2;
+    bool m_low_latency = false;
+    // no window and no swapchain: init_vulkan() stops once the device and the
+    // queues are there, for the command line tests
+    bool m_headless = false;
+    // set when acquiring fails (out of date, surface lost): nothing is
+    // presented until create_swapchain() replaces the swapchain
+    std::atomic_bool m_swapchain_lost = false;
+    // VK_KHR_incremental_present is enabled, present_frame() passes the region
+    bool m_incremental_present = false;
+    // frame pacing, used under m_swapchain_mutex
+    SubmitContext m_frame_submit;
+    std::deque<uint64_t> m_frames_pending;
+    std::vector<uint64_t> m_image_submit;
+    std::vector<vk::UniqueSemaphore> m_render_finished;
+    // swapchains replaced by a resize, destroyed once submit_id is done
+    struct retired_t
+    {
+        uint64_t submit_id;
+        vk::UniqueSwapchainKHR swapchain;
+        std::vector<vk::UniqueImageView> views;
+        std::vector<vk::UniqueFramebuffer> framebuffers;
+        std::vector<vk::UniqueSemaphore> render_finished;
+    };
+    std::deque<retired_t> m_retired;
+
     HWND m_wnd = NULL;
     std::string m_device_name;
     uint32_t m_strokes_count = 0;
@@ -42,15 +82,32 @@ public:
     bool init_vulkan();
     bool init_pipeline();
     std::tuple<vk::PhysicalDevice, vk::UniqueDevice, uint32_t> find_device();
+    // replaces the swapchain without waiting for the device, the old one is
+    // passed as oldSwapchain and released by release_retired()
     void create_swapchain();
+    void release_retired();
+    // waits for a free frame and acquires the next image, false when the
+    // swapchain could not provide one or is lost. Both are called under
+    // m_swapchain_mutex.
+    bool acquire_frame(uint32_t& image_idx, vk::Semaphore& acquired);
+    // region is the part of the image redrawn by cmd, empty for the whole image
+    void present_frame(uint32_t image_idx, vk::Semaphore acquired, vk::CommandBuffer cmd,
+        const DirtyRect& region = DirtyRect());
     void create_window();
-    void save_image(const vk::UniqueImage& img, const glm::ivec2 sz, const std::filesystem::path& path, vk::Format format);
+    // img is in layout, where it is left, and may be written by other threads'
+    // submissions on the same queue. Returns the texels tightly packed.
+    std::vector<uint8_t> read_image(const vk::UniqueImage& img, const glm::ivec2 sz, uint32_t texel_size,
+        vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
     void run_loop();
 
     static App* I;
     static LRESULT CALLBACK wnd_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
     virtual void on_resize() = 0;
+    // called by create_swapchain() under m_swapchain_mutex once the new images
+    // and framebuffers exist, so no frame sees the swapchain before the per
+    // image state follows it
+    virtual void on_swapchain_images() {}
     virtual void on_init() = 0;
     virtual void on_terminate() = 0;
     virtual void on_keyup(int keycode) = 0;
@@ -0,0 +1,264 @@
+#include "pch.h"
+#include "brushlibrary.h"
+
+// raw_layout() of a 1x1 r8 layer, 0 is full coverage: plain square dabs
+static const std::array<uint8_t, 16> fallback_texels = {};
+
+// triangle filter along x, wider than a texel when shrinking
+static std::vector<float> resample_x(const std::vector<float>& src, glm::ivec2 size, int dst_w)
+{
+    std::vector<float> dst(dst_w * size.y);
+    float scale = (float)size.x / dst_w;
+    float radius = std::max(scale, 1.f);
+    for (int x = 0; x < dst_w; x++)
+    {
+        float center = (x + 0.5f) * scale;
+        int i0 = std::max(0, (int)std::floor(center - radius));
+        int i1 = std::min(size.x - 1, (int)std::ceil(center + radius));
+        for (int y = 0; y < size.y; y++)
+        {
+            float sum = 0.f;
+            float weights = 0.f;
+            for (int i = i0; i <= i1; i++)
+            {
+                float w = std::max(0.f, 1.f - std::abs(i + 0.5f - center) / radius);
+                sum += w * src[y * size.x + i];
+                weights += w;
+            }
+            dst[y * dst_w + x] = weights > 0.f ? sum / weights : src[y * size.x + i0];
+        }
+    }
+    return dst;
+}
+
+static std::vector<float> transpose(const std::vector<float>& src, glm::ivec2 size)
+{
+    std::vector<float> dst(src.size());
+    for (int y = 0; y < size.y; y++)
+        for (int x = 0; x < size.x; x++)
+            dst[x * size.y + y] = src[y * size.x + x];
+    return dst;
+}
+
+bool BrushLibrary::pack(const std::filesystem::path& path, const std::vector<std::filesystem::path>& sources)
+{
+    struct tip_t
+    {
+        std::string name;
+        // tip_size x tip_size, 1 is no coverage
+        std::vector<float> texels;
+    };
+    std::vector<tip_t> tips;
+
+    // round tips, the hard one has a one texel edge, the soft one fades to
+    // the center
+    auto round = [&](const char* name, float hardness) {
+        tip_t tip{ name, std::vector<float>(tip_size * tip_size) };
+        float edge = std::max(1.f - hardness, 2.f / tip_size);
+        for (uint32_t y = 0; y < tip_size; y++)
+        {
+            for (uint32_t x = 0; x < tip_size; x++)
+            {
+                glm::vec2 p = (glm::vec2(x, y) + 0.5f) / (float)tip_size * 2.f - 1.f;
+                float c = glm::clamp((1.f - glm::length(p)) / edge, 0.f, 1.f);
+                tip.texels[y * tip_size + x] = 1.f - c * c * (3.f - 2.f * c);
+            }
+        }
+        tips.push_back(std::move(tip));
+    };
+    round("round hard", 1.f);
+    round("round soft", 0.f);
+
+    for (const auto& src : sources)
+    {
+        glm::ivec2 size;
+        int comp;
+        std::unique_ptr<uint8_t, decltype(&stbi_image_free)> pixels(
+            stbi_load(src.string().c_str(), &size.x, &size.y, &comp, 1), stbi_image_free);
+        if (!pixels)
+        {
+            std::cout << fmt::format("BrushLibrary: could not load {}, skipped\n", src.string());
+            continue;
+        }
+        std::vector<float> texels(size.x * size.y);
+        for (size_t i = 0; i < texels.size(); i++)
+            texels[i] = pixels.get()[i] / 255.f;
+        texels = resample_x(texels, size, tip_size);
+        texels = transpose(texels, { tip_size, size.y });
+        texels = resample_x(texels, { size.y, tip_size }, tip_size);
+        texels = transpose(texels, { tip_size, tip_size });
+        tips.push_back({ src.stem().string(), std::move(texels) });
+    }
+
+    header_t header = {};
+    std::copy_n("VKBL", 4, header.magic);
+    header.version = version;
+    header.tip_size = tip_size;
+    header.levels = (uint32_t)std::log2(tip_size) + 1;
+    header.count = (uint32_t)tips.size();
+    std::vector<vk::DeviceSize> level_offsets;
+    header.data_size = TextureStreamer::raw_layout({ tip_size, tip_size }, vk::Format::eR8Unorm,
+        header.levels, header.count, level_offsets);
+    header.data_offset = (sizeof(header_t) + sizeof(entry_t) * header.count + 15) / 16 * 16;
+
+    std::vector<entry_t> entries(tips.size());
+    for (size_t i = 0; i < tips.size(); i++)
+    {
+        entries[i] = {};
+        tips[i].name.copy(entries[i].name, sizeof(entry_t::name) - 1);
+    }
+
+    // every level a 2x2 box of the one above, per layer
+    std::vector<uint8_t> data(header.data_size, 0);
+    for (uint32_t layer = 0; layer < header.count; layer++)
+    {
+        std::vector<float> level = std::move(tips[layer].texels);
+        uint32_t size = tip_size;
+        for (uint32_t l = 0; l < header.levels; l++)
+        {
+            uint8_t* dst = data.data() + level_offsets[l] + (vk::DeviceSize)layer * size * size;
+            for (size_t i = 0; i < level.size(); i++)
+                dst[i] = (uint8_t)std::lround(glm::clamp(level[i], 0.f, 1.f) * 255.f);
+            if (size == 1)
+                break;
+            uint32_t half = size / 2;
+            std::vector<float> next(half * half);
+            for (uint32_t y = 0; y < half; y++)
+            {
+                for (uint32_t x = 0; x < half; x++)
+                {
+                    const float* row = level.data() + (y * 2) * size + x * 2;
+                    next[y * half + x] = (row[0] + row[1] + row[size] + row[size + 1]) * 0.25f;
+                }
+            }
+            level = std::move(next);
+            size = half;
+        }
+    }
+
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    if (!ofs)
+        return false;
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(entries.data()), sizeof(entry_t) * entries.size());
+    std::vector<char> padding(header.data_offset - sizeof(header) - sizeof(entry_t) * entries.size(), 0);
+    ofs.write(padding.data(), padding.size());
+    ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return (bool)ofs;
+}
+
+bool BrushLibrary::map(const std::filesystem::path& path)
+{
+    m_header = nullptr;
+    m_entries = nullptr;
+    if (!m_file.open(path) || m_file.m_size < sizeof(header_t))
+        return false;
+    const header_t* h = reinterpret_cast<const header_t*>(m_file.m_data);
+    // a full mip chain of a power of two tip
+    if (!std::equal(h->magic, h->magic + 4, "VKBL") || h->version != version || h->count == 0 ||
+        h->levels == 0 || h->levels > 32 || (h->tip_size >> (h->levels - 1)) != 1 ||
+        h->data_offset < sizeof(header_t) + sizeof(entry_t) * h->count || h->data_offset % 16 != 0 ||
+        h->data_offset + h->data_size > m_file.m_size)
+        return false;
+    std::vector<vk::DeviceSize> level_offsets;
+    if (TextureStreamer::raw_layout(glm::ivec2(h->tip_size), vk::Format::eR8Unorm, h->levels, h->count,
+        level_offsets) != h->data_size)
+        return false;
+    m_header = h;
+    m_entries = reinterpret_cast<const entry_t*>(m_file.m_data + sizeof(header_t));
+    return true;
+}
+
+BrushLibrary::~BrushLibrary()
+{
+    if (m_loader.joinable())
+        m_loader.join();
+    // the streamer may still read the mapping
+    if (m_tips)
+        m_streamer->wait(m_tips);
+}
+
+void BrushLibrary::create(TextureStreamer& streamer, const std::filesystem::path& path,
+    const std::vector<std::filesystem::path>& sources)
+{
+    m_streamer = &streamer;
+    m_fallback = streamer.load_raw({ 1, 1 }, vk::Format::eR8Unorm, 1, 1,
+        fallback_texels.data(), fallback_texels.size());
+    m_loading = true;
+    m_loader = std::thread(&BrushLibrary::loader_main, this, path, sources);
+}
+
+void BrushLibrary::loader_main(std::filesystem::path path, std::vector<std::filesystem::path> sources)
+{
+    TextureStreamer::handle_t tips;
+    std::error_code ec;
+    auto packed_time = std::filesystem::last_write_time(path, ec);
+    bool stale = bool(ec) || std::any_of(sources.begin(), sources.end(), [&](const auto& src) {
+        std::error_code src_ec;
+        auto src_time = std::filesystem::last_write_time(src, src_ec);
+        return !src_ec && src_time > packed_time;
+    });
+    if (stale || !map(path))
+    {
+        m_file.close();
+        std::cout << fmt::format("packing the brush library {}\n", path.string());
+        if (!pack(path, sources) || !map(path))
+        {
+            std::cout << fmt::format("BrushLibrary: {} unavailable, painting square dabs\n", path.string());
+            m_file.close();
+        }
+    }
+    if (m_header)
+    {
+        m_count = m_header->count;
+        tips = m_streamer->load_raw(glm::ivec2(m_header->tip_size), vk::Format::eR8Unorm,
+            m_header->levels, m_header->count, m_file.m_data + m_header->data_offset, m_header->data_size);
+    }
+    {
+        std::lock_guard lock(m_mutex);
+        m_tips = std::move(tips);
+        m_loading = false;
+    }
+    m_loaded_cv.notify_all();
+}
+
+TextureStreamer::handle_t BrushLibrary::tips() const
+{
+    std::lock_guard lock(m_mutex);
+    return m_tips;
+}
+
+std::string BrushLibrary::name(uint32_t tip) const
+{
+    if (tip >= m_count)
+        return "fallback";
+    const char* name = m_entries[tip].name;
+    return std::string(name, std::find(name, name + sizeof(entry_t::name), '\0'));
+}
+
+void BrushLibrary::wait()
+{
+    TextureStreamer::handle_t tips;
+    {
+        std::unique_lock lock(m_mutex);
+        m_loaded_cv.wait(lock, [&] { return !m_loading; });
+        tips = m_tips;
+    }
+    if (tips)
+        m_streamer->wait(tips);
+    if (!tips || !TextureStreamer::ready(tips))
+        m_streamer->wait(m_fallback);
+}
+
+bool BrushLibrary::settled() const
+{
+    std::lock_guard lock(m_mutex);
+    return !m_loading && (!m_tips || m_tips->state != TextureStreamer::State::pending);
+}
+
+const vk::UniqueImageView& BrushLibrary::view() const
+{
+    // the view lives as long as m_tips, which is set once
+    auto tips = this->tips();
+    return m_streamer->view(tips && TextureStreamer::ready(tips) ? tips : m_fallback);
+}
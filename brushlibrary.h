@@ -0,0 +1,78 @@
+#pragma once
+#include "utils.h"
+#include "texturestreamer.h"
+
+/*
+Brush tips packed in one mipmapped r8 texture array, one tip per layer, with
+the brush.png convention: 1 - r is the coverage. Dabs pick their tip by
+index (dab_t::tip), so switching brush changes no descriptor and no command
+buffer, and small dabs read the small mips. The library is a binary file:
+header_t, one entry_t per tip, then the texels as TextureStreamer::raw_layout()
+lays them out. It is memory mapped and handed to the streamer as is. When it
+is missing, of another version or older than a source it is packed again
+from procedural round tips and the source images, on a thread of its own:
+the fallback tip is bound meanwhile.
+*/
+class BrushLibrary
+{
+public:
+    struct header_t
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t tip_size;
+        uint32_t levels;
+        uint32_t count;
+        uint32_t data_offset;
+        uint64_t data_size;
+    };
+    struct entry_t
+    {
+        char name[64];
+    };
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t tip_size = 256;
+private:
+    MappedFile m_file;
+    const header_t* m_header = nullptr;
+    const entry_t* m_entries = nullptr;
+    // the tips in m_entries, 0 until the library is mapped
+    std::atomic<uint32_t> m_count = 0;
+    TextureStreamer* m_streamer = nullptr;
+    // a single opaque tip, bound while loading or when the library failed
+    TextureStreamer::handle_t m_fallback;
+
+    // m_tips is set by the loader, m_loading cleared once it is done
+    mutable std::mutex m_mutex;
+    std::condition_variable m_loaded_cv;
+    TextureStreamer::handle_t m_tips;
+    bool m_loading = false;
+    std::thread m_loader;
+
+    // false when the file is not a valid library
+    bool map(const std::filesystem::path& path);
+    void loader_main(std::filesystem::path path, std::vector<std::filesystem::path> sources);
+    TextureStreamer::handle_t tips() const;
+public:
+    ~BrushLibrary();
+
+    // returns at once, the library is packed when needed and mapped on the
+    // loader thread, then streamed. A library that fails paints with the
+    // fallback.
+    void create(TextureStreamer& streamer, const std::filesystem::path& path,
+        const std::vector<std::filesystem::path>& sources);
+    // writes a library with the procedural tips first, then sources in order
+    static bool pack(const std::filesystem::path& path, const std::vector<std::filesystem::path>& sources);
+
+    // 1, the fallback, until the library is mapped
+    uint32_t count() const { return std::max(m_count.load(), 1u); }
+    std::string name(uint32_t tip) const;
+    // blocks until the tips, or the fallback when they failed, can be sampled
+    void wait();
+    // blocks until the fallback can be sampled
+    void wait_fallback() { m_streamer->wait(m_fallback); }
+    // true once view() no longer changes: the tips are there or failed
+    bool settled() const;
+    // a 2D array view, for sampler2DArray
+    const vk::UniqueImageView& view() const;
+};
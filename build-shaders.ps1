@@ -1,7 +1,15 @@
-glslc -O -o .\shader.frag.spv .\shader.frag
-glslc -DMULTISAMPLE -O -o .\shader.frag.ms.spv .\shader.frag
-glslc -O -o .\shader.vert.spv .\shader.vert
-
 glslc -O -o .\shader-fill.frag.spv .\shader-fill.frag
 glslc -DMULTISAMPLE -O -o .\shader-fill.frag.ms.spv .\shader-fill.frag
 glslc -O -o .\shader-fill.vert.spv .\shader-fill.vert
+
+glslc -O -o .\shader-batch.frag.spv .\shader-batch.frag
+glslc -O -o .\shader-batch.vert.spv .\shader-batch.vert
+
+glslc -O -o .\shader-bin.comp.spv .\shader-bin.comp
+glslc -O -o .\shader-raster.comp.spv .\shader-raster.comp
+glslc -DSPARSE -O -o .\shader-raster.comp.sparse.spv .\shader-raster.comp
+
+glslc -O -o .\shader-sparse.frag.spv .\shader-sparse.frag
+
+glslc -O -o .\shader-segment.frag.spv .\shader-segment.frag
+glslc -O -o .\shader-segment.vert.spv .\shader-segment.vert
@@ -0,0 +1,317 @@
+#include "pch.h"
+#include "exporter.h"
+#include "debug_message.h"
+
+bool Exporter::create(MemoryAllocator& allocator, const vk::UniqueDevice& dev, QueueArbiter& queues, QueueKind kind,
+    uint32_t workers)
+{
+    m_allocator = &allocator;
+    m_dev = &dev;
+    m_queues = &queues;
+    m_kind = kind;
+    m_staged = queues.family(QueueKind::transfer) != queues.family(kind);
+    if (workers == 0)
+        workers = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 8u);
+    m_running = m_workers_running = true;
+    for (uint32_t i = 0; i < workers; i++)
+        m_workers.emplace_back(&Exporter::worker_main, this);
+    m_reader = std::thread(&Exporter::reader_main, this);
+    return true;
+}
+
+void Exporter::destroy()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+    m_committed_cv.notify_all();
+    // every committed job has its tasks queued after this
+    m_reader.join();
+    {
+        std::lock_guard lock(m_mutex);
+        m_workers_running = false;
+    }
+    m_tasks_cv.notify_all();
+    for (auto& t : m_workers)
+        t.join();
+    m_workers.clear();
+}
+
+Exporter::handle_t Exporter::begin(glm::ivec2 size, vk::Format format, const std::filesystem::path& path,
+    callback_t callback)
+{
+    vk::DeviceSize texel;
+    switch (format)
+    {
+    case vk::Format::eR8G8B8A8Unorm:
+        texel = 4;
+        break;
+    case vk::Format::eR32G32B32A32Sfloat:
+        texel = 4 * sizeof(float);
+        break;
+    default:
+        throw std::runtime_error("Exporter: unsupported format " + vk::to_string(format));
+    }
+    if (size.x <= 0 || size.y <= 0)
+        throw std::runtime_error("Exporter: empty image");
+
+    auto job = std::make_shared<job_t>();
+    job->id = m_next_id++;
+    job->path = path;
+    job->size = size;
+    job->format = format;
+    job->callback = std::move(callback);
+    job->start = std::chrono::steady_clock::now();
+    // jpg drops the alpha, the canvas is opaque
+    auto ext = path.extension().string();
+    if (ext == ".jpg" || ext == ".jpeg")
+        job->dst_comp = 3;
+    else if (ext == ".png")
+        job->dst_comp = 4;
+    else if (ext == ".hdr")
+    {
+        job->dst_comp = 3;
+        job->dst_float = true;
+    }
+    else
+        throw std::runtime_error("Exporter: no encoder for " + path.string());
+
+    job->bytes = (vk::DeviceSize)size.x * size.y * texel;
+    vk::UniqueBuffer& host = m_staged ? job->readback : job->buffer;
+    Allocation& host_memory = m_staged ? job->readback_memory : job->memory;
+    host = (*m_dev)->createBufferUnique(vk::BufferCreateInfo({}, job->bytes, vk::BufferUsageFlagBits::eTransferDst));
+    debug_name(host, m_staged ? "Exporter::job_t::readback" : "Exporter::job_t::buffer");
+    // the workers read every texel, cached memory when the device has it
+    try
+    {
+        host_memory = m_allocator->bind(host, vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostCached,
+            MemoryAllocator::Strategy::linear);
+    }
+    catch (const std::runtime_error&)
+    {
+        host_memory = m_allocator->bind(host, vk::MemoryPropertyFlagBits::eHostVisible |
+            vk::MemoryPropertyFlagBits::eHostCoherent, MemoryAllocator::Strategy::linear);
+    }
+    if (m_staged)
+    {
+        // written on the owner's queue and read on the transfer one, ordered
+        // by copied: concurrent sharing, no ownership transfer
+        std::array<uint32_t, 2> families = { m_queues->family(m_kind), m_queues->family(QueueKind::transfer) };
+        auto staging_info = vk::BufferCreateInfo({}, job->bytes,
+            vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+            vk::SharingMode::eConcurrent, (uint32_t)families.size(), families.data());
+        job->buffer = (*m_dev)->createBufferUnique(staging_info);
+        debug_name(job->buffer, "Exporter::job_t::buffer");
+        job->memory = m_allocator->bind(job->buffer, vk::MemoryPropertyFlagBits::eDeviceLocal,
+            MemoryAllocator::Strategy::linear);
+        job->copied = (*m_dev)->createSemaphoreUnique(vk::SemaphoreCreateInfo());
+        debug_name(job->copied, "Exporter::job_t::copied");
+    }
+    job->fence = (*m_dev)->createFenceUnique(vk::FenceCreateInfo());
+    debug_name(job->fence, "Exporter::job_t::fence");
+    return job;
+}
+
+void Exporter::commit(const handle_t& job)
+{
+    // an empty batch: its fence signals once everything posted before on the
+    // queue is complete, the copy included
+    QueueArbiter::op_t op;
+    op.kind = m_kind;
+    if (job->copied)
+    {
+        // or the transfer queue takes the texels to the host once the
+        // owner's copy signals
+        job->cmd_pool = (*m_dev)->createCommandPoolUnique(vk::CommandPoolCreateInfo(
+            vk::CommandPoolCreateFlagBits::eTransient, m_queues->family(QueueKind::transfer)));
+        job->cmd = std::move((*m_dev)->allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo(
+            *job->cmd_pool, vk::CommandBufferLevel::ePrimary, 1)).front());
+        debug_name(job->cmd, "Exporter::job_t::cmd");
+        vk::CommandBuffer cmd = *job->cmd;
+        cmd.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+        cmd.copyBuffer(*job->buffer, *job->readback, vk::BufferCopy(0, 0, job->bytes));
+        vk::BufferMemoryBarrier bmb(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead,
+            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, *job->readback, 0, VK_WHOLE_SIZE);
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
+            {}, nullptr, bmb, nullptr);
+        cmd.end();
+        op.kind = QueueKind::transfer;
+        op.cmd_count = 1;
+        op.cmds[0] = cmd;
+        op.wait_count = 1;
+        op.wait[0] = *job->copied;
+        op.wait_stages[0] = vk::PipelineStageFlagBits::eTransfer;
+    }
+    op.fence = *job->fence;
+    op.submitted = &job->submitted;
+    op.id = job->id;
+    m_queues->submit(op);
+    report(*job, Stage::copying, 0.f);
+    {
+        std::lock_guard lock(m_mutex);
+        m_committed.push_back(job);
+    }
+    m_committed_cv.notify_one();
+}
+
+void Exporter::report(job_t& job, Stage stage, float progress, const std::string& error)
+{
+    if (!job.callback)
+        return;
+    float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - job.start).count();
+    std::lock_guard lock(job.callback_mutex);
+    job.callback({ job.path, stage, progress, ms, error });
+}
+
+void Exporter::reader_main()
+{
+    while (true)
+    {
+        handle_t job;
+        {
+            std::unique_lock lock(m_mutex);
+            m_committed_cv.wait(lock, [&] { return !m_running || !m_committed.empty(); });
+            if (m_committed.empty())
+                return;
+            job = std::move(m_committed.front());
+            m_committed.pop_front();
+        }
+        QueueArbiter::wait_submitted(job->submitted, job->id);
+        (*m_dev)->waitForFences(*job->fence, true, UINT64_MAX);
+        job->fence.reset();
+        job->cmd.reset();
+        job->cmd_pool.reset();
+        job->copied.reset();
+        if (job->readback)
+        {
+            // the texels are in host memory
+            job->memory = Allocation();
+            job->buffer.reset();
+        }
+
+        // a few bands per worker, so a slow one does not hold the encode
+        job->pixels.resize((size_t)job->size.x * job->size.y * job->dst_comp * (job->dst_float ? sizeof(float) : 1));
+        job->bands = std::min((uint32_t)job->size.y, (uint32_t)m_workers.size() * 4);
+        job->bands_left = job->bands;
+        report(*job, Stage::converting, 0.f);
+        {
+            std::lock_guard lock(m_mutex);
+            for (uint32_t band = 0; band < job->bands; band++)
+            {
+                int y0 = (int)((uint64_t)job->size.y * band / job->bands);
+                int y1 = (int)((uint64_t)job->size.y * (band + 1) / job->bands);
+                m_tasks.push_back([this, job, y0, y1] {
+                    convert(*job, y0, y1);
+                    uint32_t rows = job->rows_done.fetch_add(y1 - y0) + (y1 - y0);
+                    if (job->bands_left.fetch_sub(1) == 1)
+                        encode(*job);
+                    else
+                        report(*job, Stage::converting, 0.5f * rows / job->size.y);
+                });
+            }
+        }
+        m_tasks_cv.notify_all();
+    }
+}
+
+void Exporter::worker_main()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(m_mutex);
+            m_tasks_cv.wait(lock, [&] { return !m_workers_running || !m_tasks.empty(); });
+            if (m_tasks.empty())
+                return;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void Exporter::convert(job_t& job, int y0, int y1)
+{
+    const Allocation& host = job.readback ? job.readback_memory : job.memory;
+    const uint8_t* src = static_cast<const uint8_t*>(host.m_ptr);
+    size_t src_texel = job.format == vk::Format::eR32G32B32A32Sfloat ? 4 * sizeof(float) : 4;
+    size_t dst_texel = job.dst_comp * (job.dst_float ? sizeof(float) : 1);
+    for (int y = y0; y < y1; y++)
+    {
+        // the canvas has y up, the encoders write the top row first
+        const uint8_t* src_row = src + (size_t)(job.size.y - 1 - y) * job.size.x * src_texel;
+        uint8_t* dst_row = job.pixels.data() + (size_t)y * job.size.x * dst_texel;
+        if (job.format == vk::Format::eR8G8B8A8Unorm && !job.dst_float)
+        {
+            for (int x = 0; x < job.size.x; x++)
+                std::copy_n(src_row + x * 4, job.dst_comp, dst_row + x * job.dst_comp);
+            continue;
+        }
+        for (int x = 0; x < job.size.x; x++)
+        {
+            glm::vec4 c = job.format == vk::Format::eR32G32B32A32Sfloat ?
+                reinterpret_cast<const glm::vec4*>(src_row)[x] :
+                glm::vec4(reinterpret_cast<const glm::u8vec4*>(src_row)[x]) / 255.f;
+            for (uint32_t i = 0; i < job.dst_comp; i++)
+            {
+                if (job.dst_float)
+                    reinterpret_cast<float*>(dst_row)[x * job.dst_comp + i] = c[i];
+                else
+                    dst_row[x * job.dst_comp + i] = (uint8_t)std::lround(glm::clamp(c[i], 0.f, 1.f) * 255.f);
+            }
+        }
+    }
+}
+
+void Exporter::encode(job_t& job)
+{
+    // the readback is in pixels now
+    job.memory = Allocation();
+    job.buffer.reset();
+    job.readback_memory = Allocation();
+    job.readback.reset();
+    report(job, Stage::encoding, 0.5f);
+
+    // written aside and moved in place, a reader never sees half a file
+    auto tmp = job.path;
+    tmp += fmt::format(".{}.tmp", job.id);
+    auto ext = job.path.extension().string();
+    int ok = 0;
+    if (job.dst_float)
+        ok = stbi_write_hdr(tmp.string().c_str(), job.size.x, job.size.y, job.dst_comp,
+            reinterpret_cast<const float*>(job.pixels.data()));
+    else if (ext == ".png")
+        ok = stbi_write_png(tmp.string().c_str(), job.size.x, job.size.y, job.dst_comp, job.pixels.data(),
+            job.size.x * job.dst_comp);
+    else
+        ok = stbi_write_jpg(tmp.string().c_str(), job.size.x, job.size.y, job.dst_comp, job.pixels.data(), 100);
+    job.pixels = {};
+    if (!ok)
+    {
+        report(job, Stage::failed, 1.f, fmt::format("could not write {}", tmp.string()));
+        return;
+    }
+
+    std::error_code ec;
+    {
+        std::lock_guard lock(m_mutex);
+        uint64_t& written = m_written[job.path];
+        if (job.id > written)
+        {
+            std::filesystem::rename(tmp, job.path, ec);
+            if (!ec)
+                written = job.id;
+        }
+        else
+            std::filesystem::remove(tmp, ec);
+    }
+    if (ec)
+        report(job, Stage::failed, 1.f, fmt::format("could not replace {}: {}", job.path.string(), ec.message()));
+    else
+        report(job, Stage::done, 1.f);
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "utils.h"
+#include "queuearbiter.h"
+
+/*
+Writes snapshots of an image to disk without stalling the threads that paint
+or present. The thread owning the image asks begin() for a readback buffer,
+records the copy in its own submission, so the snapshot is whatever the
+queue has drawn before it, and hands the job back with commit(). When the
+device has a transfer family apart from the owner's, that copy goes to device
+memory and the transfer queue moves it to the host, the owner's queue is free
+again as soon as the image is copied. A fence posted after the last copy
+tells the reader thread when the texels are there, worker threads then flip and convert bands of rows in parallel and
+the last band encodes the file. The callback reports the progress from the
+exporter threads, one call at a time for a job.
+*/
+class Exporter
+{
+public:
+    enum class Stage : uint32_t { copying, converting, encoding, done, failed };
+    struct progress_t
+    {
+        std::filesystem::path path;
+        Stage stage;
+        // the whole export: 0 while copying, up to 0.5 while converting, 1 when done
+        float progress;
+        // since begin()
+        float ms;
+        std::string error;
+    };
+    using callback_t = std::function<void(const progress_t&)>;
+    struct job_t
+    {
+        uint64_t id = 0;
+        std::filesystem::path path;
+        glm::ivec2 size = { 0, 0 };
+        vk::Format format = vk::Format::eR8G8B8A8Unorm;
+        callback_t callback;
+        std::chrono::steady_clock::time_point start;
+        // what the owner copies to, tightly packed texels with row 0 at the
+        // bottom. Host memory unless copied is set.
+        vk::UniqueBuffer buffer;
+        Allocation memory;
+        // staged readback: the owner's submission must signal copied, the
+        // transfer queue then copies buffer to readback in host memory
+        vk::UniqueSemaphore copied;
+        vk::UniqueBuffer readback;
+        Allocation readback_memory;
+        vk::UniqueCommandPool cmd_pool;
+        vk::UniqueCommandBuffer cmd;
+        vk::DeviceSize bytes = 0;
+        vk::UniqueFence fence;
+        // set by the arbiter once the fence is submitted
+        std::atomic<uint64_t> submitted{ 0 };
+        // what the encoder takes: row 0 at the top, dst_comp channels
+        std::vector<uint8_t> pixels;
+        uint32_t dst_comp = 4;
+        bool dst_float = false;
+        uint32_t bands = 0;
+        std::atomic<uint32_t> bands_left{ 0 };
+        std::atomic<uint32_t> rows_done{ 0 };
+        std::mutex callback_mutex;
+    };
+    using handle_t = std::shared_ptr<job_t>;
+private:
+    MemoryAllocator* m_allocator = nullptr;
+    const vk::UniqueDevice* m_dev = nullptr;
+    QueueArbiter* m_queues = nullptr;
+    QueueKind m_kind = QueueKind::graphics;
+    // the transfer family is not m_kind's, see job_t::copied
+    bool m_staged = false;
+    uint64_t m_next_id = 1;
+
+    std::mutex m_mutex;
+    std::condition_variable m_committed_cv;
+    std::condition_variable m_tasks_cv;
+    // committed jobs, in submission order
+    std::deque<handle_t> m_committed;
+    std::deque<std::function<void()>> m_tasks;
+    // the reader stops once m_committed is empty, the workers once the
+    // reader is gone and m_tasks is empty
+    bool m_running = false;
+    bool m_workers_running = false;
+    std::thread m_reader;
+    std::vector<std::thread> m_workers;
+    // the newest job moved in place for every path, an older job finishing
+    // later does not overwrite it
+    std::map<std::filesystem::path, uint64_t> m_written;
+
+    void reader_main();
+    void worker_main();
+    void convert(job_t& job, int y0, int y1);
+    void encode(job_t& job);
+    void report(job_t& job, Stage stage, float progress, const std::string& error = {});
+public:
+    ~Exporter() { destroy(); }
+
+    // kind: the queue the copies are submitted on. workers 0 picks from the
+    // number of cores.
+    bool create(MemoryAllocator& allocator, const vk::UniqueDevice& dev, QueueArbiter& queues, QueueKind kind,
+        uint32_t workers = 0);
+    // finishes the committed jobs, then stops the threads
+    void destroy();
+
+    // a job reading back size texels of format (rgba8 or rgba32f), encoded as
+    // the extension of path says: .jpg, .png or .hdr
+    handle_t begin(glm::ivec2 size, vk::Format format, const std::filesystem::path& path, callback_t callback);
+    // after the submission copying the image to job->buffer was posted, it
+    // signals job->copied when that is set
+    void commit(const handle_t& job);
+};
@@ -2,83 +2,680 @@
 #include "utils.h"
 #include "app.h"
 #include "rendertarget.h"
-#include "texture.h"
-#include "CmdRenderStroke.h"
+#include "texturestreamer.h"
+#include "brushlibrary.h"
+#include "exporter.h"
+#include "CmdRenderStrokeBatch.h"
+#include "CmdRenderStrokeCompute.h"
+#include "CmdRenderStrokeSegments.h"
+#include "tiledcanvas.h"
+#include "strokeresampler.h"
+#include "spscqueue.h"
 #include "debug_message.h"
 #include <shellscalingapi.h>
 
 class DrawApp : public App
 {
     RenderTarget rt;
-    Texture m_tex;
-    vk::UniqueSemaphore render_finished_sem;
+    TiledCanvas m_canvas;
+    TextureStreamer m_textures;
+    // the canvas thread starts painting once the tips are loaded
+    BrushLibrary m_brushes;
+    // layer of m_brushes new dabs use, picked with '1'..'9'
+    std::atomic<uint32_t> m_tip = 0;
+    // space on the raster canvas: the canvas thread records the copy, the
+    // exporter threads encode
+    Exporter m_exporter;
     vk::UniqueSampler m_sampler_linear;
     vk::UniqueSampler m_sampler_nearest;
+    // the canvas as sampled by the display, one set for every swapchain image
+    vk::UniqueDescriptorSet m_display_descr;
     std::vector<CmdRenderToScreen> m_cmd_screen;
+    // owned by the main render thread, used under m_swapchain_mutex
+    vk::UniqueCommandPool m_screen_cmd_pool;
     float m_zoom = 1.f;
     glm::vec2 m_pan = { 0, 0 };
+    // bumped by anything that changes what is on screen: strokes, clears,
+    // view and swapchain changes. The display thread sleeps until it moves.
+    std::atomic<uint32_t> m_display_damage{ 1 };
+    // what to redraw: canvas pixels touched by strokes, or everything
+    std::mutex m_damage_mutex;
+    DirtyRect m_damage_canvas;
+    bool m_damage_full = true;
+    // per swapchain image, the screen region changed since it was last drawn
+    // (used under m_swapchain_mutex)
+    std::vector<DirtyRect> m_image_damage;
+    std::vector<uint8_t> m_image_full;
+    // stroke backend: instanced raster draw or tile binned compute, toggled with 'B'
+    std::atomic_bool m_compute_strokes = false;
+    // single sample raster dabs antialiased in the fragment shader instead
+    // of hard edged, toggled with 'A'
+    std::atomic_bool m_analytic_aa = true;
+    // hard round strokes as capsule segments instead of dabs, toggled with 'L'
+    std::atomic_bool m_segment_strokes = false;
+    // 'C', the clear is done by the canvas thread which owns the canvas
+    // layout and the page table
+    std::atomic_bool m_clear_pending = false;
+    // space, recorded by the canvas thread like the clear
+    std::atomic_bool m_export_pending = false;
+    // of the last export for the title, -1 when none is running
+    std::atomic<int> m_export_percent = -1;
+    // the sparse pages pool could not grow for a stroke, shown in the title
+    // until the next clear
+    std::atomic_bool m_pool_full = false;
+    // the whole canvas in a corner, read from its mips, toggled with 'N'
+    std::atomic_bool m_navigator = false;
+    // prints the barriers of every stroke submission, toggled with 'G'
+    std::atomic_bool m_trace_barriers = false;
+    // stroke submissions the canvas thread keeps in flight
+    const uint32_t m_strokes_in_flight = 3;
+    // samples the canvas thread has submitted, the stroke checks wait on it
+    std::atomic<uint64_t> m_samples_done{ 0 };
+    // pipelineBarriers and image barriers of its last stroke submission
+    std::atomic<uint32_t> m_submit_barriers{ 0 };
+    std::atomic<uint32_t> m_submit_image_barriers{ 0 };
 
-    struct StrokeSample
-    {
-        glm::vec2 cur;
-        float pressure;
-        StrokeSample(glm::vec2 pos, float pressure) : cur(pos), pressure(pressure) {}
-    };
-    std::mutex m_stroke_mutex;
-    std::condition_variable m_stroke_cv;
-    std::vector<StrokeSample> m_stroke_samples;
+    // input thread -> canvas thread
+    SpscQueue<StrokeSample, 1 << 16> m_stroke_queue;
+    // used by the input thread only, m_resampled keeps what did not fit in
+    // the queue for the next event
+    StrokeResampler m_resampler;
+    StrokeSamples m_resampled;
 
     std::thread m_canvas_render_thread;
     std::thread m_main_render_thread;
 public:
+    // sparse mode paints a m_sparse_size document through TiledCanvas pages
+    // (compute strokes only) instead of the fixed size RenderTarget. Set
+    // before init_vulkan(), see --sparse.
+    bool m_sparse_canvas = false;
+    glm::ivec2 m_sparse_size = { 16384, 16384 };
+    // the command line check main() runs instead of the window, by option
+    // name without the dashes: compare-aa, compare-compute, count-dabs,
+    // check-allocs, check-barriers
+    std::string m_check;
 
-    void clear_rt()
+    void invalidate()
     {
-        CmdRenderStroke m_cmd_stroke_clear;
-        m_cmd_stroke_clear.create(m_dev, m_pd, m_cmd_pool, m_descr_pool, rt.m_descr_layout, rt.m_renderpass,
-            rt.m_framebuffer, rt.m_pipeline, rt.m_layout, m_sampler_linear, vk::Extent2D(rt.m_size.x, rt.m_size.y),
-            rt.m_fb_img, rt.m_fb_view, m_tex.m_view, { 1, 1, 1 });
-
-        rt.to_layout(m_dev, m_cmd_pool, m_main_queue, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eShaderReadOnlyOptimal,
-            vk::PipelineStageFlagBits::eBottomOfPipe, vk::PipelineStageFlagBits::eFragmentShader);
-
-        vk::SubmitInfo si;
-        std::array<vk::CommandBuffer, 2> commands = { *m_cmd_stroke_clear.m_cmd, *rt.cmd_resolve };
-        if ((int)m_samples > 1)
         {
-            si.commandBufferCount = commands.size();
-            si.pCommandBuffers = commands.data();
+            std::lock_guard lock(m_damage_mutex);
+            m_damage_full = true;
         }
-        else
+        m_display_damage.fetch_add(1, std::memory_order_seq_cst);
+        WakeByAddressAll(&m_display_damage);
+    }
+
+    // only r, in canvas pixels, changed
+    void invalidate(const DirtyRect& r)
+    {
         {
-            si.commandBufferCount = 1;
-            si.pCommandBuffers = &m_cmd_stroke_clear.m_cmd.get();
+            std::lock_guard lock(m_damage_mutex);
+            m_damage_canvas.add(r);
         }
-        vk::UniqueFence submit_fence = m_dev->createFenceUnique(vk::FenceCreateInfo());
-        m_main_queue_mutex.lock();
-        m_main_queue.submit(si, *submit_fence);
-        m_main_queue_mutex.unlock();
-        m_dev->waitForFences(*submit_fence, true, UINT64_MAX);
+        m_display_damage.fetch_add(1, std::memory_order_seq_cst);
+        WakeByAddressAll(&m_display_damage);
     }
 
     virtual void on_keyup(int keycode) override
     {
         if (keycode == VK_SPACE)
         {
-            if ((int)m_samples > 1)
-                save_image(rt.m_resolved_img, rt.m_size, "out", vk::Format::eR8G8B8A8Unorm);
-            else
-                save_image(rt.m_fb_img, rt.m_size, "out", rt.m_format);
+            m_export_pending = true;
+            m_stroke_queue.wake();
         }
         else if (keycode == 'C')
         {
-            clear_rt();
+            m_clear_pending = true;
+            m_stroke_queue.wake();
         }
         else if (keycode == 'R')
         {
             m_zoom = 1.f;
             m_pan = { 0, 0 };
+            invalidate();
+        }
+        else if (keycode == 'B')
+        {
+            if (m_sparse_canvas)
+                std::cout << "the sparse canvas only supports compute strokes\n";
+            else if (rt.m_compute_supported)
+            {
+                m_compute_strokes = !m_compute_strokes;
+                m_segment_strokes = false;
+                m_resampler.m_segments = false;
+            }
+            else
+                std::cout << "compute strokes not supported with this render target\n";
+        }
+        else if (keycode == 'L')
+        {
+            // segments are drawn by the raster backend only
+            if (m_sparse_canvas)
+                std::cout << "the sparse canvas does not support segment strokes\n";
+            else
+            {
+                m_segment_strokes = !m_segment_strokes;
+                m_resampler.m_segments = m_segment_strokes;
+                m_compute_strokes = false;
+            }
+        }
+        else if (keycode == 'A')
+        {
+            if (rt.m_batch_pipeline_aa)
+                m_analytic_aa = !m_analytic_aa;
+            else
+                std::cout << "analytic antialiasing needs a single sample render target\n";
+        }
+        else if (keycode == 'N')
+        {
+            if (m_sparse_canvas)
+                std::cout << "the sparse canvas has no mips for the navigator\n";
+            else
+            {
+                m_navigator = !m_navigator;
+                invalidate();
+            }
+        }
+        else if (keycode == 'G')
+        {
+            m_trace_barriers = !m_trace_barriers;
+        }
+        else if (keycode >= '1' && keycode <= '9')
+        {
+            uint32_t tip = keycode - '1';
+            if (tip < m_brushes.count())
+            {
+                m_tip = tip;
+                std::cout << fmt::format("brush tip {}: {}\n", tip + 1, m_brushes.name(tip));
+            }
+        }
+        else if (keycode == 'M')
+        {
+            auto s = m_allocator.stats();
+            std::cout << fmt::format("memory: {} blocks {:.1f} MB, {} allocations {:.1f} MB, fragmentation {:.0f}%\n",
+                s.blocks, s.block_bytes / 1048576.0, s.allocations, s.used_bytes / 1048576.0, s.fragmentation * 100.f);
+        }
+    }
+
+    // brush.png and any image in brushes/ join the procedural tips
+    void create_brushes()
+    {
+        std::vector<std::filesystem::path> tip_sources = { "brush.png" };
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator("brushes", ec))
+        {
+            if (entry.path().extension() == ".png")
+                tip_sources.push_back(entry.path());
+        }
+        std::sort(tip_sources.begin() + 1, tip_sources.end());
+        m_brushes.create(m_textures, "brushes.bin", tip_sources);
+    }
+
+    // the m_check that need the device, after a headless init_vulkan():
+    // false when the check fails
+    bool run_check()
+    {
+        m_textures.create(m_allocator, m_dev, m_queues, QueueKind::graphics);
+        create_brushes();
+        m_sampler_linear = create_sampler(m_dev, vk::Filter::eLinear);
+        bool ok = false;
+        if (m_check == "compare-aa")
+            ok = compare_aa();
+        else if (m_check == "compare-compute")
+            ok = compare_compute();
+        else if (m_check == "check-allocs")
+            ok = check_allocs();
+        else if (m_check == "check-barriers")
+            ok = check_barriers();
+        m_textures.destroy();
+        return ok;
+    }
+
+    struct diff_t
+    {
+        int max_diff;
+        double psnr;
+    };
+    // rgba8 pixels against expected, rgb only: the dabs leave alpha untouched
+    static diff_t compare_rgb(const char* name, const std::vector<uint8_t>& pixels,
+        const std::vector<uint8_t>& expected)
+    {
+        double sum = 0, sum_sq = 0;
+        int max_diff = 0;
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            if (i % 4 == 3)
+                continue;
+            int d = std::abs((int)pixels[i] - (int)expected[i]);
+            sum += d;
+            sum_sq += d * d;
+            max_diff = std::max(max_diff, d);
+        }
+        double n = pixels.size() / 4 * 3;
+        double psnr = sum_sq > 0 ? 10.0 * std::log10(255.0 * 255.0 / (sum_sq / n)) : INFINITY;
+        std::cout << fmt::format("  {}: mean diff {:.3f}, max diff {}, psnr {:.1f} dB\n",
+            name, sum / n, max_diff, psnr);
+        return diff_t{ max_diff, psnr };
+    }
+
+    // the analytic antialiasing is checked against MSAA: below this PSNR or
+    // above this max channel difference it fails, and so it does when it is
+    // no closer than the hard edged single sample dabs
+    static constexpr double aa_min_psnr = 30.0;
+    static constexpr int aa_max_diff = 96;
+
+    // draws the same synthetic stroke on a MSAA target (8x or the most the
+    // device has) and on a single sample one with and without the analytic
+    // antialiasing, compares both with the MSAA one
+    bool compare_aa()
+    {
+        auto sample_counts = m_pd.getProperties().limits.framebufferColorSampleCounts;
+        vk::SampleCountFlagBits msaa = vk::SampleCountFlagBits::e8;
+        while (msaa != vk::SampleCountFlagBits::e1 && !(sample_counts & msaa))
+            msaa = vk::SampleCountFlagBits((uint32_t)msaa >> 1);
+        if (msaa == vk::SampleCountFlagBits::e1)
+        {
+            std::cout << "no multisampled color attachments to compare with, skipped\n";
+            return true;
+        }
+        m_brushes.wait();
+
+        const int size = 512;
+        RenderTarget reference, single;
+        reference.create(m_pd, m_allocator, m_dev, size, size, msaa, vk::Format::eR8G8B8A8Unorm);
+        single.create(m_pd, m_allocator, m_dev, size, size, vk::SampleCountFlagBits::e1, vk::Format::eR8G8B8A8Unorm);
+
+        std::array<vk::DescriptorPoolSize, 1> descr_pool_size = {
+            vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 2),
+        };
+        vk::UniqueDescriptorPool descr_pool = m_dev->createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo(
+            vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 2, descr_pool_size.size(), descr_pool_size.data()));
+        vk::UniqueCommandPool cmd_pool = m_dev->createCommandPoolUnique(vk::CommandPoolCreateInfo(
+            vk::CommandPoolCreateFlagBits::eResetCommandBuffer, m_family_idx));
+        vk::UniqueDescriptorSet reference_descr = CmdRenderStrokeBatch::create_descr(m_dev, descr_pool,
+            reference.m_batch_descr_layout, m_sampler_linear, m_brushes.view());
+        vk::UniqueDescriptorSet single_descr = CmdRenderStrokeBatch::create_descr(m_dev, descr_pool,
+            single.m_batch_descr_layout, m_sampler_linear, m_brushes.view());
+
+        // a wave growing from 2 to 16 pixels wide, thin dabs are where the
+        // edges matter the most
+        std::vector<CmdRenderStrokeBatch::dab_t> dabs(256);
+        for (size_t i = 0; i < dabs.size(); i++)
+        {
+            float t = (float)i / (dabs.size() - 1);
+            dabs[i].pos = { -0.8f + 1.6f * t, 0.5f * glm::sin(t * glm::two_pi<float>() * 2.f) };
+            dabs[i].scale = glm::mix(2.f, 16.f, t) / size;
+            dabs[i].pressure = 1.f;
+            dabs[i].col = { 0, 0, 0 };
+            dabs[i].tip = 0;
+        }
+
+        auto draw = [&](RenderTarget& target, const vk::UniqueDescriptorSet& descr, const vk::UniquePipeline& pipeline) {
+            CmdRenderStrokeBatch batch;
+            batch.create(m_dev, m_allocator, cmd_pool, descr, target.m_renderpass, target.m_framebuffer, pipeline,
+                target.m_batch_layout, vk::Extent2D(size, size), target.m_fb_state, (uint32_t)dabs.size());
+            for (const auto& dab : dabs)
+                batch.add(dab);
+            RenderGraph graph;
+            target.add_clear_pass(graph, glm::vec4(1));
+            batch.add_pass(graph);
+            target.mark_dirty(batch.dirty());
+            target.add_update_pass(graph);
+            target.add_display_pass(graph);
+            bool multisampled = target.m_samples != vk::SampleCountFlagBits::e1;
+            m_submit.run([&](vk::CommandBuffer cmd) { graph.execute(cmd); });
+            return read_image(multisampled ? target.m_resolved_img : target.m_fb_img, target.m_size, 4);
+        };
+        std::vector<uint8_t> expected = draw(reference, reference_descr, reference.m_batch_pipeline);
+        auto report = [&](const char* name, const std::vector<uint8_t>& pixels) {
+            return compare_rgb(name, pixels, expected);
+        };
+        std::cout << fmt::format("aa compare {}x{}, reference MSAA {}x {:.2f} MB, single sample {:.2f} MB\n",
+            size, size, (int)msaa, (reference.m_fb_mem.m_size + reference.m_resolved_mem.m_size) / 1048576.0,
+            single.m_fb_mem.m_size / 1048576.0);
+        diff_t hard = report("single sample", draw(single, single_descr, single.m_batch_pipeline));
+        diff_t aa = report("analytic aa", draw(single, single_descr, single.m_batch_pipeline_aa));
+
+        bool ok = aa.psnr >= aa_min_psnr && aa.max_diff <= aa_max_diff && aa.psnr > hard.psnr;
+        if (!ok)
+        {
+            std::cout << fmt::format("analytic aa FAILED: wants psnr >= {:.1f} dB and above single sample, "
+                "max diff <= {}\n", aa_min_psnr, aa_max_diff);
+        }
+        return ok;
+    }
+
+    // the compute backend is checked against the raster one without the
+    // analytic antialiasing: they mix the same dabs in the same order and only
+    // differ by rounding and by how the brush mip is picked
+    static constexpr double compute_min_psnr = 35.0;
+    static constexpr int compute_max_diff = 48;
+
+    // draws the same overlapping dabs with CmdRenderStrokeBatch and with
+    // CmdRenderStrokeCompute on one single sample target and compares them.
+    // Needs no extension nor optional feature, runs on lavapipe and SwiftShader.
+    bool compare_compute()
+    {
+        m_brushes.wait();
+
+        const int size = 512;
+        RenderTarget target;
+        target.create(m_pd, m_allocator, m_dev, size, size, vk::SampleCountFlagBits::e1, vk::Format::eR8G8B8A8Unorm);
+        if (!target.m_compute_supported)
+        {
+            std::cout << "no compute strokes on this device, skipped\n";
+            return true;
+        }
+
+        std::array<vk::DescriptorPoolSize, 3> descr_pool_size = {
+            vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 2),
+            vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, 1),
+            vk::DescriptorPoolSize(vk::DescriptorType::eStorageBufferDynamic, 2),
+        };
+        vk::UniqueDescriptorPool descr_pool = m_dev->createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo(
+            vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 2, descr_pool_size.size(), descr_pool_size.data()));
+        vk::UniqueCommandPool cmd_pool = m_dev->createCommandPoolUnique(vk::CommandPoolCreateInfo(
+            vk::CommandPoolCreateFlagBits::eResetCommandBuffer, m_family_idx));
+        vk::UniqueDescriptorSet batch_descr = CmdRenderStrokeBatch::create_descr(m_dev, descr_pool,
+            target.m_batch_descr_layout, m_sampler_linear, m_brushes.view());
+        ComputeStrokeSet compute_set;
+        compute_set.create(m_pd, m_allocator, m_dev, descr_pool, target.m_compute_descr_layout, 1,
+            m_sampler_linear, m_brushes.view(), target.m_fb_view);
+
+        // a spiral of translucent dabs in alternating colors, 8 to 40 pixels
+        // wide: they overlap across tiles and mask words, so any change of
+        // order shows
+        std::vector<CmdRenderStrokeBatch::dab_t> dabs(768);
+        for (size_t i = 0; i < dabs.size(); i++)
+        {
+            float t = (float)i / (dabs.size() - 1);
+            float a = t * glm::two_pi<float>() * 3.f;
+            dabs[i].pos = glm::vec2(glm::cos(a), glm::sin(a)) * glm::mix(0.1f, 0.8f, t);
+            dabs[i].scale = glm::mix(8.f, 40.f, t) / size;
+            dabs[i].pressure = 0.6f;
+            dabs[i].col = i % 3 == 0 ? glm::vec3(0.9f, 0.1f, 0.1f) : i % 3 == 1 ? glm::vec3(0.1f, 0.6f, 0.2f) :
+                glm::vec3(0.1f, 0.2f, 0.8f);
+            dabs[i].tip = 0;
+        }
+
+        auto draw = [&](bool compute) {
+            CmdRenderStrokeBatch batch;
+            CmdRenderStrokeCompute strokes;
+            RenderGraph graph;
+            target.add_clear_pass(graph, glm::vec4(1));
+            if (compute)
+            {
+                strokes.create(m_dev, cmd_pool, compute_set, 0, target.m_bin_pipeline, target.m_raster_pipeline,
+                    target.m_compute_layout, target.m_size, target.m_fb_state);
+                for (const auto& dab : dabs)
+                    strokes.add(dab);
+                strokes.add_pass(graph);
+                target.mark_dirty(strokes.dirty());
+            }
+            else
+            {
+                batch.create(m_dev, m_allocator, cmd_pool, batch_descr, target.m_renderpass, target.m_framebuffer,
+                    target.m_batch_pipeline, target.m_batch_layout, vk::Extent2D(size, size), target.m_fb_state,
+                    (uint32_t)dabs.size());
+                for (const auto& dab : dabs)
+                    batch.add(dab);
+                batch.add_pass(graph);
+                target.mark_dirty(batch.dirty());
+            }
+            target.add_update_pass(graph);
+            target.add_display_pass(graph);
+            m_submit.run([&](vk::CommandBuffer cmd) { graph.execute(cmd); });
+            return read_image(target.m_fb_img, target.m_size, 4);
+        };
+        std::cout << fmt::format("compute compare {}x{}, {} dabs\n", size, size, dabs.size());
+        std::vector<uint8_t> expected = draw(false);
+        diff_t diff = compare_rgb("compute", draw(true), expected);
+
+        bool ok = diff.psnr >= compute_min_psnr && diff.max_diff <= compute_max_diff;
+        if (!ok)
+        {
+            std::cout << fmt::format("compute strokes FAILED: wants psnr >= {:.1f} dB and max diff <= {}\n",
+                compute_min_psnr, compute_max_diff);
+        }
+        return ok;
+    }
+
+    // a stroke backend as picked with 'B', 'L' and 'A'
+    struct backend_t
+    {
+        const char* name;
+        bool compute;
+        bool segments;
+        bool aa;
+    };
+
+    // paints headless through the canvas thread, as the window would: the
+    // same stroke frames times with every backend of the canvas, waiting for
+    // the canvas thread to submit it each time. frame(backend, i) is called
+    // after every frame.
+    template<typename F>
+    void paint_frames(uint32_t frames, F&& frame)
+    {
+        // the canvas needs the display render pass, there is no swapchain
+        m_swapchain_extent = vk::Extent2D(800, 600);
+        init_pipeline();
+        create_canvas();
+        // the library streaming would show up as allocations
+        m_brushes.wait();
+        m_canvas_render_thread = std::thread(&DrawApp::canvas_render_thread, this);
+
+        // a circle in canvas units, a new stroke every frame
+        StrokeSamples stroke;
+        for (int i = 0; i < 256; i++)
+        {
+            float a = glm::two_pi<float>() * i / 256.f;
+            stroke.push_back(glm::vec2(glm::cos(a), glm::sin(a)) * 0.5f, 1.f, i == 0);
         }
+        std::vector<backend_t> backends;
+        if (m_sparse_canvas)
+            backends.push_back({ "sparse compute", true, false, false });
+        else
+        {
+            backends.push_back({ "raster", false, false, false });
+            if (rt.m_batch_pipeline_aa)
+                backends.push_back({ "raster aa", false, false, true });
+            backends.push_back({ "segments", false, true, false });
+            if (rt.m_compute_supported)
+                backends.push_back({ "compute", true, false, false });
+        }
+
+        uint64_t pushed = 0;
+        for (const backend_t& backend : backends)
+        {
+            m_compute_strokes = backend.compute;
+            m_segment_strokes = backend.segments;
+            m_analytic_aa = backend.aa;
+            for (uint32_t i = 0; i < frames; i++)
+            {
+                for (uint32_t n = 0; n < stroke.size(); )
+                    n += m_stroke_queue.push((uint32_t)stroke.size() - n, [&](uint32_t k) { return stroke.get(n + k); });
+                pushed += stroke.size();
+                for (uint64_t done = m_samples_done; done < pushed; done = m_samples_done)
+                    WaitOnAddress(&m_samples_done, &done, sizeof(done), INFINITE);
+                frame(backend, i);
+            }
+        }
+
+        m_running = false;
+        m_stroke_queue.wake();
+        m_canvas_render_thread.join();
+    }
+
+    // frames every backend gets to reach its steady state, then the frames
+    // the stroke checks look at
+    static constexpr uint32_t check_warmup_frames = 16;
+    static constexpr uint32_t check_frames = 64;
+
+    // --check-allocs: once a backend is warm, painting creates no semaphore,
+    // fence, command buffer nor device memory
+    bool check_allocs()
+    {
+        struct counters_t
+        {
+            uint32_t semaphores;
+            uint32_t fences;
+            uint32_t command_buffers;
+            uint32_t blocks;
+            uint32_t allocations;
+            vk::DeviceSize used_bytes;
+
+            bool operator==(const counters_t& o) const
+            {
+                return semaphores == o.semaphores && fences == o.fences && command_buffers == o.command_buffers &&
+                    blocks == o.blocks && allocations == o.allocations && used_bytes == o.used_bytes;
+            }
+        };
+        auto counters = [&] {
+            auto s = m_allocator.stats();
+            return counters_t{ SubmitContext::s_created_semaphores, SubmitContext::s_created_fences,
+                SubmitContext::s_created_command_buffers, s.blocks, s.allocations, s.used_bytes };
+        };
+        auto print = [](const counters_t& c) {
+            return fmt::format("{} semaphores, {} fences, {} command buffers, {} blocks, {} allocations {:.1f} MB",
+                c.semaphores, c.fences, c.command_buffers, c.blocks, c.allocations, c.used_bytes / 1048576.0);
+        };
+        std::cout << fmt::format("allocations check, {} frames after {} warm up frames\n",
+            check_frames, check_warmup_frames);
+        bool ok = true;
+        counters_t warm{};
+        bool flat = true;
+        paint_frames(check_warmup_frames + check_frames, [&](const backend_t& backend, uint32_t i) {
+            counters_t c = counters();
+            if (i + 1 == check_warmup_frames)
+            {
+                warm = c;
+                flat = true;
+            }
+            else if (i >= check_warmup_frames && flat && !(c == warm))
+            {
+                std::cout << fmt::format("  {} FAILED at frame {}: {}, warm {}\n", backend.name, i,
+                    print(c), print(warm));
+                flat = false;
+                ok = false;
+            }
+            if (i + 1 == check_warmup_frames + check_frames && flat)
+                std::cout << fmt::format("  {}: flat, {}\n", backend.name, print(c));
+        });
+        return ok;
+    }
+
+    // --check-barriers: once a backend is warm, every frame of the same
+    // stroke is submitted with the same barriers, none accumulates
+    bool check_barriers()
+    {
+        std::cout << fmt::format("barriers check, {} frames after {} warm up frames\n",
+            check_frames, check_warmup_frames);
+        bool ok = true;
+        uint32_t warm_barriers = 0;
+        uint32_t warm_imbs = 0;
+        bool flat = true;
+        paint_frames(check_warmup_frames + check_frames, [&](const backend_t& backend, uint32_t i) {
+            uint32_t barriers = m_submit_barriers;
+            uint32_t imbs = m_submit_image_barriers;
+            if (i + 1 == check_warmup_frames)
+            {
+                warm_barriers = barriers;
+                warm_imbs = imbs;
+                flat = true;
+            }
+            else if (i >= check_warmup_frames && flat && (barriers != warm_barriers || imbs != warm_imbs))
+            {
+                std::cout << fmt::format("  {} FAILED at frame {}: {} barriers {} image barriers, warm {} and {}\n",
+                    backend.name, i, barriers, imbs, warm_barriers, warm_imbs);
+                // the next submissions print theirs
+                m_trace_barriers = true;
+                flat = false;
+                ok = false;
+            }
+            if (i + 1 == check_warmup_frames + check_frames && flat)
+            {
+                std::cout << fmt::format("  {}: flat, {} barriers {} image barriers per frame\n",
+                    backend.name, barriers, imbs);
+            }
+        });
+        return ok;
+    }
+
+    // the reference stroke, a 48 pixels brush at full pressure and zoom 1,
+    // has to get at least this many times fewer dabs than the old input path
+    static constexpr double dabs_min_reduction = 10.0;
+
+    // --count-dabs, needs no device: runs m_resampler over a fast mouse
+    // stroke and counts its dabs against the one per window pixel of motion
+    // the input path emitted before it
+    bool count_dabs()
+    {
+        m_swapchain_extent = vk::Extent2D(800, 600);
+        // a wave across the window, an event every 13 pixels or so
+        std::vector<glm::vec2> events;
+        for (int i = 0; i <= 100; i++)
+        {
+            float t = i / 100.f;
+            events.push_back({ 100.f + 600.f * t, 300.f + 200.f * glm::sin(t * glm::two_pi<float>() * 1.5f) });
+        }
+        // window pixels to canvas units at zoom 1
+        const float px = 2.f / m_swapchain_extent.height;
+        struct case_t
+        {
+            const char* name;
+            float zoom;
+            float radius;
+            float pressure;
+        };
+        const float radius = m_resampler.m_radius;
+        const case_t cases[] = {
+            { "reference, 48 px brush", 1.f, 24.f * px, 1.f },
+            { "default brush", 1.f, radius, 1.f },
+            { "default brush, zoom 4", 4.f, radius, 1.f },
+            { "default brush, zoom 1/4", 0.25f, radius, 1.f },
+            { "default brush, pressure 0.2", 1.f, radius, 0.2f },
+        };
+        float stroke_px = 0;
+        for (size_t i = 1; i < events.size(); i++)
+            stroke_px += glm::distance(events[i - 1], events[i]);
+        std::cout << fmt::format("dab count, {:.0f} px stroke in a {}x{} window\n", stroke_px,
+            m_swapchain_extent.width, m_swapchain_extent.height);
+        bool ok = true;
+        for (const case_t& c : cases)
+        {
+            m_zoom = c.zoom;
+            StrokeResampler resampler = m_resampler;
+            resampler.m_radius = c.radius;
+            resampler.m_segments = false;
+            StrokeSamples out;
+            glm::mat4 m = px_to_canvas();
+            size_t before = 0;
+            float len = 0;
+            resampler.begin(events[0], c.pressure, m, out);
+            for (size_t i = 1; i < events.size(); i++)
+            {
+                before += (size_t)glm::ceil(glm::distance(events[i - 1], events[i]));
+                len += glm::distance(glm::vec2(m * glm::vec4(events[i - 1], 0, 1)),
+                    glm::vec2(m * glm::vec4(events[i], 0, 1)));
+                resampler.move(events[i], c.pressure, m, out);
+            }
+            // no two dabs closer than the floor, whatever the pressure
+            size_t most = (size_t)(len / (resampler.m_min_step * c.radius)) + 1;
+            double reduction = (double)before / out.size();
+            std::cout << fmt::format("  {}: {} -> {} dabs ({:.1f}x)\n", c.name, before, out.size(), reduction);
+            if (out.size() > most)
+            {
+                std::cout << fmt::format("  {} FAILED: more dabs than the spacing floor allows ({})\n", c.name, most);
+                ok = false;
+            }
+            if (&c == &cases[0] && reduction < dabs_min_reduction)
+            {
+                std::cout << fmt::format("  {} FAILED: wants at least {:.0f}x fewer dabs\n", c.name, dabs_min_reduction);
+                ok = false;
+            }
+        }
+        m_zoom = 1.f;
+        return ok;
     }
 
     void main_render_thread()
@@ -86,14 +683,37 @@ public:
         auto timer_start = std::chrono::high_resolution_clock::now();
         uint32_t frames = 0;
         float timer_fps = 0;
+        uint32_t presented = 0;
         while (m_running)
         {
+            // nothing changed since the last frame, sleep until invalidate()
+            uint32_t damage = m_display_damage.load(std::memory_order_seq_cst);
+            if (damage == presented)
+            {
+                WaitOnAddress(&m_display_damage, &damage, sizeof(damage), INFINITE);
+                continue;
+            }
+
             auto timer_stop = std::chrono::high_resolution_clock::now();
             auto timer_diff = std::chrono::duration<float>(timer_stop - timer_start);
             timer_start = timer_stop;
             float dt = timer_diff.count();
+            // damage arriving while rendering is drawn by the next frame
             if (render_frame(dt))
+            {
                 frames++;
+                presented = damage;
+            }
+            else if (m_swapchain_lost)
+            {
+                // the damage stays pending: sleep until a resize invalidates
+                // or a while, then replace the swapchain if the window has an
+                // extent again (out of date without a WM_SIZE)
+                WaitOnAddress(&m_display_damage, &damage, sizeof(damage), 250);
+                create_swapchain();
+                if (!m_swapchain_lost)
+                    invalidate();
+            }
 
             timer_fps += dt;
             float timer_fps_sec;
@@ -101,10 +721,19 @@ public:
             if (timer_fps_sec >= 1.f)
             {
                 timer_fps = timer_fps_dec;
-                std::string title = fmt::format("Vulkan {} - {} fps - {} stroke/sec - res {}x{}{}",
-                    m_device_name, frames, m_strokes_count,
-                    rt.m_size.x, rt.m_size.y,
-                    (int)m_samples > 1 ? fmt::format(" - MSAA {}x", (int)m_samples) : "");
+                std::string title = m_sparse_canvas ?
+                    fmt::format("Vulkan {} - {} fps - {} stroke/sec - sparse {}x{} - pages {}/{}{}{}",
+                        m_device_name, frames, m_strokes_count,
+                        m_canvas.m_size.x, m_canvas.m_size.y,
+                        m_canvas.used_slots(), m_canvas.slots(), m_pool_full ? " full" : "",
+                        m_export_percent >= 0 ? fmt::format(" - export {}%", (int)m_export_percent) : "") :
+                    fmt::format("Vulkan {} - {} fps - {} stroke/sec - res {}x{}{} - {}{}",
+                        m_device_name, frames, m_strokes_count,
+                        rt.m_size.x, rt.m_size.y,
+                        (int)m_samples > 1 ? fmt::format(" - MSAA {}x", (int)m_samples) : "",
+                        m_compute_strokes ? "compute" : m_segment_strokes ? "segments" :
+                        m_analytic_aa && rt.m_batch_pipeline_aa ? "raster aa" : "raster",
+                        m_export_percent >= 0 ? fmt::format(" - export {}%", (int)m_export_percent) : "");
                 SetWindowTextA(m_wnd, title.c_str());
                 frames = 0;
                 m_strokes_count = 0;
@@ -112,121 +741,514 @@ public:
         }
     }
 
+    // records the copy of the canvas on the canvas thread and hands it to
+    // m_exporter, the sparse canvas exports the bounding box of its painted pages
+    void export_canvas(RenderGraph& graph, SubmitContext& submit)
+    {
+        DirtyRect painted = m_sparse_canvas ? m_canvas.painted() : DirtyRect();
+        if (m_sparse_canvas && painted.empty())
+        {
+            std::cout << "export: empty canvas\n";
+            return;
+        }
+        vk::Format format = m_sparse_canvas ? m_canvas.m_format : rt.display_format();
+        glm::ivec2 size = m_sparse_canvas ? painted.max - painted.min : rt.m_size;
+        auto job = m_exporter.begin(size, format, format == vk::Format::eR32G32B32A32Sfloat ? "out.hdr" : "out.jpg",
+            [this](const Exporter::progress_t& p) {
+                if (p.stage == Exporter::Stage::done)
+                    std::cout << fmt::format("exported {} in {:.0f} ms\n", p.path.string(), p.ms);
+                else if (p.stage == Exporter::Stage::failed)
+                    std::cout << fmt::format("export failed: {}\n", p.error);
+                bool finished = p.stage == Exporter::Stage::done || p.stage == Exporter::Stage::failed;
+                m_export_percent = finished ? -1 : (int)(p.progress * 100.f);
+            });
+        DirtyRect dirty;
+        if (m_sparse_canvas)
+        {
+            m_canvas.add_copy_pass(graph, *job->buffer, painted);
+            m_canvas.add_display_pass(graph);
+        }
+        else
+        {
+            if (rt.needs_update())
+                dirty = rt.add_update_pass(graph);
+            rt.add_copy_pass(graph, *job->buffer);
+            rt.add_display_pass(graph);
+        }
+        vk::CommandBuffer cmd = submit.begin();
+        graph.execute(cmd);
+        cmd.end();
+        vk::SubmitInfo si;
+        si.commandBufferCount = 1;
+        si.pCommandBuffers = &cmd;
+        if (job->copied)
+        {
+            si.signalSemaphoreCount = 1;
+            si.pSignalSemaphores = &*job->copied;
+        }
+        submit.submit(si, cmd);
+        m_exporter.commit(job);
+        if (!dirty.empty())
+            invalidate(dirty);
+    }
+
     void canvas_render_thread()
     {
-        auto cmd_pool_info = vk::CommandPoolCreateInfo({}, m_family_idx);
+        auto cmd_pool_info = vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, m_family_idx);
         vk::UniqueCommandPool cmd_pool = m_dev->createCommandPoolUnique(cmd_pool_info);
+        SubmitContext submit;
+        submit.create(m_dev, m_queues, QueueKind::graphics);
 
-        const size_t n = 1000;
-        std::array<vk::DescriptorPoolSize, 2> descr_pool_size = {
-            vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, n * 2),
-            vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, n * 2),
+        // the stroke sets bind the fallback tip until the library is packed
+        // and streamed, then the tips once. A library failing to load keeps
+        // painting with the fallback.
+        m_brushes.wait_fallback();
+        const vk::UniqueImageView* brush_view = &m_brushes.view();
+        bool brushes_settled = m_brushes.settled();
+
+        // every slot owns the command buffers and mapped buffers of one
+        // submission, the CPU fills the next slot while the GPU runs the others
+        const uint32_t slots_count = m_strokes_in_flight;
+        // one set per backend shared by the slots, whatever their number
+        std::array<vk::DescriptorPoolSize, 4> descr_pool_size = {
+            vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 2),
+            vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, 1),
+            vk::DescriptorPoolSize(vk::DescriptorType::eStorageBufferDynamic, 2),
+            vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 1),
         };
         auto descr_pool_info = vk::DescriptorPoolCreateInfo(
             vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-            n * 4, descr_pool_size.size(), descr_pool_size.data());
+            2, descr_pool_size.size(), descr_pool_size.data());
         vk::UniqueDescriptorPool descr_pool = m_dev->createDescriptorPoolUnique(descr_pool_info);
-        
-        std::vector<CmdRenderStroke> m_cmd_strokes(n);
-        std::vector<vk::CommandBuffer> cmd_strokes_cmd(m_cmd_strokes.size());
-        for (int i = 0; i < m_cmd_strokes.size(); i++)
+        vk::UniqueDescriptorSet batch_descr;
+        ComputeStrokeSet compute_set;
+        if (m_sparse_canvas)
         {
-            m_cmd_strokes[i].m_cleared = true;
-            m_cmd_strokes[i].create(m_dev, m_pd, cmd_pool, descr_pool, rt.m_descr_layout, rt.m_renderpass,
-                rt.m_framebuffer, rt.m_pipeline, rt.m_layout, m_sampler_linear, vk::Extent2D(rt.m_size.x, rt.m_size.y),
-                rt.m_fb_img, rt.m_fb_view, m_tex.m_view, { 0, 1, 0 });
+            compute_set.create(m_pd, m_allocator, m_dev, descr_pool, m_canvas.m_compute_descr_layout, slots_count,
+                m_sampler_linear, *brush_view, m_canvas.m_pool_view, *m_canvas.m_pages_buffer);
+        }
+        else
+        {
+            batch_descr = CmdRenderStrokeBatch::create_descr(m_dev, descr_pool, rt.m_batch_descr_layout,
+                m_sampler_linear, *brush_view);
+            if (rt.m_compute_supported)
+            {
+                compute_set.create(m_pd, m_allocator, m_dev, descr_pool, rt.m_compute_descr_layout, slots_count,
+                    m_sampler_linear, *brush_view, rt.m_fb_view);
+            }
         }
 
-        std::cout << "canvas ready\n";
-
-        while (m_running)
+        struct StrokeSlot
+        {
+            CmdRenderStrokeBatch batch;
+            CmdRenderStrokeCompute compute;
+            CmdRenderStrokeSegments segments;
+            // completion of the last submission of the slot
+            uint64_t submit_id = 0;
+        };
+        const uint32_t batch_capacity = 4096;
+        std::vector<StrokeSlot> slots(slots_count);
+        for (uint32_t i = 0; i < slots_count; i++)
         {
-            std::vector<StrokeSample> samples;
+            auto& slot = slots[i];
+            if (m_sparse_canvas)
             {
-                std::unique_lock lock(m_stroke_mutex);
-                m_stroke_cv.wait(lock, [&] {
-                    if (m_running && m_stroke_samples.empty()) return false; // keep waiting 
-                    else return true;
-                });
-                samples = std::move(m_stroke_samples);
+                slot.compute.create(m_dev, cmd_pool, compute_set, i, m_canvas);
             }
+            else
+            {
+                slot.batch.create(m_dev, m_allocator, cmd_pool, batch_descr, rt.m_renderpass, rt.m_framebuffer,
+                    rt.m_batch_pipeline, rt.m_batch_layout, vk::Extent2D(rt.m_size.x, rt.m_size.y),
+                    rt.m_fb_state, batch_capacity);
+                slot.segments.create(m_dev, m_allocator, cmd_pool, rt.m_renderpass, rt.m_framebuffer, rt.m_segment_pipeline,
+                    rt.m_segment_layout, vk::Extent2D(rt.m_size.x, rt.m_size.y), rt.m_fb_state, batch_capacity);
+            }
+            if (!m_sparse_canvas && rt.m_compute_supported)
+            {
+                slot.compute.create(m_dev, cmd_pool, compute_set, i, rt.m_bin_pipeline, rt.m_raster_pipeline,
+                    rt.m_compute_layout, rt.m_size, rt.m_fb_state);
+            }
+        }
+        uint32_t slot_idx = 0;
+        // blocks only when the GPU is still running the submission of this slot
+        auto wait_slot = [&](StrokeSlot& slot) {
+            submit.wait(slot.submit_id);
+        };
+        // a dab needs more pages than the pool has free: the pool doubles
+        // while nothing reads it, neither the stroke submissions nor the
+        // frames in flight
+        auto grow_pool = [&] {
+            submit.wait_idle();
+            std::lock_guard lock(m_swapchain_mutex);
+            m_frame_submit.wait_idle();
+            if (!m_canvas.grow(m_allocator, m_dev, submit))
+                return false;
+            compute_set.set_target(m_dev, m_canvas.m_pool_view);
+            CmdRenderToScreen::write_descr(m_dev, *m_display_descr, m_canvas.m_sampler, m_canvas.m_pool_view,
+                *m_canvas.m_pages_buffer);
+            std::cout << fmt::format("canvas pages pool grown to {} pages\n", m_canvas.slots());
+            return true;
+        };
+        // the rest of a stroke that found the pool full is dropped
+        bool drop_stroke = false;
+
+        auto to_dab = [&](const StrokeSamples& samples, size_t i) {
+            CmdRenderStrokeBatch::dab_t dab;
+            dab.pos = { samples.x[i], -samples.y[i] };
+            dab.scale = m_resampler.m_radius * samples.pressure[i];
+            dab.pressure = 1.f;
+            dab.col = glm::vec3(0);
+            dab.tip = m_tip;
+            return dab;
+        };
+        // the previous point of the stroke, segments continue across chunks
+        bool seg_open = false;
+        glm::vec2 seg_last;
+        float seg_last_radius = 0.f;
+        // the segment before, its coverage is not blended twice at the joint
+        glm::vec4 seg_prev = glm::vec4(0);
+        auto to_segment = [&](const StrokeSamples& samples, size_t i) {
+            CmdRenderStrokeSegments::segment_t seg;
+            glm::vec2 p = { samples.x[i], -samples.y[i] };
+            float r = m_resampler.m_radius * samples.pressure[i];
+            // a new stroke starts with a round dot
+            if (samples.start[i] || !seg_open)
+            {
+                seg_last = p;
+                seg_last_radius = r;
+                seg_prev = glm::vec4(0);
+                seg_open = true;
+            }
+            seg.a = seg_last;
+            seg.b = p;
+            seg.radius = { seg_last_radius, r };
+            seg.col = glm::vec4(0, 0, 0, 1);
+            seg.prev = seg_prev;
+            seg_prev = glm::vec4(seg.a, seg.radius.x, 1.f);
+            seg_last = p;
+            seg_last_radius = r;
+            return seg;
+        };
+
+        // barriers of the canvas images, reused for every submission
+        RenderGraph graph;
 
+        std::cout << "canvas ready\n";
+
+        // reused for every chunk, no allocations once they reached their size
+        std::vector<StrokeSample> popped(4096);
+        StrokeSamples samples;
+        while (m_running)
+        {
+            m_stroke_queue.wait([&] { return !m_running || m_clear_pending || m_export_pending; });
             if (!m_running)
                 break;
 
-            int buf_size = m_cmd_strokes.size() - 1;
-            int n = std::ceilf((float)samples.size() / buf_size);
-            for (int blk = 0; blk < n; blk++)
+            // the tips arrived: rebound once the submissions reading the
+            // fallback are done, the slots record their sets again anyway
+            if (!brushes_settled && m_brushes.settled())
             {
-                int i = 0;
-                int offset = blk * buf_size;
-                int samples_count = std::min<int>(buf_size, samples.size() - offset);
-                for (; i < samples_count; i++)
+                brushes_settled = true;
+                if (&m_brushes.view() != brush_view)
                 {
-                    float x = samples[offset + i].cur.x;
-                    float y = -samples[offset + i].cur.y;
+                    brush_view = &m_brushes.view();
+                    submit.wait_idle();
+                    if (batch_descr)
+                        CmdRenderStrokeBatch::write_descr(m_dev, *batch_descr, m_sampler_linear, *brush_view);
+                    if (compute_set.m_descr)
+                        compute_set.set_brush(m_dev, m_sampler_linear, *brush_view);
+                }
+            }
 
-                    m_cmd_strokes[i].m_frag_ubo.m_value.col = glm::vec3(0, 0, 0);
-                    m_cmd_strokes[i].m_frag_ubo.m_value.pressure = 1.f;
-                    m_cmd_strokes[i].m_frag_ubo.update(m_dev);
+            // queued before the strokes that follow, the graph orders it after
+            // the ones still running
+            if (m_clear_pending.exchange(false))
+            {
+                if (m_sparse_canvas)
+                {
+                    // the submissions in flight read the page table
+                    submit.wait_idle();
+                    m_canvas.clear();
+                    m_pool_full = false;
+                }
+                else
+                {
+                    rt.add_clear_pass(graph, glm::vec4(1));
+                    rt.add_display_pass(graph);
+                    vk::CommandBuffer cmd = submit.begin();
+                    graph.execute(cmd);
+                    submit.submit(cmd);
+                }
+                invalidate();
+            }
 
-                    m_cmd_strokes[i].m_vert_ubo.m_value.mvp = glm::translate(glm::vec3(x, y, 0))
-                        * glm::scale(glm::vec3(0.01f * samples[offset + i].pressure));
-                    m_cmd_strokes[i].m_vert_ubo.update(m_dev);
-                    m_strokes_count++;
+            // the snapshot holds the strokes submitted so far, the ones
+            // popped below go after the copy
+            if (m_export_pending.exchange(false))
+                export_canvas(graph, submit);
 
-                    cmd_strokes_cmd[i] = *m_cmd_strokes[i].m_cmd;
+            samples.clear();
+            while (uint32_t n = m_stroke_queue.pop(popped.data(), (uint32_t)popped.size()))
+            {
+                for (uint32_t i = 0; i < n; i++)
+                    samples.push_back(popped[i]);
+            }
+            if (samples.empty())
+                continue;
+
+            bool use_compute = m_sparse_canvas || (m_compute_strokes && rt.m_compute_supported);
+            bool use_segments = !use_compute && m_segment_strokes;
+            // submits the dabs collected so far, the resolve and the mips go
+            // with the last one.
+            // Submissions on the same queue run in order and the graph puts a
+            // barrier on the canvas before every stroke pass, the display pass
+            // is ordered after them the same way: nothing here waits for the
+            // GPU except when a slot comes around again.
+            auto flush = [&](bool last) {
+                auto& batch = slots[slot_idx].batch;
+                auto& compute = slots[slot_idx].compute;
+                auto& segments = slots[slot_idx].segments;
+                vk::CommandBuffer cmd;
+                DirtyRect dirty;
+                uint32_t count = 0;
+                if (use_compute)
+                {
+                    cmd = *compute.m_cmd;
+                    dirty = compute.dirty();
+                    count = compute.m_count;
+                    if (!dirty.empty())
+                        compute.add_pass(graph);
+                }
+                else if (use_segments)
+                {
+                    cmd = *segments.m_cmd;
+                    dirty = segments.dirty();
+                    count = segments.m_count;
+                    if (!dirty.empty())
+                        segments.add_pass(graph);
                 }
-                offset += samples_count;
+                else
+                {
+                    cmd = *batch.m_cmd;
+                    dirty = batch.dirty();
+                    count = batch.m_count;
+                    batch.m_pipeline = m_analytic_aa && rt.m_batch_pipeline_aa ?
+                        *rt.m_batch_pipeline_aa : *rt.m_batch_pipeline;
+                    if (!dirty.empty())
+                        batch.add_pass(graph);
+                }
+                if (!m_sparse_canvas)
+                    rt.mark_dirty(dirty);
+                bool update = !m_sparse_canvas && last && rt.needs_update();
+                m_strokes_count += count;
+                // all the dabs fell outside the canvas
+                if (dirty.empty() && !update)
+                {
+                    batch.clear();
+                    compute.clear();
+                    segments.clear();
+                    return;
+                }
+                // the display samples the resolved image and the mips, which
+                // also change where the earlier submissions of the chunk drew
+                if (update)
+                    dirty.add(rt.add_update_pass(graph));
+                if (m_sparse_canvas)
+                    m_canvas.add_display_pass(graph);
+                else
+                    rt.add_display_pass(graph);
+
+                // the pool is created with eResetCommandBuffer, begin() resets implicitly
+                cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+                graph.execute(cmd);
+                cmd.end();
+                if (m_trace_barriers)
+                    std::cout << graph.dump();
+                uint32_t imbs = 0;
+                for (const auto& b : graph.barriers())
+                    imbs += b.imb_count;
+                m_submit_barriers = (uint32_t)graph.barriers().size();
+                m_submit_image_barriers = imbs;
+                batch.clear();
+                compute.clear();
+                segments.clear();
+
+                vk::SubmitInfo si;
+                si.commandBufferCount = 1;
+                si.pCommandBuffers = &cmd;
+                slots[slot_idx].submit_id = submit.submit(si);
+                // the display pass is queued after it on the same queue
+                invalidate(dirty);
 
-                vk::UniqueFence strokes_fence = m_dev->createFenceUnique(vk::FenceCreateInfo());
-                if (m_samples == vk::SampleCountFlagBits::e1 || (blk < n - 1))
+                slot_idx = (slot_idx + 1) % slots_count;
+                wait_slot(slots[slot_idx]);
+            };
+
+            // a compute batch is also closed when its dirty rect grows over
+            // max_tiles, so batches are cut while streaming the samples
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                auto& batch = slots[slot_idx].batch;
+                auto& compute = slots[slot_idx].compute;
+                auto& segments = slots[slot_idx].segments;
+                if (drop_stroke)
+                {
+                    if (!samples.start[i])
+                        continue;
+                    drop_stroke = false;
+                }
+                if (use_segments)
+                {
+                    if (segments.full())
+                        flush(false);
+                    segments.add(to_segment(samples, i));
+                    continue;
+                }
+                auto dab = to_dab(samples, i);
+                if (use_compute)
                 {
-                    vk::SubmitInfo si;
-                    si.commandBufferCount = samples_count;
-                    si.pCommandBuffers = cmd_strokes_cmd.data();
-                    m_main_queue_mutex.lock();
-                    m_main_queue.submit(si, *strokes_fence);
-                    m_main_queue_mutex.unlock();
-                    m_dev->waitForFences(*strokes_fence, true, UINT64_MAX);
+                    if (compute.m_count > 0 && !compute.can_add(dab))
+                        flush(false);
+                    if (m_sparse_canvas && !m_canvas.fits(dab.bounds(m_canvas.m_size)) && !grow_pool())
+                    {
+                        // painting on would leave holes where pages are missing
+                        if (!m_pool_full.exchange(true))
+                            std::cout << "canvas pages pool full, stroke stopped\n";
+                        drop_stroke = true;
+                        continue;
+                    }
+                    compute.add(dab);
                 }
                 else
                 {
-                    cmd_strokes_cmd[i] = *rt.cmd_resolve;
-
-                    vk::SubmitInfo si;
-                    si.commandBufferCount = samples_count + 1;
-                    si.pCommandBuffers = cmd_strokes_cmd.data();
-                    m_main_queue_mutex.lock();
-                    m_main_queue.submit(si, *strokes_fence);
-                    m_main_queue_mutex.unlock();
+                    if (batch.full())
+                        flush(false);
+                    batch.add(dab);
                 }
-                m_dev->waitForFences(*strokes_fence, true, UINT64_MAX);
             }
+            flush(true);
+            m_samples_done.fetch_add(samples.size(), std::memory_order_seq_cst);
+            WakeByAddressAll(&m_samples_done);
+        }
 
-            //std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        // the slots own resources the GPU may still be using
+        submit.wait_idle();
+    }
+
+    // the document, before the canvas thread starts
+    void create_canvas()
+    {
+        if (m_sparse_canvas)
+        {
+            m_canvas.create(m_allocator, m_dev, m_submit, m_sparse_size.x, m_sparse_size.y,
+                m_pd.getProperties().limits.maxImageArrayLayers, m_renderpass);
+        }
+        else
+        {
+            rt.create(m_pd, m_allocator, m_dev, 2048, 2048, m_samples, vk::Format::eR8G8B8A8Unorm);
+            // the canvas thread is not running yet, it takes the canvas from here
+            RenderGraph graph;
+            rt.add_clear_pass(graph, glm::vec4(1));
+            rt.add_display_pass(graph);
+            m_submit.run([&](vk::CommandBuffer cmd) { graph.execute(cmd); });
         }
     }
 
     virtual void on_init() override
     {
-        rt.create(m_pd, m_dev, 2048, 2048, m_samples, vk::Format::eR8G8B8A8Unorm);
-        if ((int)m_samples > 1)
-            rt.create_resolver(m_dev, m_cmd_pool, m_main_queue);
-        m_tex.create(m_pd, m_dev, m_main_queue, m_cmd_pool, "brush.png");
+        create_canvas();
+        m_textures.create(m_allocator, m_dev, m_queues, QueueKind::graphics);
+        m_exporter.create(m_allocator, m_dev, m_queues, QueueKind::graphics);
+        create_brushes();
         m_sampler_linear = create_sampler(m_dev, vk::Filter::eLinear);
         m_sampler_nearest = create_sampler(m_dev, vk::Filter::eNearest);
-        render_finished_sem = m_dev->createSemaphoreUnique(vk::SemaphoreCreateInfo());
-        clear_rt();
+        if (m_sparse_canvas)
+        {
+            m_display_descr = CmdRenderToScreen::create_descr(m_dev, m_descr_pool, m_canvas.m_display_descr_layout,
+                m_canvas.m_sampler, m_canvas.m_pool_view, *m_canvas.m_pages_buffer);
+        }
+        else
+        {
+            m_display_descr = CmdRenderToScreen::create_descr(m_dev, m_descr_pool, m_descr_layout, m_sampler_linear,
+                rt.m_display_view);
+        }
+        m_screen_cmd_pool = m_dev->createCommandPoolUnique(vk::CommandPoolCreateInfo(
+            vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient, m_family_idx));
+        {
+            // the first swapchain was created before the passes could be
+            std::lock_guard lock(m_swapchain_mutex);
+            on_swapchain_images();
+        }
 
         m_canvas_render_thread = std::thread(&DrawApp::canvas_render_thread, this);
         m_main_render_thread = std::thread(&DrawApp::main_render_thread, this);
     }
 
+    glm::mat4 screen_mvp() const
+    {
+        float aspect = (float)m_swapchain_extent.width / (float)m_swapchain_extent.height;
+        return glm::ortho<float>(-aspect, aspect, -1, 1) * glm::translate(glm::vec3(m_pan, 0))
+            * glm::scale(glm::vec3(m_zoom));
+    }
+
+    // canvas pixels to the swapchain pixels they cover through the view,
+    // padded by a texel of the coarser mip the trilinear filter reads
+    DirtyRect canvas_to_screen(const DirtyRect& r) const
+    {
+        DirtyRect out;
+        if (r.empty())
+            return out;
+        glm::vec2 size = m_sparse_canvas ? m_canvas.m_size : rt.m_size;
+        glm::vec2 sz = { m_swapchain_extent.width, m_swapchain_extent.height };
+        glm::mat4 mvp = screen_mvp();
+        int pad = std::max(1, (int)std::ceil(2.f * size.y / (m_zoom * sz.y)));
+        for (glm::ivec2 c : { r.min - pad, r.max + pad, glm::ivec2(r.min.x - pad, r.max.y + pad),
+            glm::ivec2(r.max.x + pad, r.min.y - pad) })
+        {
+            // uv to the quad of shader-fill.vert
+            glm::vec2 uv = glm::vec2(c) / size;
+            glm::vec4 p = mvp * glm::vec4(uv.x * 2.f - 1.f, 1.f - uv.y * 2.f, 0.f, 1.f);
+            glm::vec2 px = (glm::vec2(p) / p.w * 0.5f + 0.5f) * sz;
+            out.add(glm::ivec2(glm::floor(px)) - 1, glm::ivec2(glm::ceil(px)) + 1);
+        }
+        return out.clamp(glm::ivec2(sz));
+    }
+
+    // where the navigator is drawn, in swapchain pixels: the top right corner
+    DirtyRect navigator_rect() const
+    {
+        const int side = 192;
+        const int margin = 16;
+        int width = side * rt.m_size.x / rt.m_size.y;
+        int right = (int)m_swapchain_extent.width - margin;
+        DirtyRect r;
+        r.add({ right - width, margin }, { right, margin + side });
+        return r.clamp(glm::ivec2(m_swapchain_extent.width, m_swapchain_extent.height));
+    }
+
+    // the quad of shader-fill.vert on navigator_rect()
+    glm::mat4 navigator_mvp() const
+    {
+        DirtyRect r = navigator_rect();
+        glm::vec2 sz = { m_swapchain_extent.width, m_swapchain_extent.height };
+        glm::vec2 center = glm::vec2(r.min + r.max) / sz - 1.f;
+        glm::vec2 half = glm::vec2(r.max - r.min) / sz;
+        return glm::translate(glm::vec3(center, 0.f)) * glm::scale(glm::vec3(half, 1.f));
+    }
+
+    // window pixels to canvas units, the inverse of the display transform
+    glm::mat4 px_to_canvas() const
+    {
+        glm::vec2 sz = { m_swapchain_extent.width, m_swapchain_extent.height };
+        return glm::inverse(screen_mvp()) * glm::translate(glm::vec3(-1.f, -1.f, 0.f))
+            * glm::scale(glm::vec3(2.f / sz, 1.f));
+    }
+
     virtual bool render_frame(float dt)
     {
         static float timer = 0;
 
+        // caps the redraw rate, damage arriving meanwhile is coalesced
         timer += dt;
         const float period = 1.f / 60.f;
         if (timer < period)
@@ -235,37 +1257,52 @@ public:
             return false;
         }
 
-        for (size_t i = 0; i < m_swapchain_images.size(); i++)
-        {
-            float aspect = (float)m_swapchain_extent.width / (float)m_swapchain_extent.height;
-            m_cmd_screen[i].m_ubo.m_value.mvp = glm::ortho<float>(-aspect, aspect, -1, 1) * glm::translate(glm::vec3(m_pan, 0)) 
-                * glm::scale(glm::vec3(m_zoom));
-            m_cmd_screen[i].m_ubo.update(m_dev);
-        }
-
         std::lock_guard lock(m_swapchain_mutex);
 
-        auto swapchain_sem = m_dev->createSemaphoreUnique(vk::SemaphoreCreateInfo());
-        vk::ResultValue<uint32_t> swapchain_idx = m_dev->acquireNextImageKHR(*m_swapchain, UINT64_MAX, *swapchain_sem, nullptr);
-        vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eTopOfPipe;
-        auto submit_info = vk::SubmitInfo(1, &swapchain_sem.get(), &wait_stage, 1,
-            &m_cmd_screen[swapchain_idx.value].m_cmd.get(), 1, &render_finished_sem.get());
-        auto fence = m_dev->createFenceUnique(vk::FenceCreateInfo());
-        auto present_info = vk::PresentInfoKHR(1, &render_finished_sem.get(), 1, &m_swapchain.get(), &swapchain_idx.value);
-
-        auto present_start = std::chrono::high_resolution_clock::now();
-        m_main_queue_mutex.lock();
-        m_main_queue.submit(submit_info, *fence);
-        m_dev->waitForFences(*fence, true, UINT64_MAX);
-        try
+        // every image that was not drawn since gets the damage
+        DirtyRect canvas_damage;
+        bool full;
         {
-            m_main_queue.presentKHR(present_info);
+            std::lock_guard damage_lock(m_damage_mutex);
+            canvas_damage = m_damage_canvas;
+            full = m_damage_full;
+            m_damage_canvas.clear();
+            m_damage_full = false;
         }
-        catch (const vk::SystemError& err)
+        DirtyRect screen_damage = canvas_to_screen(canvas_damage);
+        bool navigator = m_navigator;
+        if (navigator && !canvas_damage.empty())
+            screen_damage.add(navigator_rect());
+        for (size_t i = 0; i < m_image_damage.size(); i++)
         {
-            std::cout << err.what() << "\n";
+            m_image_damage[i].add(screen_damage);
+            m_image_full[i] |= full;
         }
-        m_main_queue_mutex.unlock();
+        // strokes out of the view
+        if (!full && screen_damage.empty())
+            return true;
+
+        uint32_t swapchain_idx;
+        vk::Semaphore acquired;
+        if (!acquire_frame(swapchain_idx, acquired))
+        {
+            // the next try waits a whole period
+            timer = 0;
+            return false;
+        }
+
+        CmdRenderToScreen::push_t push;
+        push.mvp = screen_mvp();
+        auto& cmd_screen = m_cmd_screen[swapchain_idx];
+        DirtyRect area = m_image_full[swapchain_idx] ? DirtyRect() : m_image_damage[swapchain_idx];
+        CmdRenderToScreen::push_t navigator_push;
+        navigator_push.mvp = navigator_mvp();
+        cmd_screen.record(push, area, navigator ? &navigator_push : nullptr);
+
+        auto present_start = std::chrono::high_resolution_clock::now();
+        present_frame(swapchain_idx, acquired, *cmd_screen.m_cmd, area);
+        m_image_damage[swapchain_idx].clear();
+        m_image_full[swapchain_idx] = false;
 
         //auto timer_diff = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - present_start);
         //int64_t present_dt = timer_diff.count();
@@ -279,17 +1316,36 @@ public:
 
     virtual void on_resize() override
     {
+        // the per image passes follow in on_swapchain_images()
         create_swapchain();
-        std::lock_guard lock(m_swapchain_mutex);
-        m_cmd_screen.clear();
+        invalidate();
+    }
+
+    // under m_swapchain_mutex
+    virtual void on_swapchain_images() override
+    {
+        if (!m_screen_cmd_pool)
+            return;
+        // the per image passes only follow the new framebuffers, create_swapchain()
+        // waited for the ones a smaller swapchain drops
+        size_t reused = std::min(m_cmd_screen.size(), m_swapchain_images.size());
         m_cmd_screen.resize(m_swapchain_images.size());
-        for (size_t i = 0; i < m_swapchain_images.size(); i++)
+        m_image_damage.assign(m_swapchain_images.size(), DirtyRect());
+        m_image_full.assign(m_swapchain_images.size(), true);
+        for (size_t i = 0; i < reused; i++)
+            m_cmd_screen[i].resize(m_framebuffers[i], m_swapchain_extent);
+        for (size_t i = reused; i < m_swapchain_images.size(); i++)
         {
-            m_cmd_screen[i].create(m_dev, m_pd, m_cmd_pool, m_descr_pool, m_descr_layout, m_renderpass, 
-                m_framebuffers[i], m_pipeline, m_pipeline_layout, m_sampler_linear, m_swapchain_extent, 
-                (int)m_samples > 1 ? rt.m_resolved_view : rt.m_fb_view, glm::vec3(0.3f));
-            m_cmd_screen[i].m_ubo.m_value.mvp = glm::identity<glm::mat4>();
-            m_cmd_screen[i].m_ubo.update(m_dev);
+            if (m_sparse_canvas)
+            {
+                m_cmd_screen[i].create(m_dev, m_screen_cmd_pool, m_display_descr, m_renderpass, m_renderpass_load,
+                    m_framebuffers[i], m_canvas.m_display_pipeline, m_canvas.m_display_layout, m_swapchain_extent, glm::vec3(0.3f));
+            }
+            else
+            {
+                m_cmd_screen[i].create(m_dev, m_screen_cmd_pool, m_display_descr, m_renderpass, m_renderpass_load,
+                    m_framebuffers[i], m_pipeline, m_pipeline_layout, m_swapchain_extent, glm::vec3(0.3f));
+            }
         }
     }
 
@@ -300,31 +1356,30 @@ public:
     glm::vec2 m_pan_start;
     glm::vec2 m_pan_value;
 
+    // hands the resampled points to the canvas thread, never blocks: when the
+    // queue is full the rest stays in m_resampled until the next event
+    void push_samples()
+    {
+        if (m_resampled.empty())
+            return;
+        uint32_t pushed = m_stroke_queue.push((uint32_t)m_resampled.size(),
+            [&](uint32_t i) { return m_resampled.get(i); });
+        m_resampled.erase_front(pushed);
+    }
+
     virtual void on_mouse_move(glm::ivec2 pos, float pressure) override
     {
         glm::vec2 sz = { m_swapchain_extent.width, m_swapchain_extent.height };
-        auto m = glm::inverse(m_cmd_screen[0].m_ubo.m_value.mvp);
         if (m_dragL)
         {
-            //m_stroke_samples.emplace_back((glm::vec2(pos) / sz) * 2.f - 1.f);
-            int dist = glm::ceil(glm::distance(glm::vec2(m_cur_pos), glm::vec2(pos)));
-            if (dist > 0)
-            {
-                std::lock_guard lock(m_stroke_mutex);
-                for (int i = 0; i < dist; i++)
-                {
-                    glm::vec2 p = glm::lerp(glm::vec2(m_cur_pos), glm::vec2(pos), (float)i / dist);
-                    p = (p / sz) * 2.f - 1.f;
-                    p = m * glm::vec4(p, 0, 1);
-                    m_stroke_samples.emplace_back(p, pressure);
-                }
-            }
-            m_stroke_cv.notify_one();
+            m_resampler.move(pos, pressure, px_to_canvas(), m_resampled);
+            push_samples();
         }
         if (m_dragR)
         {
             glm::vec2 pos_n = m_mat_start * glm::vec4((glm::vec2(pos) / sz) * 2.f - 1.f, 0.f, 1.f);
             m_pan = m_pan_value + glm::vec2(pos_n - m_pan_start) * m_zoom;
+            invalidate();
         }
         m_cur_pos = pos;
     }
@@ -335,11 +1390,13 @@ public:
         if (button == 0)
         {
             m_dragL = true;
+            m_resampler.begin(pos, pressure, px_to_canvas(), m_resampled);
+            push_samples();
         }
         else if (button == 1)
         {
             glm::vec2 sz = { m_swapchain_extent.width, m_swapchain_extent.height };
-            m_mat_start = glm::inverse(m_cmd_screen[0].m_ubo.m_value.mvp);
+            m_mat_start = glm::inverse(screen_mvp());
             m_pan_start = m_mat_start * glm::vec4((glm::vec2(pos) / sz) * 2.f - 1.f, 0.f, 1.f);
             m_pan_value = m_pan;
             m_dragR = true;
@@ -351,6 +1408,7 @@ public:
         if (button == 0)
         {
             m_dragL = false;
+            m_resampler.end();
         }
         else if (button == 1)
         {
@@ -360,9 +1418,14 @@ public:
 
     virtual void on_terminate() override
     {
-        m_stroke_cv.notify_one();
+        m_stroke_queue.wake();
+        invalidate();
+        // a canvas thread still waiting for the brush tips gets the placeholder
+        m_textures.destroy();
         if (m_canvas_render_thread.joinable())
             m_canvas_render_thread.join();
+        // the exports already committed are still written
+        m_exporter.destroy();
         if (m_main_render_thread.joinable())
             m_main_render_thread.join();
     }
@@ -370,6 +1433,7 @@ public:
     virtual void on_mouse_wheel(glm::ivec2 pos, float delta) override
     {
         m_zoom += m_zoom * 0.1f * delta;
+        invalidate();
     }
 
 };
@@ -389,13 +1453,52 @@ void init_shcore_API()
     SetProcessDpiAwareness_fn = (decltype(SetProcessDpiAwareness_fn))GetProcAddress(dll, "SetProcessDpiAwareness");
 }
 
-int main()
+int main(int argc, char** argv)
 {
     init_shcore_API();
     if (SetProcessDpiAwareness_fn)
         SetProcessDpiAwareness_fn(PROCESS_PER_MONITOR_DPI_AWARE);
 
     auto app = std::make_unique<DrawApp>();
+    // --present=fifo|mailbox|immediate --images=N --frames=N --low-latency
+    // --sparse[=WxH] --compare-aa --compare-compute --count-dabs --check-allocs
+    // --check-barriers
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--present=fifo")
+            app->m_present_mode = vk::PresentModeKHR::eFifo;
+        else if (arg == "--present=mailbox")
+            app->m_present_mode = vk::PresentModeKHR::eMailbox;
+        else if (arg == "--present=immediate")
+            app->m_present_mode = vk::PresentModeKHR::eImmediate;
+        else if (arg.rfind("--images=", 0) == 0)
+            app->m_swapchain_images_count = std::stoul(arg.substr(9));
+        else if (arg.rfind("--frames=", 0) == 0)
+            app->m_frames_in_flight = std::stoul(arg.substr(9));
+        else if (arg == "--low-latency")
+            app->m_low_latency = true;
+        else if (arg == "--compare-aa" || arg == "--compare-compute" || arg == "--count-dabs" ||
+            arg == "--check-allocs" || arg == "--check-barriers")
+            app->m_check = arg.substr(2);
+        else if (arg == "--sparse")
+            app->m_sparse_canvas = true;
+        else if (arg.rfind("--sparse=", 0) == 0)
+        {
+            app->m_sparse_canvas = true;
+            size_t x = arg.find('x', 9);
+            app->m_sparse_size.x = std::stoi(arg.substr(9, x - 9));
+            app->m_sparse_size.y = x == std::string::npos ? app->m_sparse_size.x : std::stoi(arg.substr(x + 1));
+        }
+        else
+            std::cout << "unknown option " << arg << "\n";
+    }
+    // the checks exit with their result
+    if (app->m_check == "count-dabs")
+        return app->count_dabs() ? 0 : 1;
+    app->m_headless = !app->m_check.empty();
     app->init_vulkan();
+    if (app->m_headless)
+        return app->run_check() ? 0 : 1;
     app->run_loop();
 }
@@ -0,0 +1,311 @@
+#include "pch.h"
+#include "memoryallocator.h"
+#include "debug_message.h"
+
+struct MemoryBlock
+{
+    struct range_t
+    {
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+        bool free;
+        bool linear;
+    };
+    vk::UniqueDeviceMemory memory;
+    vk::DeviceSize size = 0;
+    uint8_t* ptr = nullptr;
+    uint32_t type = 0;
+    MemoryAllocator::Strategy strategy = MemoryAllocator::Strategy::free_list;
+    bool dedicated = false;
+    uint32_t allocations = 0;
+    vk::DeviceSize used = 0;
+    // free_list: sorted by offset, covering the block, free ranges never adjacent
+    std::vector<range_t> ranges;
+    // linear: first free byte and the kind of resource right before it
+    vk::DeviceSize top = 0;
+    bool top_linear = true;
+};
+
+static vk::DeviceSize align_up(vk::DeviceSize v, vk::DeviceSize align)
+{
+    return (v + align - 1) / align * align;
+}
+
+// a range ending at end and one starting at start share a granularity page
+static bool same_page(vk::DeviceSize end, vk::DeviceSize start, vk::DeviceSize page)
+{
+    return end > 0 && (end - 1) / page == start / page;
+}
+
+static bool alloc_linear(MemoryBlock& b, const vk::MemoryRequirements& req, bool linear,
+    vk::DeviceSize page, vk::DeviceSize& offset)
+{
+    offset = align_up(b.top, req.alignment);
+    if (b.allocations > 0 && b.top_linear != linear && same_page(b.top, offset, page))
+        offset = align_up(offset, page);
+    if (offset + req.size > b.size)
+        return false;
+    b.top = offset + req.size;
+    b.top_linear = linear;
+    return true;
+}
+
+static bool alloc_free_list(MemoryBlock& b, const vk::MemoryRequirements& req, bool linear,
+    vk::DeviceSize page, vk::DeviceSize& offset)
+{
+    // best fit: the smallest free range that holds the resource
+    size_t best = b.ranges.size();
+    vk::DeviceSize best_offset = 0;
+    for (size_t i = 0; i < b.ranges.size(); i++)
+    {
+        const auto& r = b.ranges[i];
+        if (!r.free || (best < b.ranges.size() && r.size >= b.ranges[best].size))
+            continue;
+        vk::DeviceSize start = align_up(r.offset, req.alignment);
+        if (i > 0 && b.ranges[i - 1].linear != linear && same_page(r.offset, start, page))
+            start = align_up(start, page);
+        vk::DeviceSize end = start + req.size;
+        if (end > r.offset + r.size)
+            continue;
+        if (i + 1 < b.ranges.size() && b.ranges[i + 1].linear != linear && same_page(end, b.ranges[i + 1].offset, page))
+            continue;
+        best = i;
+        best_offset = start;
+    }
+    if (best == b.ranges.size())
+        return false;
+
+    // split in alignment padding, the allocation and the tail
+    MemoryBlock::range_t r = b.ranges[best];
+    std::array<MemoryBlock::range_t, 3> parts = {
+        MemoryBlock::range_t{ r.offset, best_offset - r.offset, true, false },
+        MemoryBlock::range_t{ best_offset, req.size, false, linear },
+        MemoryBlock::range_t{ best_offset + req.size, r.offset + r.size - best_offset - req.size, true, false },
+    };
+    b.ranges.erase(b.ranges.begin() + best);
+    auto it = b.ranges.begin() + best;
+    for (const auto& part : parts)
+    {
+        if (part.size > 0)
+            it = b.ranges.insert(it, part) + 1;
+    }
+    offset = best_offset;
+    return true;
+}
+
+static void free_range(MemoryBlock& b, vk::DeviceSize offset)
+{
+    auto it = std::lower_bound(b.ranges.begin(), b.ranges.end(), offset,
+        [](const MemoryBlock::range_t& r, vk::DeviceSize o) { return r.offset < o; });
+    if (it == b.ranges.end() || it->offset != offset)
+        throw std::runtime_error("MemoryAllocator: freeing an unknown range");
+    it->free = true;
+    auto next = it + 1;
+    if (next != b.ranges.end() && next->free)
+    {
+        it->size += next->size;
+        it = b.ranges.erase(next) - 1;
+    }
+    if (it != b.ranges.begin() && (it - 1)->free)
+    {
+        (it - 1)->size += it->size;
+        b.ranges.erase(it);
+    }
+}
+
+Allocation& Allocation::operator=(Allocation&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        m_owner = other.m_owner;
+        m_block = other.m_block;
+        m_memory = other.m_memory;
+        m_offset = other.m_offset;
+        m_size = other.m_size;
+        m_ptr = other.m_ptr;
+        other.m_owner = nullptr;
+        other.m_block = nullptr;
+        other.m_memory = nullptr;
+        other.m_ptr = nullptr;
+    }
+    return *this;
+}
+
+void Allocation::reset()
+{
+    if (m_block)
+        m_owner->free(*this);
+    m_owner = nullptr;
+    m_block = nullptr;
+    m_memory = nullptr;
+    m_offset = m_size = 0;
+    m_ptr = nullptr;
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+    stats_t s = stats();
+    if (s.allocations > 0)
+        std::cout << fmt::format("MemoryAllocator: {} allocations still alive\n", s.allocations);
+}
+
+bool MemoryAllocator::create(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev,
+    vk::DeviceSize block_size, vk::DeviceSize host_block_size)
+{
+    m_dev = *dev;
+    m_props = pd.getMemoryProperties();
+    m_granularity = pd.getProperties().limits.bufferImageGranularity;
+    m_block_size = block_size;
+    m_host_block_size = host_block_size;
+    return true;
+}
+
+uint32_t MemoryAllocator::find_type(uint32_t type_bits, vk::MemoryPropertyFlags flags) const
+{
+    for (uint32_t i = 0; i < m_props.memoryTypeCount; i++)
+        if ((1 << i) & type_bits && (m_props.memoryTypes[i].propertyFlags & flags) == flags)
+            return i;
+    throw std::runtime_error("MemoryAllocator: no memory type for " + vk::to_string(flags));
+}
+
+MemoryBlock* MemoryAllocator::create_block(uint32_t type, Strategy strategy, vk::DeviceSize size, bool dedicated)
+{
+    auto block = std::make_unique<MemoryBlock>();
+    block->memory = m_dev.allocateMemoryUnique({ size, type });
+    debug_name(block->memory, dedicated ? "MemoryAllocator dedicated block" : "MemoryAllocator block");
+    block->size = size;
+    block->type = type;
+    block->strategy = strategy;
+    block->dedicated = dedicated;
+    block->ranges.push_back({ 0, size, true, false });
+    if (m_props.memoryTypes[type].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+        block->ptr = static_cast<uint8_t*>(m_dev.mapMemory(*block->memory, 0, VK_WHOLE_SIZE));
+    auto& pool = m_pools[type][(size_t)strategy];
+    pool.push_back(std::move(block));
+    return pool.back().get();
+}
+
+Allocation MemoryAllocator::alloc(const vk::MemoryRequirements& req, vk::MemoryPropertyFlags flags,
+    bool linear_resource, Strategy strategy)
+{
+    uint32_t type = find_type(req.memoryTypeBits, flags);
+    bool host = bool(m_props.memoryTypes[type].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible);
+    vk::DeviceSize block_size = host ? m_host_block_size : m_block_size;
+
+    auto try_alloc = [&](MemoryBlock& b, vk::DeviceSize& offset) {
+        bool ok = b.strategy == Strategy::linear ?
+            alloc_linear(b, req, linear_resource, m_granularity, offset) :
+            alloc_free_list(b, req, linear_resource, m_granularity, offset);
+        if (ok)
+        {
+            b.allocations++;
+            b.used += req.size;
+        }
+        return ok;
+    };
+
+    std::lock_guard lock(m_mutex);
+    MemoryBlock* block = nullptr;
+    vk::DeviceSize offset = 0;
+    if (req.size > block_size / 2)
+    {
+        block = create_block(type, strategy, req.size, true);
+        try_alloc(*block, offset);
+    }
+    else
+    {
+        for (auto& b : m_pools[type][(size_t)strategy])
+        {
+            if (!b->dedicated && try_alloc(*b, offset))
+            {
+                block = b.get();
+                break;
+            }
+        }
+        if (!block)
+        {
+            block = create_block(type, strategy, block_size, false);
+            try_alloc(*block, offset);
+        }
+    }
+
+    Allocation a;
+    a.m_owner = this;
+    a.m_block = block;
+    a.m_memory = *block->memory;
+    a.m_offset = offset;
+    a.m_size = req.size;
+    a.m_ptr = block->ptr ? block->ptr + offset : nullptr;
+    return a;
+}
+
+void MemoryAllocator::free(Allocation& a)
+{
+    std::lock_guard lock(m_mutex);
+    MemoryBlock& b = *a.m_block;
+    if (b.strategy == Strategy::free_list)
+        free_range(b, a.m_offset);
+    b.allocations--;
+    b.used -= a.m_size;
+    if (b.allocations > 0)
+        return;
+    b.top = 0;
+
+    // an empty block is kept only when it is the last one of its pool, so
+    // a staging buffer made and dropped in a loop does not allocate each time
+    auto& pool = m_pools[b.type][(size_t)b.strategy];
+    if (b.dedicated || pool.size() > 1)
+    {
+        if (b.ptr)
+            m_dev.unmapMemory(*b.memory);
+        pool.erase(std::find_if(pool.begin(), pool.end(), [&](const auto& p) { return p.get() == &b; }));
+    }
+}
+
+Allocation MemoryAllocator::bind(const vk::UniqueBuffer& buffer, vk::MemoryPropertyFlags flags, Strategy strategy)
+{
+    Allocation a = alloc(m_dev.getBufferMemoryRequirements(*buffer), flags, true, strategy);
+    m_dev.bindBufferMemory(*buffer, a.m_memory, a.m_offset);
+    return a;
+}
+
+Allocation MemoryAllocator::bind(const vk::UniqueImage& image, vk::MemoryPropertyFlags flags, Strategy strategy,
+    vk::ImageTiling tiling)
+{
+    Allocation a = alloc(m_dev.getImageMemoryRequirements(*image), flags, tiling == vk::ImageTiling::eLinear, strategy);
+    m_dev.bindImageMemory(*image, a.m_memory, a.m_offset);
+    return a;
+}
+
+MemoryAllocator::stats_t MemoryAllocator::stats() const
+{
+    std::lock_guard lock(m_mutex);
+    stats_t s;
+    vk::DeviceSize free_bytes = 0;
+    vk::DeviceSize largest_free = 0;
+    for (const auto& type_pools : m_pools)
+    {
+        for (const auto& pool : type_pools)
+        {
+            for (const auto& b : pool)
+            {
+                s.blocks++;
+                s.allocations += b->allocations;
+                s.block_bytes += b->size;
+                s.used_bytes += b->used;
+                if (b->strategy != Strategy::free_list)
+                    continue;
+                for (const auto& r : b->ranges)
+                {
+                    if (!r.free)
+                        continue;
+                    free_bytes += r.size;
+                    largest_free = std::max(largest_free, r.size);
+                }
+            }
+        }
+    }
+    s.fragmentation = free_bytes > 0 ? 1.f - (float)largest_free / (float)free_bytes : 0.f;
+    return s;
+}
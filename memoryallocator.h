@@ -0,0 +1,81 @@
+#pragma once
+
+class MemoryAllocator;
+struct MemoryBlock;
+
+// A range of a device memory block, given back to the allocator when
+// destroyed or reset. Declare it after the buffer or image bound to it.
+class Allocation
+{
+    friend class MemoryAllocator;
+    MemoryAllocator* m_owner = nullptr;
+    MemoryBlock* m_block = nullptr;
+public:
+    vk::DeviceMemory m_memory;
+    vk::DeviceSize m_offset = 0;
+    vk::DeviceSize m_size = 0;
+    // the block is persistently mapped when host visible, points at m_offset
+    void* m_ptr = nullptr;
+
+    Allocation() = default;
+    Allocation(const Allocation&) = delete;
+    Allocation& operator=(const Allocation&) = delete;
+    Allocation(Allocation&& other) noexcept { *this = std::move(other); }
+    Allocation& operator=(Allocation&& other) noexcept;
+    ~Allocation() { reset(); }
+    void reset();
+    explicit operator bool() const { return m_block != nullptr; }
+};
+
+/*
+Sub-allocates buffers and images from a few large vkDeviceMemory blocks per
+memory type instead of one allocation per resource, the device limit
+(maxMemoryAllocationCount) is often 4096. free_list blocks reuse freed ranges
+(best fit, neighbours merged), linear blocks only bump an offset and are reset
+when their last allocation goes: meant for short lived staging buffers.
+Resources larger than half a block get a dedicated block. Buffers and optimal
+images in the same block are kept bufferImageGranularity apart. Thread safe.
+*/
+class MemoryAllocator
+{
+    friend class Allocation;
+public:
+    enum class Strategy : uint32_t { free_list, linear, count };
+    struct stats_t
+    {
+        uint32_t blocks = 0;
+        uint32_t allocations = 0;
+        vk::DeviceSize block_bytes = 0;
+        vk::DeviceSize used_bytes = 0;
+        // 1 - largest free range / free bytes, over the free_list blocks
+        float fragmentation = 0.f;
+    };
+private:
+    vk::Device m_dev;
+    vk::PhysicalDeviceMemoryProperties m_props;
+    vk::DeviceSize m_granularity = 1;
+    vk::DeviceSize m_block_size = 0;
+    vk::DeviceSize m_host_block_size = 0;
+    // blocks per memory type and strategy
+    std::array<std::array<std::vector<std::unique_ptr<MemoryBlock>>, (size_t)Strategy::count>,
+        VK_MAX_MEMORY_TYPES> m_pools;
+    mutable std::mutex m_mutex;
+
+    uint32_t find_type(uint32_t type_bits, vk::MemoryPropertyFlags flags) const;
+    MemoryBlock* create_block(uint32_t type, Strategy strategy, vk::DeviceSize size, bool dedicated);
+    void free(Allocation& a);
+public:
+    ~MemoryAllocator();
+
+    bool create(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev,
+        vk::DeviceSize block_size = 64 << 20, vk::DeviceSize host_block_size = 16 << 20);
+    // linear_resource: a buffer or a linear tiling image
+    Allocation alloc(const vk::MemoryRequirements& req, vk::MemoryPropertyFlags flags, bool linear_resource,
+        Strategy strategy = Strategy::free_list);
+    // allocates and binds
+    Allocation bind(const vk::UniqueBuffer& buffer, vk::MemoryPropertyFlags flags,
+        Strategy strategy = Strategy::free_list);
+    Allocation bind(const vk::UniqueImage& image, vk::MemoryPropertyFlags flags,
+        Strategy strategy = Strategy::free_list, vk::ImageTiling tiling = vk::ImageTiling::eOptimal);
+    stats_t stats() const;
+};
@@ -7,12 +7,18 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <deque>
+#include <map>
 #include <fstream>
 #include <algorithm>
+#include <limits>
 #include <filesystem>
 #include <condition_variable>
+#include <functional>
 
+// std::min/std::max, not the windows.h macros
+#define NOMINMAX
 #include <windows.h>
 #include <windowsx.h>
 #include <fmt/format.h>
@@ -0,0 +1,247 @@
+#include "pch.h"
+#include "queuearbiter.h"
+
+QueueArbiter::families_t QueueArbiter::find_families(const vk::PhysicalDevice& pd, uint32_t graphics_idx)
+{
+    families_t families;
+    families.idx.fill(graphics_idx);
+    auto qf_props = pd.getQueueFamilyProperties();
+    for (uint32_t idx = 0; idx < qf_props.size(); idx++)
+    {
+        auto flags = qf_props[idx].queueFlags;
+        if (flags & vk::QueueFlagBits::eGraphics)
+            continue;
+        if ((flags & vk::QueueFlagBits::eCompute) && families[QueueKind::compute] == graphics_idx)
+            families.idx[(size_t)QueueKind::compute] = idx;
+        // copy engines expose transfer only
+        if (!(flags & vk::QueueFlagBits::eCompute) && (flags & vk::QueueFlagBits::eTransfer) &&
+            families[QueueKind::transfer] == graphics_idx)
+            families.idx[(size_t)QueueKind::transfer] = idx;
+    }
+    // no copy engine: an async compute queue copies too, off the graphics one
+    if (families[QueueKind::transfer] == graphics_idx)
+        families.idx[(size_t)QueueKind::transfer] = families[QueueKind::compute];
+    return families;
+}
+
+bool QueueArbiter::create(const vk::UniqueDevice& dev, const families_t& families)
+{
+    m_dev = *dev;
+    m_families = families;
+    for (size_t i = 0; i < m_queues.size(); i++)
+        m_queues[i] = m_dev.getQueue(m_families.idx[i], 0);
+    for (uint32_t i = 0; i < N; i++)
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+    std::cout << fmt::format("queue families: graphics {} compute {} transfer {}\n",
+        m_families[QueueKind::graphics], m_families[QueueKind::compute], m_families[QueueKind::transfer]);
+
+    m_running = true;
+    m_thread = std::thread(&QueueArbiter::thread_main, this);
+    return true;
+}
+
+void QueueArbiter::destroy()
+{
+    if (!m_thread.joinable())
+        return;
+    m_running = false;
+    m_signal.fetch_add(1, std::memory_order_seq_cst);
+    WakeByAddressAll(&m_signal);
+    m_thread.join();
+}
+
+void QueueArbiter::post(const op_t& op)
+{
+    uint32_t pos = m_tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+        cell_t& cell = m_cells[pos & (N - 1)];
+        uint32_t seq = cell.seq.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0)
+        {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.op = op;
+                cell.seq.store(pos + 1, std::memory_order_seq_cst);
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // full, the arbiter thread is behind by N operations
+            std::this_thread::yield();
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+        else
+        {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+    if (m_waiting.load(std::memory_order_seq_cst))
+    {
+        m_signal.fetch_add(1, std::memory_order_seq_cst);
+        WakeByAddressSingle(&m_signal);
+    }
+}
+
+void QueueArbiter::present(vk::SwapchainKHR swapchain, uint32_t image_idx, vk::Semaphore wait,
+    const DirtyRect* region)
+{
+    op_t op;
+    op.type = op_t::Type::present;
+    op.swapchain = swapchain;
+    op.image_idx = image_idx;
+    op.wait_count = 1;
+    op.wait[0] = wait;
+    if (region)
+    {
+        vk::Rect2D r = region->rect();
+        op.region = vk::RectLayerKHR(r.offset, r.extent, 0);
+    }
+    post(op);
+}
+
+void QueueArbiter::wait_idle()
+{
+    uint32_t ticket = m_idle_posted.fetch_add(1) + 1;
+    op_t op;
+    op.type = op_t::Type::idle;
+    post(op);
+    uint32_t done = m_idle_done.load();
+    while ((int32_t)(done - ticket) < 0)
+    {
+        WaitOnAddress(&m_idle_done, &done, sizeof(done), INFINITE);
+        done = m_idle_done.load();
+    }
+}
+
+void QueueArbiter::wait_submitted(std::atomic<uint64_t>& submitted, uint64_t id)
+{
+    uint64_t cur = submitted.load(std::memory_order_acquire);
+    while (cur < id)
+    {
+        WaitOnAddress(&submitted, &cur, sizeof(cur), INFINITE);
+        cur = submitted.load(std::memory_order_acquire);
+    }
+}
+
+void QueueArbiter::execute(const op_t& op)
+{
+    vk::Queue q = m_queues[(size_t)op.kind];
+    try
+    {
+        switch (op.type)
+        {
+        case op_t::Type::submit:
+        {
+            vk::SubmitInfo si;
+            si.waitSemaphoreCount = op.wait_count;
+            si.pWaitSemaphores = op.wait.data();
+            si.pWaitDstStageMask = op.wait_stages.data();
+            si.commandBufferCount = op.cmd_count;
+            si.pCommandBuffers = op.cmds.data();
+            si.signalSemaphoreCount = op.signal_count;
+            si.pSignalSemaphores = op.signal.data();
+            q.submit(si, op.fence);
+            break;
+        }
+        case op_t::Type::present:
+        {
+            auto present_info = vk::PresentInfoKHR(op.wait_count, op.wait.data(), 1, &op.swapchain, &op.image_idx);
+            vk::PresentRegionKHR region(1, &op.region);
+            vk::PresentRegionsKHR regions(1, &region);
+            if (op.region.extent.width > 0)
+                present_info.pNext = &regions;
+            m_queues[(size_t)QueueKind::graphics].presentKHR(present_info);
+            break;
+        }
+        case op_t::Type::idle:
+            for (auto& queue : m_queues)
+                queue.waitIdle();
+            m_idle_done.fetch_add(1);
+            WakeByAddressAll(&m_idle_done);
+            break;
+        }
+    }
+    catch (const vk::SystemError& err)
+    {
+        std::cout << err.what() << "\n";
+        if (op.type == op_t::Type::idle)
+        {
+            m_idle_done.fetch_add(1);
+            WakeByAddressAll(&m_idle_done);
+        }
+    }
+    // the posting thread's fence is not touched by the arbiter from here on
+    if (op.submitted)
+    {
+        op.submitted->store(op.id, std::memory_order_release);
+        WakeByAddressAll(op.submitted);
+    }
+}
+
+void QueueArbiter::thread_main()
+{
+    while (true)
+    {
+        cell_t& cell = m_cells[m_head & (N - 1)];
+        if (cell.seq.load(std::memory_order_acquire) == m_head + 1)
+        {
+            execute(cell.op);
+            cell.seq.store(m_head + N, std::memory_order_release);
+            m_head++;
+            continue;
+        }
+        if (!m_running)
+            break;
+
+        // same protocol as SpscQueue::wait()
+        uint32_t signal = m_signal.load(std::memory_order_seq_cst);
+        m_waiting.store(1, std::memory_order_seq_cst);
+        if (cell.seq.load(std::memory_order_seq_cst) != m_head + 1 && m_running)
+            WaitOnAddress(&m_signal, &signal, sizeof(signal), INFINITE);
+        m_waiting.store(0, std::memory_order_relaxed);
+    }
+}
+
+ImageHandoff::ImageHandoff(const QueueArbiter& queues, QueueKind from, QueueKind to, vk::Image img,
+    vk::ImageLayout old_layout, vk::ImageLayout new_layout,
+    vk::AccessFlags src_access, vk::PipelineStageFlags src_stage,
+    vk::AccessFlags dst_access, vk::PipelineStageFlags dst_stage, const vk::ImageSubresourceRange& range)
+    : src_stage(src_stage), dst_stage(dst_stage)
+{
+    same_family = queues.family(from) == queues.family(to);
+    imb.srcAccessMask = src_access;
+    imb.dstAccessMask = dst_access;
+    imb.oldLayout = old_layout;
+    imb.newLayout = new_layout;
+    imb.srcQueueFamilyIndex = same_family ? VK_QUEUE_FAMILY_IGNORED : queues.family(from);
+    imb.dstQueueFamilyIndex = same_family ? VK_QUEUE_FAMILY_IGNORED : queues.family(to);
+    imb.image = img;
+    imb.subresourceRange = range;
+}
+
+void ImageHandoff::release(vk::CommandBuffer cmd) const
+{
+    if (same_family)
+    {
+        cmd.pipelineBarrier(src_stage, dst_stage, {}, 0, nullptr, 0, nullptr, 1, &imb);
+        return;
+    }
+    // the destination access is ignored on the releasing queue
+    vk::ImageMemoryBarrier release = imb;
+    release.dstAccessMask = {};
+    cmd.pipelineBarrier(src_stage, vk::PipelineStageFlagBits::eBottomOfPipe, {}, 0, nullptr, 0, nullptr, 1, &release);
+}
+
+void ImageHandoff::acquire(vk::CommandBuffer cmd) const
+{
+    if (same_family)
+        return;
+    // the source access is ignored on the acquiring queue, the barrier
+    // chains with the semaphore wait on dst_stage
+    vk::ImageMemoryBarrier acquire = imb;
+    acquire.srcAccessMask = {};
+    cmd.pipelineBarrier(dst_stage, dst_stage, {}, 0, nullptr, 0, nullptr, 1, &acquire);
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "utils.h"
+
+enum class QueueKind : uint32_t { graphics, compute, transfer, count };
+
+// Owns the device queues and the only thread that submits to them. Any thread
+// posts submissions and presents through a bounded lock-free queue, so the
+// queues need no mutex and a thread posting never waits for another one
+// holding a queue. Kinds without a dedicated family on the device share the
+// graphics queue, which also presents.
+class QueueArbiter
+{
+public:
+    struct families_t
+    {
+        std::array<uint32_t, (size_t)QueueKind::count> idx;
+        uint32_t operator[](QueueKind kind) const { return idx[(size_t)kind]; }
+    };
+    // a submission or a present, copied in the queue: no pointers to the caller
+    struct op_t
+    {
+        enum class Type : uint32_t { submit, present, idle } type = Type::submit;
+        QueueKind kind = QueueKind::graphics;
+        uint32_t cmd_count = 0;
+        uint32_t wait_count = 0;
+        uint32_t signal_count = 0;
+        std::array<vk::CommandBuffer, 4> cmds;
+        std::array<vk::Semaphore, 2> wait;
+        std::array<vk::PipelineStageFlags, 2> wait_stages;
+        std::array<vk::Semaphore, 2> signal;
+        vk::Fence fence;
+        vk::SwapchainKHR swapchain;
+        uint32_t image_idx = 0;
+        // VK_KHR_incremental_present region, none when extent is 0
+        vk::RectLayerKHR region;
+        // the arbiter stores id there once the submit reached the queue (or
+        // failed): the fence may only be waited on or polled after that
+        std::atomic<uint64_t>* submitted = nullptr;
+        uint64_t id = 0;
+    };
+private:
+    static constexpr uint32_t N = 256;
+    static constexpr size_t cache_line = 64;
+    // bounded multi producer queue, each cell carries the sequence number of
+    // the position it is ready for (D. Vyukov)
+    struct cell_t
+    {
+        std::atomic<uint32_t> seq;
+        op_t op;
+    };
+    alignas(cache_line) std::atomic<uint32_t> m_tail{ 0 };
+    alignas(cache_line) uint32_t m_head = 0;
+    std::atomic<uint32_t> m_waiting{ 0 };
+    std::atomic<uint32_t> m_signal{ 0 };
+    std::atomic<uint32_t> m_idle_done{ 0 };
+    std::atomic<uint32_t> m_idle_posted{ 0 };
+    alignas(cache_line) std::array<cell_t, N> m_cells;
+
+    vk::Device m_dev;
+    families_t m_families;
+    std::array<vk::Queue, (size_t)QueueKind::count> m_queues;
+    std::atomic_bool m_running = false;
+    std::thread m_thread;
+
+    void post(const op_t& op);
+    void thread_main();
+    void execute(const op_t& op);
+public:
+    ~QueueArbiter() { destroy(); }
+
+    // the families to create queues for: graphics must present, compute and
+    // transfer are dedicated families when the device has them. Transfer
+    // falls back to the compute family before graphics.
+    static families_t find_families(const vk::PhysicalDevice& pd, uint32_t graphics_idx);
+    bool create(const vk::UniqueDevice& dev, const families_t& families);
+    void destroy();
+
+    uint32_t family(QueueKind kind) const { return m_families[kind]; }
+    bool dedicated(QueueKind kind) const { return family(kind) != family(QueueKind::graphics); }
+
+    void submit(const op_t& op) { post(op); }
+    // presents on the graphics queue, errors are logged by the arbiter thread.
+    // region requires VK_KHR_incremental_present.
+    void present(vk::SwapchainKHR swapchain, uint32_t image_idx, vk::Semaphore wait,
+        const DirtyRect* region = nullptr);
+    // returns once everything posted before is submitted and the queues are idle
+    void wait_idle();
+    // returns once the arbiter stored id or a later one in submitted, see op_t
+    static void wait_submitted(std::atomic<uint64_t>& submitted, uint64_t id);
+};
+
+// Queue family ownership transfer of an image between two kinds of queue:
+// release() is recorded on the source queue and acquire() on the
+// destination one, after a semaphore waited on dst_stage. When both kinds
+// share a family release() is a plain barrier to the destination access and
+// acquire() records nothing.
+struct ImageHandoff
+{
+    vk::ImageMemoryBarrier imb;
+    vk::PipelineStageFlags src_stage;
+    vk::PipelineStageFlags dst_stage;
+    bool same_family;
+
+    ImageHandoff(const QueueArbiter& queues, QueueKind from, QueueKind to, vk::Image img,
+        vk::ImageLayout old_layout, vk::ImageLayout new_layout,
+        vk::AccessFlags src_access, vk::PipelineStageFlags src_stage,
+        vk::AccessFlags dst_access, vk::PipelineStageFlags dst_stage,
+        const vk::ImageSubresourceRange& range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+    void release(vk::CommandBuffer cmd) const;
+    void acquire(vk::CommandBuffer cmd) const;
+};
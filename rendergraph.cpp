@@ -0,0 +1,157 @@
+#include "pch.h"
+#include "rendergraph.h"
+
+static const vk::AccessFlags write_access_mask = vk::AccessFlagBits::eShaderWrite |
+    vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eTransferWrite |
+    vk::AccessFlagBits::eHostWrite | vk::AccessFlagBits::eMemoryWrite;
+
+void RenderGraph::add_pass(const char* name, std::initializer_list<use_t> uses,
+    std::function<void(vk::CommandBuffer)> record)
+{
+    m_passes.push_back({ name, (uint32_t)m_uses.size(), (uint32_t)uses.size(), std::move(record) });
+    m_uses.insert(m_uses.end(), uses.begin(), uses.end());
+}
+
+void RenderGraph::add_pass(const char* name, const std::vector<use_t>& uses,
+    std::function<void(vk::CommandBuffer)> record)
+{
+    m_passes.push_back({ name, (uint32_t)m_uses.size(), (uint32_t)uses.size(), std::move(record) });
+    m_uses.insert(m_uses.end(), uses.begin(), uses.end());
+}
+
+void RenderGraph::require(const char* pass, const use_t& use)
+{
+    ImageState& s = *use.image;
+    bool writes = bool(use.access & write_access_mask);
+    bool transition = use.discard || s.layout != use.layout;
+
+    // read after read needs nothing once the last write is visible to it
+    bool barrier;
+    if (transition || writes)
+        barrier = transition || s.write_stages || s.read_stages;
+    else
+        barrier = s.write_stages && ((use.stages & ~s.visible_stages) || (use.access & ~s.visible_access));
+
+    if (barrier)
+    {
+        // already transitioned by the barrier being collected: keep its
+        // old layout, only the destination moves. States of other levels or
+        // layers of the same image get their own barrier.
+        vk::ImageMemoryBarrier* merged = nullptr;
+        for (uint32_t i = m_pending_first; i < m_imbs.size(); i++)
+            if (m_imbs[i].image == s.image && m_imbs[i].subresourceRange == s.range)
+                merged = &m_imbs[i];
+        if (merged)
+        {
+            m_pending_src |= s.write_stages | s.read_stages;
+            merged->srcAccessMask |= s.write_access;
+            merged->newLayout = use.layout;
+            merged->dstAccessMask |= use.access;
+        }
+        else
+        {
+            m_pending_src |= s.write_stages | s.read_stages;
+            // a write after reads in the same layout only needs the execution dependency
+            if (transition || s.write_access)
+            {
+                vk::ImageMemoryBarrier imb;
+                imb.srcQueueFamilyIndex = imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                imb.image = s.image;
+                imb.subresourceRange = s.range;
+                imb.srcAccessMask = s.write_access;
+                imb.dstAccessMask = use.access;
+                imb.oldLayout = use.discard ? vk::ImageLayout::eUndefined : s.layout;
+                imb.newLayout = use.layout;
+                m_imbs.push_back(imb);
+                m_imb_names.push_back(s.name);
+            }
+        }
+        if (!m_pending_pass)
+            m_pending_pass = pass;
+        m_pending_dst |= use.stages;
+    }
+
+    s.layout = use.layout;
+    if (writes)
+    {
+        s.write_stages = use.stages;
+        s.write_access = use.access & write_access_mask;
+        s.visible_stages = {};
+        s.visible_access = {};
+        s.read_stages = {};
+    }
+    else if (transition)
+    {
+        // the layout transition is the last write, visible to this use only
+        s.write_stages = use.stages;
+        s.write_access = {};
+        s.visible_stages = use.stages;
+        s.visible_access = use.access;
+        s.read_stages = use.stages;
+    }
+    else
+    {
+        if (barrier)
+        {
+            s.visible_stages |= use.stages;
+            s.visible_access |= use.access;
+        }
+        s.read_stages |= use.stages;
+    }
+}
+
+void RenderGraph::flush(vk::CommandBuffer cmd)
+{
+    if (!m_pending_pass)
+        return;
+    // nothing touched the images before, e.g. a fresh image being discarded
+    vk::PipelineStageFlags src = m_pending_src ? m_pending_src : vk::PipelineStageFlagBits::eTopOfPipe;
+    uint32_t count = (uint32_t)m_imbs.size() - m_pending_first;
+    cmd.pipelineBarrier(src, m_pending_dst, {}, 0, nullptr, 0, nullptr,
+        count, count ? &m_imbs[m_pending_first] : nullptr);
+    m_barriers.push_back({ m_pending_pass, src, m_pending_dst, m_pending_first, count });
+
+    m_pending_pass = nullptr;
+    m_pending_src = {};
+    m_pending_dst = {};
+    m_pending_first = (uint32_t)m_imbs.size();
+}
+
+void RenderGraph::execute(vk::CommandBuffer cmd)
+{
+    m_barriers.clear();
+    m_imbs.clear();
+    m_imb_names.clear();
+    m_pending_first = 0;
+    for (const auto& pass : m_passes)
+    {
+        for (uint32_t i = 0; i < pass.use_count; i++)
+            require(pass.name, m_uses[pass.first_use + i]);
+        if (pass.record)
+        {
+            flush(cmd);
+            pass.record(cmd);
+        }
+    }
+    // the state left for the work outside the graph
+    flush(cmd);
+    m_passes.clear();
+    m_uses.clear();
+}
+
+std::string RenderGraph::dump() const
+{
+    std::string out;
+    for (const auto& b : m_barriers)
+    {
+        out += fmt::format("{}: {} -> {}\n", b.pass, vk::to_string(b.src_stages), vk::to_string(b.dst_stages));
+        for (uint32_t i = b.first_imb; i < b.first_imb + b.imb_count; i++)
+        {
+            const auto& imb = m_imbs[i];
+            out += fmt::format("    {} {} -> {} ({} -> {})\n", m_imb_names[i],
+                vk::to_string(imb.oldLayout), vk::to_string(imb.newLayout),
+                vk::to_string(imb.srcAccessMask), vk::to_string(imb.dstAccessMask));
+        }
+    }
+    return out;
+}
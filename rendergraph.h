@@ -0,0 +1,121 @@
+#pragma once
+#include "utils.h"
+
+// What the GPU last did to an image, kept with the image across graph
+// executions and command buffers. Only the thread recording the passes that
+// touch the image may use it.
+struct ImageState
+{
+    vk::Image image;
+    vk::ImageSubresourceRange range;
+    const char* name = "";
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    // last write (or layout transition) and the stages it is visible to
+    vk::PipelineStageFlags write_stages;
+    vk::AccessFlags write_access;
+    vk::PipelineStageFlags visible_stages;
+    vk::AccessFlags visible_access;
+    // reads since the last write
+    vk::PipelineStageFlags read_stages;
+
+    void reset(vk::Image img, const vk::ImageSubresourceRange& subresource, const char* debug_name)
+    {
+        *this = ImageState();
+        image = img;
+        range = subresource;
+        name = debug_name;
+    }
+};
+
+/*
+Passes declare how they use the images, execute() records them with the
+barriers they need: one pipelineBarrier before a pass for all its images, no
+barrier for reads of an image already visible in the right layout. Passes
+without commands (the layout other threads expect, e.g. the display) only
+move the pending transitions, two transitions of an image in a row become a
+single one. eUndefined is only used as old layout by passes that discard the
+content, never on a live canvas.
+*/
+class RenderGraph
+{
+public:
+    struct use_t
+    {
+        ImageState* image;
+        vk::ImageLayout layout;
+        vk::AccessFlags access;
+        vk::PipelineStageFlags stages;
+        // the pass overwrites the whole image, the old content can be dropped
+        bool discard = false;
+    };
+    // one pipelineBarrier of the last execute(), for the debug dump
+    struct barrier_t
+    {
+        const char* pass;
+        vk::PipelineStageFlags src_stages;
+        vk::PipelineStageFlags dst_stages;
+        uint32_t first_imb;
+        uint32_t imb_count;
+    };
+
+    static use_t color_attachment(ImageState& img)
+    {
+        return { &img, vk::ImageLayout::eColorAttachmentOptimal,
+            vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite,
+            vk::PipelineStageFlagBits::eColorAttachmentOutput };
+    }
+    static use_t sampled(ImageState& img, vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eFragmentShader)
+    {
+        return { &img, vk::ImageLayout::eShaderReadOnlyOptimal, vk::AccessFlagBits::eShaderRead, stages };
+    }
+    static use_t storage(ImageState& img, vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader)
+    {
+        return { &img, vk::ImageLayout::eGeneral,
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite, stages };
+    }
+    static use_t transfer_src(ImageState& img)
+    {
+        return { &img, vk::ImageLayout::eTransferSrcOptimal, vk::AccessFlagBits::eTransferRead,
+            vk::PipelineStageFlagBits::eTransfer };
+    }
+    static use_t transfer_dst(ImageState& img, bool discard)
+    {
+        return { &img, vk::ImageLayout::eTransferDstOptimal, vk::AccessFlagBits::eTransferWrite,
+            vk::PipelineStageFlagBits::eTransfer, discard };
+    }
+
+    // record may be null: the uses are then the state to leave the images in
+    void add_pass(const char* name, std::initializer_list<use_t> uses,
+        std::function<void(vk::CommandBuffer)> record = nullptr);
+    // the uses known at run time only, e.g. every level of a mip chain
+    void add_pass(const char* name, const std::vector<use_t>& uses,
+        std::function<void(vk::CommandBuffer)> record = nullptr);
+    // records the passes added since the last call into cmd, which is begun
+    void execute(vk::CommandBuffer cmd);
+
+    const std::vector<barrier_t>& barriers() const { return m_barriers; }
+    // the barriers of the last execute(), one line per pipelineBarrier
+    std::string dump() const;
+private:
+    struct pass_t
+    {
+        const char* name;
+        uint32_t first_use;
+        uint32_t use_count;
+        std::function<void(vk::CommandBuffer)> record;
+    };
+    std::vector<pass_t> m_passes;
+    std::vector<use_t> m_uses;
+    std::vector<barrier_t> m_barriers;
+    std::vector<vk::ImageMemoryBarrier> m_imbs;
+    std::vector<const char*> m_imb_names;
+
+    // the barrier being collected, recorded before the next pass with commands
+    const char* m_pending_pass = nullptr;
+    vk::PipelineStageFlags m_pending_src;
+    vk::PipelineStageFlags m_pending_dst;
+    uint32_t m_pending_first = 0;
+
+    void require(const char* pass, const use_t& use);
+    void flush(vk::CommandBuffer cmd);
+};
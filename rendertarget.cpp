@@ -2,76 +2,84 @@
 #include "rendertarget.h"
 #include "utils.h"
 #include "debug_message.h"
+#include "CmdRenderStrokeBatch.h"
+#include "CmdRenderStrokeCompute.h"
+#include "CmdRenderStrokeSegments.h"
 
 /*
 Canvas: where we are going to draw stuff
-- Color attachment: RGBA Image
-- Framebuffer
-- Pipeline:
--- input: no input
--- blend: no blend
-- Shader: mixes the brush samples
--- tex: color attachment (base mixing)
--- tex: brush value
---
+- Color attachment: RGBA Image, multisampled or single sample
+- Framebuffer, the resolved copy when multisampled
+- Mip chain on the image the display samples, kept up to date for the tiles
+  strokes touch
+- Pipelines: instanced dabs, capsule segments and the compute backend, they
+  mix with the canvas through the blender or a storage image
 */
 
-bool RenderTarget::create(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev, int width, int height, vk::SampleCountFlagBits samples, vk::Format format)
+bool RenderTarget::create(const vk::PhysicalDevice& pd, MemoryAllocator& allocator, const vk::UniqueDevice& dev, int width, int height, vk::SampleCountFlagBits samples, vk::Format format)
 {
     m_size = { width, height };
     m_samples = samples;
     m_format = format;
 
-    create_framebuffer(pd, dev);
+    // the compute backend writes the canvas as a rgba8 storage image
+    auto format_props = pd.getFormatProperties(m_format);
+    m_compute_supported = m_samples == vk::SampleCountFlagBits::e1 && m_format == vk::Format::eR8G8B8A8Unorm &&
+        (format_props.optimalTilingFeatures & vk::FormatFeatureFlagBits::eStorageImage);
 
-    uint32_t spec_samples_count = (uint32_t)samples;
-    vk::SpecializationMapEntry spec_samples;
-    spec_samples.constantID = 0;
-    spec_samples.offset = 0;
-    spec_samples.size = sizeof(uint32_t);
-    vk::SpecializationInfo spec_info;
-    spec_info.mapEntryCount = 1;
-    spec_info.pMapEntries = &spec_samples;
-    spec_info.dataSize = sizeof(spec_samples_count);
-    spec_info.pData = &spec_samples_count;
-    if (samples == vk::SampleCountFlagBits::e1)
-    {
-        m_shader_vert = load_shader(dev, "shader.vert.spv");
-        m_shader_frag = load_shader(dev, "shader.frag.spv");
-    }
-    else
-    {
-        m_shader_vert = load_shader(dev, "shader.vert.spv");
-        m_shader_frag = load_shader(dev, "shader.frag.ms.spv");
-    }
+    create_framebuffer(allocator, dev);
+
+    create_batch_pipeline(dev);
+    create_segment_pipeline(dev);
+    if (m_compute_supported)
+        create_compute_pipeline(dev);
+
+    return true;
+}
+
+bool RenderTarget::create_batch_pipeline(const vk::UniqueDevice& dev)
+{
+    m_batch_shader_vert = load_shader(dev, "shader-batch.vert.spv");
+    m_batch_shader_frag = load_shader(dev, "shader-batch.frag.spv");
     std::array<vk::PipelineShaderStageCreateInfo, 2> stages = {
-        vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *m_shader_vert, "main"),
-        vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *m_shader_frag, "main", &spec_info),
+        vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *m_batch_shader_vert, "main"),
+        vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *m_batch_shader_frag, "main"),
     };
 
-    std::array<vk::DescriptorSetLayoutBinding, 4> pipeline_layout_bind = {
-        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eUniformBuffer, // mvp
-            1, vk::ShaderStageFlagBits::eVertex, nullptr),
-        vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eCombinedImageSampler, // tex_bg
-            1, vk::ShaderStageFlagBits::eFragment, nullptr),
-        vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eCombinedImageSampler, // tex_brush
-            1, vk::ShaderStageFlagBits::eFragment, nullptr),
-        vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eUniformBuffer, // col
+    std::array<vk::DescriptorSetLayoutBinding, 1> pipeline_layout_bind = {
+        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eCombinedImageSampler, // tex_brush
             1, vk::ShaderStageFlagBits::eFragment, nullptr),
     };
     vk::DescriptorSetLayoutCreateInfo descr_info;
     descr_info.bindingCount = pipeline_layout_bind.size();
     descr_info.pBindings = pipeline_layout_bind.data();
-    m_descr_layout = dev->createDescriptorSetLayoutUnique(descr_info);
-    debug_name(m_descr_layout, "RenderTarget::m_descr_layout");
+    m_batch_descr_layout = dev->createDescriptorSetLayoutUnique(descr_info);
+    debug_name(m_batch_descr_layout, "RenderTarget::m_batch_descr_layout");
 
     vk::PipelineLayoutCreateInfo layout_info;
     layout_info.setLayoutCount = 1;
-    layout_info.pSetLayouts = &m_descr_layout.get();
-    m_layout = dev->createPipelineLayoutUnique(layout_info);
-    debug_name(m_layout, "RenderTarget::m_layout");
-
+    layout_info.pSetLayouts = &m_batch_descr_layout.get();
+    m_batch_layout = dev->createPipelineLayoutUnique(layout_info);
+    debug_name(m_batch_layout, "RenderTarget::m_batch_layout");
+
+    // one dab per instance
+    vk::VertexInputBindingDescription dab_binding;
+    dab_binding.binding = 0;
+    dab_binding.stride = sizeof(CmdRenderStrokeBatch::dab_t);
+    dab_binding.inputRate = vk::VertexInputRate::eInstance;
+    std::array<vk::VertexInputAttributeDescription, 3> dab_attributes = {
+        vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32B32A32Sfloat, // pos, scale, pressure
+            offsetof(CmdRenderStrokeBatch::dab_t, pos)),
+        vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32Sfloat, // col
+            offsetof(CmdRenderStrokeBatch::dab_t, col)),
+        vk::VertexInputAttributeDescription(2, 0, vk::Format::eR32Uint, // tip
+            offsetof(CmdRenderStrokeBatch::dab_t, tip)),
+    };
     vk::PipelineVertexInputStateCreateInfo vertex_input;
+    vertex_input.vertexBindingDescriptionCount = 1;
+    vertex_input.pVertexBindingDescriptions = &dab_binding;
+    vertex_input.vertexAttributeDescriptionCount = dab_attributes.size();
+    vertex_input.pVertexAttributeDescriptions = dab_attributes.data();
     vk::PipelineInputAssemblyStateCreateInfo input_assembly;
     input_assembly.topology = vk::PrimitiveTopology::eTriangleList;
 
@@ -97,8 +105,15 @@ bool RenderTarget::create(const vk::PhysicalDevice& pd, const vk::UniqueDevice&
     multisample.sampleShadingEnable = true;
     multisample.minSampleShading = (m_samples == vk::SampleCountFlagBits::e1) ? 1.f : .25f;
 
+    // rgb = mix(bg, col, pressure * brush), alpha is left untouched
     vk::PipelineColorBlendAttachmentState blend_color;
-    blend_color.blendEnable = false;
+    blend_color.blendEnable = true;
+    blend_color.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+    blend_color.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+    blend_color.colorBlendOp = vk::BlendOp::eAdd;
+    blend_color.srcAlphaBlendFactor = vk::BlendFactor::eZero;
+    blend_color.dstAlphaBlendFactor = vk::BlendFactor::eOne;
+    blend_color.alphaBlendOp = vk::BlendOp::eAdd;
     blend_color.colorWriteMask = cc::eR | cc::eG | cc::eB | cc::eA;
     vk::PipelineColorBlendStateCreateInfo blend;
     blend.logicOpEnable = false;
@@ -106,6 +121,15 @@ bool RenderTarget::create(const vk::PhysicalDevice& pd, const vk::UniqueDevice&
     blend.attachmentCount = 1;
     blend.pAttachments = &blend_color;
 
+    // render area and scissor follow the dirty rect of each batch
+    std::array<vk::DynamicState, 2> dyn_states = {
+        vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor,
+    };
+    vk::PipelineDynamicStateCreateInfo dyn;
+    dyn.dynamicStateCount = dyn_states.size();
+    dyn.pDynamicStates = dyn_states.data();
+
     vk::GraphicsPipelineCreateInfo info;
     info.stageCount = stages.size();
     info.pStages = stages.data();
@@ -117,110 +141,218 @@ bool RenderTarget::create(const vk::PhysicalDevice& pd, const vk::UniqueDevice&
     info.pMultisampleState = &multisample;
     info.pDepthStencilState = nullptr;
     info.pColorBlendState = &blend;
-    info.pDynamicState = nullptr;
-    info.layout = *m_layout;
+    info.pDynamicState = &dyn;
+    info.layout = *m_batch_layout;
     info.renderPass = *m_renderpass;
     info.subpass = 0;
 
-    m_pipeline = dev->createGraphicsPipelineUnique(nullptr, info);
-    debug_name(m_pipeline, "RenderTarget::m_pipeline");
+    m_batch_pipeline = dev->createGraphicsPipelineUnique(nullptr, info);
+    debug_name(m_batch_pipeline, "RenderTarget::m_batch_pipeline");
 
+    if (m_samples == vk::SampleCountFlagBits::e1)
+    {
+        // same state, the fragment shader antialiases the dabs itself
+        VkBool32 analytic_aa = VK_TRUE;
+        vk::SpecializationMapEntry spec_entry(0, 0, sizeof(VkBool32)); // ANALYTIC_AA
+        vk::SpecializationInfo spec_info(1, &spec_entry, sizeof(analytic_aa), &analytic_aa);
+        stages[1].pSpecializationInfo = &spec_info;
+        m_batch_pipeline_aa = dev->createGraphicsPipelineUnique(nullptr, info);
+        debug_name(m_batch_pipeline_aa, "RenderTarget::m_batch_pipeline_aa");
+    }
 
     return true;
 }
 
-void RenderTarget::to_layout(const vk::UniqueDevice& dev, const vk::UniqueCommandPool& cmd_pool, const vk::Queue& q,
-    vk::AccessFlags access_mask, vk::ImageLayout layout, vk::PipelineStageFlags src_stage, vk::PipelineStageFlags dst_stage)
+bool RenderTarget::create_segment_pipeline(const vk::UniqueDevice& dev)
 {
-    vk::UniqueCommandBuffer cmd = std::move(dev->allocateCommandBuffersUnique(
-        { *cmd_pool, vk::CommandBufferLevel::ePrimary, 1 }).front());
-    debug_name(cmd, "RenderTarget::to_layout::cmd");
-    cmd->begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
-    {
-        vk::ImageMemoryBarrier imb;
-        imb.srcAccessMask = m_fb_access_mask;
-        imb.dstAccessMask = access_mask;
-        imb.oldLayout = m_fb_layout;
-        imb.newLayout = layout;
-        imb.srcQueueFamilyIndex = imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        imb.image = *m_fb_img;
-        imb.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-        cmd->pipelineBarrier(src_stage, dst_stage, {}, 0, nullptr, 0, nullptr, 1, &imb);
-    }
-    cmd->end();
+    m_segment_shader_vert = load_shader(dev, "shader-segment.vert.spv");
+    m_segment_shader_frag = load_shader(dev, "shader-segment.frag.spv");
+    std::array<vk::PipelineShaderStageCreateInfo, 2> stages = {
+        vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *m_segment_shader_vert, "main"),
+        vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *m_segment_shader_frag, "main"),
+    };
+
+    // no descriptors, the segments are analytic
+    vk::PushConstantRange push_range(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        0, sizeof(CmdRenderStrokeSegments::push_t));
+    vk::PipelineLayoutCreateInfo layout_info;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    m_segment_layout = dev->createPipelineLayoutUnique(layout_info);
+    debug_name(m_segment_layout, "RenderTarget::m_segment_layout");
+
+    // one segment per instance
+    vk::VertexInputBindingDescription seg_binding;
+    seg_binding.binding = 0;
+    seg_binding.stride = sizeof(CmdRenderStrokeSegments::segment_t);
+    seg_binding.inputRate = vk::VertexInputRate::eInstance;
+    std::array<vk::VertexInputAttributeDescription, 4> seg_attributes = {
+        vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32B32A32Sfloat, // a, b
+            offsetof(CmdRenderStrokeSegments::segment_t, a)),
+        vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32Sfloat, // radius
+            offsetof(CmdRenderStrokeSegments::segment_t, radius)),
+        vk::VertexInputAttributeDescription(2, 0, vk::Format::eR32G32B32A32Sfloat, // col
+            offsetof(CmdRenderStrokeSegments::segment_t, col)),
+        vk::VertexInputAttributeDescription(3, 0, vk::Format::eR32G32B32A32Sfloat, // prev
+            offsetof(CmdRenderStrokeSegments::segment_t, prev)),
+    };
+    vk::PipelineVertexInputStateCreateInfo vertex_input;
+    vertex_input.vertexBindingDescriptionCount = 1;
+    vertex_input.pVertexBindingDescriptions = &seg_binding;
+    vertex_input.vertexAttributeDescriptionCount = seg_attributes.size();
+    vertex_input.pVertexAttributeDescriptions = seg_attributes.data();
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly;
+    input_assembly.topology = vk::PrimitiveTopology::eTriangleList;
+
+    vk::Viewport vp = { 0.f, 0.f, (float)m_size.x, (float)m_size.y, 0.f, 1.f };
+    vk::Rect2D scissor = { vk::Offset2D(0), vk::Extent2D(m_size.x, m_size.y) };
+    vk::PipelineViewportStateCreateInfo viewport;
+    viewport.viewportCount = 1;
+    viewport.pViewports = &vp;
+    viewport.scissorCount = 1;
+    viewport.pScissors = &scissor;
+
+    vk::PipelineRasterizationStateCreateInfo rasterization;
+    rasterization.depthBiasClamp = false;
+    rasterization.rasterizerDiscardEnable = false;
+    rasterization.polygonMode = vk::PolygonMode::eFill;
+    rasterization.cullMode = vk::CullModeFlagBits::eNone;
+    rasterization.frontFace = vk::FrontFace::eClockwise;
+    rasterization.depthBiasEnable = false;
+    rasterization.lineWidth = 1.f;
+
+    vk::PipelineMultisampleStateCreateInfo multisample;
+    multisample.rasterizationSamples = m_samples;
+    multisample.sampleShadingEnable = true;
+    multisample.minSampleShading = (m_samples == vk::SampleCountFlagBits::e1) ? 1.f : .25f;
+
+    // rgb = mix(bg, col, coverage), alpha is left untouched
+    vk::PipelineColorBlendAttachmentState blend_color;
+    blend_color.blendEnable = true;
+    blend_color.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+    blend_color.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+    blend_color.colorBlendOp = vk::BlendOp::eAdd;
+    blend_color.srcAlphaBlendFactor = vk::BlendFactor::eZero;
+    blend_color.dstAlphaBlendFactor = vk::BlendFactor::eOne;
+    blend_color.alphaBlendOp = vk::BlendOp::eAdd;
+    blend_color.colorWriteMask = cc::eR | cc::eG | cc::eB | cc::eA;
+    vk::PipelineColorBlendStateCreateInfo blend;
+    blend.logicOpEnable = false;
+    blend.logicOp = vk::LogicOp::eCopy;
+    blend.attachmentCount = 1;
+    blend.pAttachments = &blend_color;
+
+    // render area and scissor follow the dirty rect of each batch
+    std::array<vk::DynamicState, 2> dyn_states = {
+        vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor,
+    };
+    vk::PipelineDynamicStateCreateInfo dyn;
+    dyn.dynamicStateCount = dyn_states.size();
+    dyn.pDynamicStates = dyn_states.data();
+
+    vk::GraphicsPipelineCreateInfo info;
+    info.stageCount = stages.size();
+    info.pStages = stages.data();
+    info.pVertexInputState = &vertex_input;
+    info.pInputAssemblyState = &input_assembly;
+    info.pTessellationState = nullptr;
+    info.pViewportState = &viewport;
+    info.pRasterizationState = &rasterization;
+    info.pMultisampleState = &multisample;
+    info.pDepthStencilState = nullptr;
+    info.pColorBlendState = &blend;
+    info.pDynamicState = &dyn;
+    info.layout = *m_segment_layout;
+    info.renderPass = *m_renderpass;
+    info.subpass = 0;
 
-    m_fb_access_mask = access_mask;
-    m_fb_layout = layout;
+    m_segment_pipeline = dev->createGraphicsPipelineUnique(nullptr, info);
+    debug_name(m_segment_pipeline, "RenderTarget::m_segment_pipeline");
 
-    vk::SubmitInfo si;
-    si.commandBufferCount = 1;
-    si.pCommandBuffers = &cmd.get();
-    vk::UniqueFence submit_fence = dev->createFenceUnique(vk::FenceCreateInfo());
-    q.submit(si, *submit_fence);
-    dev->waitForFences(*submit_fence, true, UINT64_MAX);
+    return true;
 }
 
-void RenderTarget::resolve(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& cmd_pool, const vk::Queue& cmd_queue)
+bool RenderTarget::create_compute_pipeline(const vk::UniqueDevice& dev)
 {
-    vk::SubmitInfo si;
-    si.commandBufferCount = 1;
-    si.pCommandBuffers = &cmd_resolve.get();
-    vk::UniqueFence submit_fence = m_dev->createFenceUnique(vk::FenceCreateInfo());
-    cmd_queue.submit(si, *submit_fence);
-    m_dev->waitForFences(*submit_fence, true, UINT64_MAX);
+    m_bin_shader = load_shader(dev, "shader-bin.comp.spv");
+    m_raster_shader = load_shader(dev, "shader-raster.comp.spv");
+
+    std::array<vk::DescriptorSetLayoutBinding, 4> pipeline_layout_bind = {
+        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageImage, // canvas
+            1, vk::ShaderStageFlagBits::eCompute, nullptr),
+        vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eCombinedImageSampler, // tex_brush
+            1, vk::ShaderStageFlagBits::eCompute, nullptr),
+        // dynamic: the range of the slot is given when binding, see ComputeStrokeSet
+        vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBufferDynamic, // dabs
+            1, vk::ShaderStageFlagBits::eCompute, nullptr),
+        vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageBufferDynamic, // tiles mask
+            1, vk::ShaderStageFlagBits::eCompute, nullptr),
+    };
+    vk::DescriptorSetLayoutCreateInfo descr_info;
+    descr_info.bindingCount = pipeline_layout_bind.size();
+    descr_info.pBindings = pipeline_layout_bind.data();
+    m_compute_descr_layout = dev->createDescriptorSetLayoutUnique(descr_info);
+    debug_name(m_compute_descr_layout, "RenderTarget::m_compute_descr_layout");
+
+    vk::PushConstantRange push_range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CmdRenderStrokeCompute::push_t));
+    vk::PipelineLayoutCreateInfo layout_info;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &m_compute_descr_layout.get();
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    m_compute_layout = dev->createPipelineLayoutUnique(layout_info);
+    debug_name(m_compute_layout, "RenderTarget::m_compute_layout");
+
+    std::array<uint32_t, 2> spec_values = { CmdRenderStrokeCompute::tile_size, CmdRenderStrokeCompute::mask_words };
+    std::array<vk::SpecializationMapEntry, 2> spec_entries = {
+        vk::SpecializationMapEntry(0, 0, sizeof(uint32_t)), // TILE_SIZE
+        vk::SpecializationMapEntry(1, sizeof(uint32_t), sizeof(uint32_t)), // MASK_WORDS
+    };
+    vk::SpecializationInfo spec_info;
+    spec_info.mapEntryCount = spec_entries.size();
+    spec_info.pMapEntries = spec_entries.data();
+    spec_info.dataSize = sizeof(spec_values);
+    spec_info.pData = spec_values.data();
+
+    vk::ComputePipelineCreateInfo info;
+    info.layout = *m_compute_layout;
+    info.stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *m_bin_shader, "main", &spec_info);
+    m_bin_pipeline = dev->createComputePipelineUnique(nullptr, info);
+    debug_name(m_bin_pipeline, "RenderTarget::m_bin_pipeline");
+
+    info.stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *m_raster_shader, "main", &spec_info);
+    m_raster_pipeline = dev->createComputePipelineUnique(nullptr, info);
+    debug_name(m_raster_pipeline, "RenderTarget::m_raster_pipeline");
+
+    return true;
 }
 
-bool RenderTarget::create_framebuffer(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev)
+bool RenderTarget::create_framebuffer(MemoryAllocator& allocator, const vk::UniqueDevice& dev)
 {
+    // down to 1x1, multisampled images cannot have mips: the resolved one has them
+    bool multisampled = m_samples != vk::SampleCountFlagBits::e1;
+    m_mip_levels = (uint32_t)std::floor(std::log2(std::max(m_size.x, m_size.y))) + 1;
+
     // device image
     vk::ImageCreateInfo img_info;
     img_info.imageType = vk::ImageType::e2D;
     img_info.format = m_format;
     img_info.extent = vk::Extent3D(m_size.x, m_size.y, 1);
-    img_info.mipLevels = 1;
+    img_info.mipLevels = multisampled ? 1 : m_mip_levels;
     img_info.arrayLayers = 1;
     img_info.samples = m_samples;
     img_info.tiling = vk::ImageTiling::eOptimal;
-    img_info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+    img_info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eColorAttachment |
+        vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst;
+    if (m_compute_supported)
+        img_info.usage |= vk::ImageUsageFlagBits::eStorage;
     img_info.sharingMode = vk::SharingMode::eExclusive; // TODO: check this since it will likely be used in different command buffers
     img_info.initialLayout = vk::ImageLayout::eUndefined;
     m_fb_img = dev->createImageUnique(img_info);
     debug_name(m_fb_img, "RenderTarget::m_fb_img");
 
-    vk::ImageCreateInfo resolved_info;
-    resolved_info.imageType = vk::ImageType::e2D;
-    resolved_info.format = vk::Format::eR8G8B8A8Unorm;
-    resolved_info.extent = vk::Extent3D(m_size.x, m_size.y, 1);
-    resolved_info.mipLevels = 1;
-    resolved_info.arrayLayers = 1;
-    resolved_info.samples = vk::SampleCountFlagBits::e1;
-    resolved_info.tiling = vk::ImageTiling::eOptimal;
-    resolved_info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc;
-    resolved_info.sharingMode = vk::SharingMode::eExclusive;
-    resolved_info.initialLayout = vk::ImageLayout::eUndefined;
-    m_resolved_img = dev->createImageUnique(resolved_info);
-    debug_name(m_resolved_img, "RenderTarget::m_resolved_img");
-    vk::MemoryRequirements img_req = dev->getImageMemoryRequirements(*m_fb_img);
-    uint32_t img_mem_idx = find_memory(pd, img_req, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    vk::MemoryRequirements resolved_req = dev->getImageMemoryRequirements(*m_resolved_img);
-    uint32_t resolved_mem_idx = find_memory(pd, resolved_req, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    if (img_mem_idx == resolved_mem_idx)
-    {
-        m_fb_mem = dev->allocateMemoryUnique({ img_req.size + resolved_req.size, img_mem_idx });
-        debug_name(m_fb_mem, "RenderTarget::m_fb_mem");
-        m_resolved_mem.reset();
-        dev->bindImageMemory(*m_fb_img, *m_fb_mem, 0);
-        dev->bindImageMemory(*m_resolved_img, *m_fb_mem, img_req.size);
-    }
-    else
-    {
-        m_fb_mem = dev->allocateMemoryUnique({ img_req.size, img_mem_idx });
-        debug_name(m_fb_mem, "RenderTarget::m_fb_mem");
-        dev->bindImageMemory(*m_fb_img, *m_fb_mem, 0);
-        m_resolved_mem = dev->allocateMemoryUnique({ resolved_req.size, resolved_mem_idx });
-        debug_name(m_resolved_mem, "RenderTarget::m_resolved_mem");
-        dev->bindImageMemory(*m_resolved_img, *m_resolved_mem, 0);
-    }
+    m_fb_mem = allocator.bind(m_fb_img, vk::MemoryPropertyFlagBits::eDeviceLocal);
 
     // image view
     vk::ImageViewCreateInfo view_info;
@@ -231,14 +363,44 @@ bool RenderTarget::create_framebuffer(const vk::PhysicalDevice& pd, const vk::Un
     view_info.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
     m_fb_view = dev->createImageViewUnique(view_info);
     debug_name(m_fb_view, "RenderTarget::m_fb_view");
-    vk::ImageViewCreateInfo resolved_view_info;
-    resolved_view_info.image = *m_resolved_img;
-    resolved_view_info.viewType = vk::ImageViewType::e2D;
-    resolved_view_info.format = resolved_info.format;
-    resolved_view_info.components = { cs::eR, cs::eG, cs::eB, cs::eA };
-    resolved_view_info.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-    m_resolved_view = dev->createImageViewUnique(resolved_view_info);
-    debug_name(m_resolved_view, "RenderTarget::m_resolved_view");
+
+    // single sample targets are displayed and saved directly, strokes
+    // antialias their edges in the shader instead
+    if (multisampled)
+    {
+        vk::ImageCreateInfo resolved_info;
+        resolved_info.imageType = vk::ImageType::e2D;
+        resolved_info.format = vk::Format::eR8G8B8A8Unorm;
+        resolved_info.extent = vk::Extent3D(m_size.x, m_size.y, 1);
+        resolved_info.mipLevels = m_mip_levels;
+        resolved_info.arrayLayers = 1;
+        resolved_info.samples = vk::SampleCountFlagBits::e1;
+        resolved_info.tiling = vk::ImageTiling::eOptimal;
+        resolved_info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc;
+        resolved_info.sharingMode = vk::SharingMode::eExclusive;
+        resolved_info.initialLayout = vk::ImageLayout::eUndefined;
+        m_resolved_img = dev->createImageUnique(resolved_info);
+        debug_name(m_resolved_img, "RenderTarget::m_resolved_img");
+        m_resolved_mem = allocator.bind(m_resolved_img, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        vk::ImageViewCreateInfo resolved_view_info;
+        resolved_view_info.image = *m_resolved_img;
+        resolved_view_info.viewType = vk::ImageViewType::e2D;
+        resolved_view_info.format = resolved_info.format;
+        resolved_view_info.components = { cs::eR, cs::eG, cs::eB, cs::eA };
+        resolved_view_info.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+        m_resolved_view = dev->createImageViewUnique(resolved_view_info);
+        debug_name(m_resolved_view, "RenderTarget::m_resolved_view");
+    }
+
+    // the whole chain, for the display
+    vk::ImageViewCreateInfo display_view_info;
+    display_view_info.image = multisampled ? *m_resolved_img : *m_fb_img;
+    display_view_info.viewType = vk::ImageViewType::e2D;
+    display_view_info.format = multisampled ? vk::Format::eR8G8B8A8Unorm : m_format;
+    display_view_info.components = { cs::eR, cs::eG, cs::eB, cs::eA };
+    display_view_info.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, m_mip_levels, 0, 1);
+    m_display_view = dev->createImageViewUnique(display_view_info);
+    debug_name(m_display_view, "RenderTarget::m_display_view");
 
     // renderpass
     vk::AttachmentDescription renderpass_descr;
@@ -248,10 +410,11 @@ bool RenderTarget::create_framebuffer(const vk::PhysicalDevice& pd, const vk::Un
     renderpass_descr.storeOp = vk::AttachmentStoreOp::eStore;
     renderpass_descr.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
     renderpass_descr.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-    renderpass_descr.initialLayout = vk::ImageLayout::eColorAttachmentOptimal; // TODO: try other things
-    renderpass_descr.finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    // no transitions in the render pass, RenderGraph puts the canvas in this layout
+    renderpass_descr.initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
+    renderpass_descr.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
 
-    auto subpass_color_ref = vk::AttachmentReference(0, vk::ImageLayout::eGeneral);
+    auto subpass_color_ref = vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal);
     vk::SubpassDescription subpass_descr;
     subpass_descr.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
     subpass_descr.colorAttachmentCount = 1;
@@ -275,76 +438,238 @@ bool RenderTarget::create_framebuffer(const vk::PhysicalDevice& pd, const vk::Un
     m_framebuffer = dev->createFramebufferUnique(fb_info);
     debug_name(m_framebuffer, "RenderTarget::m_framebuffer");
 
-    m_fb_access_mask = vk::AccessFlags();
-    m_fb_layout = vk::ImageLayout::eUndefined;
+    auto color_range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    m_fb_state.reset(*m_fb_img, color_range, "RenderTarget::m_fb_img");
+    if (multisampled)
+        m_resolved_state.reset(*m_resolved_img, color_range, "RenderTarget::m_resolved_img");
+    m_mip_states.resize(m_mip_levels - 1);
+    for (uint32_t level = 1; level < m_mip_levels; level++)
+    {
+        m_mip_states[level - 1].reset(display_view_info.image,
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1), "RenderTarget mip");
+    }
+    m_tiles = (m_size + dirty_tile_size - 1) / dirty_tile_size;
+    m_dirty_tiles.assign((m_tiles.x * m_tiles.y + 63) / 64, 0);
+    m_dirty_count = 0;
 
     return true;
 }
 
-bool RenderTarget::create_resolver(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& cmd_pool, const vk::Queue& cmd_queue)
+// overlapping rects are merged, blit regions of a level must not overlap
+static void merge_overlaps(std::vector<DirtyRect>& rects)
+{
+    for (size_t i = 0; i < rects.size(); i++)
+    {
+        for (size_t j = i + 1; j < rects.size(); j++)
+        {
+            const DirtyRect& a = rects[i];
+            const DirtyRect& b = rects[j];
+            if (glm::any(glm::greaterThanEqual(a.min, b.max)) || glm::any(glm::greaterThanEqual(b.min, a.max)))
+                continue;
+            rects[i].add(b);
+            rects.erase(rects.begin() + j);
+            // the grown rect may overlap the ones already checked
+            j = i;
+        }
+    }
+}
+
+ImageState& RenderTarget::display_state()
 {
-    auto cmd_resolve_info = vk::CommandBufferAllocateInfo(*cmd_pool, vk::CommandBufferLevel::ePrimary, 1);
-    cmd_resolve = std::move(m_dev->allocateCommandBuffersUnique(cmd_resolve_info).front());
-    debug_name(cmd_resolve, "RenderTarget::cmd_resolve");
-
-    cmd_resolve->begin(vk::CommandBufferBeginInfo());
-
-    vk::ImageMemoryBarrier imb;
-    imb.srcQueueFamilyIndex = imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imb.image = *m_resolved_img;
-    imb.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-    imb.srcAccessMask = {};// vk::AccessFlagBits::eShaderRead;
-    imb.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-    imb.oldLayout = vk::ImageLayout::eUndefined;
-    imb.newLayout = vk::ImageLayout::eTransferDstOptimal;
-    cmd_resolve->pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
-        {}, 0, nullptr, 0, nullptr, 1, &imb);
-
-    vk::ImageResolve resolve;
-    resolve.srcSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
-    resolve.srcOffset = vk::Offset3D();
-    resolve.dstSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
-    resolve.dstOffset = vk::Offset3D();
-    resolve.extent = vk::Extent3D(m_size.x, m_size.y, 1);
-    cmd_resolve->resolveImage(*m_fb_img, vk::ImageLayout::eGeneral,
-        *m_resolved_img, vk::ImageLayout::eTransferDstOptimal, resolve);
-
-    imb.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-    imb.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-    imb.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-    imb.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    cmd_resolve->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader,
-        {}, 0, nullptr, 0, nullptr, 1, &imb);
-
-    cmd_resolve->end();
-
-    // transition layout
-
-    vk::UniqueCommandBuffer cmd = std::move(m_dev->allocateCommandBuffersUnique(
-        { *cmd_pool, vk::CommandBufferLevel::ePrimary, 1 }).front());
-    debug_name(cmd, "RenderTarget::create_resolver::cmd");
-
-    cmd->begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+    return m_samples != vk::SampleCountFlagBits::e1 ? m_resolved_state : m_fb_state;
+}
+
+void RenderTarget::add_clear_pass(RenderGraph& graph, glm::vec4 color)
+{
+    vk::ClearColorValue value(std::array<float, 4>{ color.r, color.g, color.b, color.a });
+    graph.add_pass("clear", { RenderGraph::transfer_dst(m_fb_state, true) }, [this, value](vk::CommandBuffer cmd) {
+        cmd.clearColorImage(*m_fb_img, vk::ImageLayout::eTransferDstOptimal, value, m_fb_state.range);
+    });
+    if (m_samples != vk::SampleCountFlagBits::e1)
+    {
+        // cheaper than resolving the whole canvas, nothing is left to resolve
+        graph.add_pass("clear resolved", { RenderGraph::transfer_dst(m_resolved_state, true) },
+            [this, value](vk::CommandBuffer cmd) {
+                cmd.clearColorImage(*m_resolved_img, vk::ImageLayout::eTransferDstOptimal, value, m_resolved_state.range);
+            });
+    }
+    for (auto& mip : m_mip_states)
     {
-        vk::ImageMemoryBarrier imb;
-        imb.srcAccessMask = {};
-        imb.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-        imb.oldLayout = vk::ImageLayout::eUndefined;
-        imb.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-        imb.srcQueueFamilyIndex = imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        imb.image = *m_resolved_img;
-        imb.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
-        cmd->pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eFragmentShader,
-            {}, 0, nullptr, 0, nullptr, 1, &imb);
+        graph.add_pass("clear mip", { RenderGraph::transfer_dst(mip, true) }, [&mip, value](vk::CommandBuffer cmd) {
+            cmd.clearColorImage(mip.image, vk::ImageLayout::eTransferDstOptimal, value, mip.range);
+        });
     }
-    cmd->end();
+    std::fill(m_dirty_tiles.begin(), m_dirty_tiles.end(), 0);
+    m_dirty_count = 0;
+}
 
-    vk::SubmitInfo si;
-    si.commandBufferCount = 1;
-    si.pCommandBuffers = &cmd.get();
-    vk::UniqueFence submit_fence = m_dev->createFenceUnique(vk::FenceCreateInfo());
-    cmd_queue.submit(si, *submit_fence);
-    m_dev->waitForFences(*submit_fence, true, UINT64_MAX);
+void RenderTarget::mark_dirty(const DirtyRect& r)
+{
+    DirtyRect c = r.clamp(m_size);
+    if (c.empty())
+        return;
+    glm::ivec2 t0 = c.min / dirty_tile_size;
+    glm::ivec2 t1 = (c.max + dirty_tile_size - 1) / dirty_tile_size;
+    for (int y = t0.y; y < t1.y; y++)
+    {
+        for (int x = t0.x; x < t1.x; x++)
+        {
+            uint32_t i = y * m_tiles.x + x;
+            uint64_t bit = 1ull << (i % 64);
+            if (!(m_dirty_tiles[i / 64] & bit))
+            {
+                m_dirty_tiles[i / 64] |= bit;
+                m_dirty_count++;
+            }
+        }
+    }
+}
 
-    return true;
+std::vector<DirtyRect> RenderTarget::take_dirty_rects()
+{
+    // runs of dirty tiles along each row, in tiles. A run with the same
+    // columns as one of the row above extends it instead of adding a rect.
+    auto dirty = [this](int x, int y) {
+        uint32_t i = y * m_tiles.x + x;
+        return (m_dirty_tiles[i / 64] >> (i % 64)) & 1;
+    };
+    std::vector<glm::ivec4> runs;
+    std::vector<size_t> open, row_open;
+    for (int y = 0; y < m_tiles.y; y++)
+    {
+        row_open.clear();
+        for (int x = 0; x < m_tiles.x; x++)
+        {
+            if (!dirty(x, y))
+                continue;
+            int x0 = x;
+            while (x < m_tiles.x && dirty(x, y))
+                x++;
+            auto it = std::find_if(open.begin(), open.end(),
+                [&](size_t r) { return runs[r].x == x0 && runs[r].z == x; });
+            if (it != open.end())
+            {
+                runs[*it].w = y + 1;
+                row_open.push_back(*it);
+            }
+            else
+            {
+                row_open.push_back(runs.size());
+                runs.emplace_back(x0, y, x, y + 1);
+            }
+        }
+        open.swap(row_open);
+    }
+    std::fill(m_dirty_tiles.begin(), m_dirty_tiles.end(), 0);
+    m_dirty_count = 0;
+
+    std::vector<DirtyRect> rects(runs.size());
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        rects[i].add(glm::ivec2(runs[i].x, runs[i].y) * dirty_tile_size,
+            glm::ivec2(runs[i].z, runs[i].w) * dirty_tile_size);
+        rects[i] = rects[i].clamp(m_size);
+    }
+    return rects;
+}
+
+DirtyRect RenderTarget::add_update_pass(RenderGraph& graph)
+{
+    DirtyRect updated;
+    if (m_dirty_count == 0)
+        return updated;
+    std::vector<DirtyRect> rects = take_dirty_rects();
+    for (const auto& r : rects)
+        updated.add(r);
+
+    if (m_samples != vk::SampleCountFlagBits::e1)
+    {
+        std::vector<vk::ImageResolve> regions;
+        regions.reserve(rects.size());
+        for (const auto& r : rects)
+        {
+            vk::ImageResolve resolve;
+            resolve.srcSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+            resolve.srcOffset = vk::Offset3D(r.min.x, r.min.y, 0);
+            resolve.dstSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+            resolve.dstOffset = resolve.srcOffset;
+            resolve.extent = vk::Extent3D(r.max.x - r.min.x, r.max.y - r.min.y, 1);
+            regions.push_back(resolve);
+        }
+        // the tiles not resolved keep their content
+        graph.add_pass("resolve", { RenderGraph::transfer_src(m_fb_state), RenderGraph::transfer_dst(m_resolved_state, false) },
+            [this, regions = std::move(regions)](vk::CommandBuffer cmd) {
+                cmd.resolveImage(*m_fb_img, vk::ImageLayout::eTransferSrcOptimal,
+                    *m_resolved_img, vk::ImageLayout::eTransferDstOptimal, regions);
+            });
+    }
+
+    // every level from the one above, only the texels over the dirty rects.
+    // The rects are halved outwards, their source is the 2x2 texels block
+    // the linear filter averages.
+    ImageState* src = &display_state();
+    glm::ivec2 src_size = m_size;
+    for (uint32_t level = 1; level < m_mip_levels; level++)
+    {
+        glm::ivec2 dst_size = glm::max(src_size / 2, glm::ivec2(1));
+        for (auto& r : rects)
+        {
+            r.min = r.min / 2;
+            r.max = (r.max + 1) / 2;
+            r = r.clamp(dst_size);
+        }
+        merge_overlaps(rects);
+
+        std::vector<vk::ImageBlit> blits;
+        blits.reserve(rects.size());
+        for (const auto& r : rects)
+        {
+            glm::ivec2 src_max = glm::min(r.max * 2, src_size);
+            vk::ImageBlit blit;
+            blit.srcSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level - 1, 0, 1);
+            blit.srcOffsets[0] = vk::Offset3D(r.min.x * 2, r.min.y * 2, 0);
+            blit.srcOffsets[1] = vk::Offset3D(src_max.x, src_max.y, 1);
+            blit.dstSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+            blit.dstOffsets[0] = vk::Offset3D(r.min.x, r.min.y, 0);
+            blit.dstOffsets[1] = vk::Offset3D(r.max.x, r.max.y, 1);
+            blits.push_back(blit);
+        }
+        ImageState& dst = m_mip_states[level - 1];
+        graph.add_pass("mip", { RenderGraph::transfer_src(*src), RenderGraph::transfer_dst(dst, false) },
+            [&dst, blits = std::move(blits)](vk::CommandBuffer cmd) {
+                cmd.blitImage(dst.image, vk::ImageLayout::eTransferSrcOptimal,
+                    dst.image, vk::ImageLayout::eTransferDstOptimal, blits, vk::Filter::eLinear);
+            });
+        src = &dst;
+        src_size = dst_size;
+    }
+    return updated;
+}
+
+void RenderTarget::add_display_pass(RenderGraph& graph)
+{
+    std::vector<RenderGraph::use_t> uses = { RenderGraph::sampled(display_state()) };
+    for (auto& mip : m_mip_states)
+        uses.push_back(RenderGraph::sampled(mip));
+    graph.add_pass("display", uses);
+}
+
+void RenderTarget::add_copy_pass(RenderGraph& graph, vk::Buffer buffer)
+{
+    ImageState& src = display_state();
+    vk::BufferImageCopy bic;
+    bic.bufferOffset = 0;
+    bic.bufferRowLength = m_size.x;
+    bic.bufferImageHeight = m_size.y;
+    bic.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    bic.imageOffset = vk::Offset3D();
+    bic.imageExtent = vk::Extent3D(m_size.x, m_size.y, 1);
+    graph.add_pass("copy", { RenderGraph::transfer_src(src) }, [&src, buffer, bic](vk::CommandBuffer cmd) {
+        cmd.copyImageToBuffer(src.image, vk::ImageLayout::eTransferSrcOptimal, buffer, bic);
+        // the fence makes the copy available, not visible to the host
+        vk::BufferMemoryBarrier bmb(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead,
+            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, buffer, 0, VK_WHOLE_SIZE);
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
+            {}, nullptr, bmb, nullptr);
+    });
 }
@@ -1,36 +1,88 @@
 #pragma once
+#include "rendergraph.h"
 
 class RenderTarget
 {
-    bool create_framebuffer(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev);
+    bool create_framebuffer(MemoryAllocator& allocator, const vk::UniqueDevice& dev);
+    bool create_batch_pipeline(const vk::UniqueDevice& dev);
+    bool create_segment_pipeline(const vk::UniqueDevice& dev);
+    bool create_compute_pipeline(const vk::UniqueDevice& dev);
+    // level 0 of the image the display samples
+    ImageState& display_state();
+    // the dirty tiles as rects in pixels, clears the bitmap
+    std::vector<DirtyRect> take_dirty_rects();
 public:
-    vk::UniqueDescriptorSetLayout m_descr_layout;
-    vk::UniquePipelineLayout m_layout;
-    vk::UniquePipeline m_pipeline;
+    // instanced dabs pipeline, see CmdRenderStrokeBatch
+    vk::UniqueDescriptorSetLayout m_batch_descr_layout;
+    vk::UniquePipelineLayout m_batch_layout;
+    vk::UniquePipeline m_batch_pipeline;
+    // single sample only, edges and brush antialiased in the fragment shader
+    vk::UniquePipeline m_batch_pipeline_aa;
+    vk::UniqueShaderModule m_batch_shader_vert;
+    vk::UniqueShaderModule m_batch_shader_frag;
 
-    vk::UniqueShaderModule m_shader_vert;
-    vk::UniqueShaderModule m_shader_frag;
+    // capsule segments pipeline, see CmdRenderStrokeSegments
+    vk::UniquePipelineLayout m_segment_layout;
+    vk::UniquePipeline m_segment_pipeline;
+    vk::UniqueShaderModule m_segment_shader_vert;
+    vk::UniqueShaderModule m_segment_shader_frag;
+
+    // compute stroke backend, see CmdRenderStrokeCompute
+    vk::UniqueDescriptorSetLayout m_compute_descr_layout;
+    vk::UniquePipelineLayout m_compute_layout;
+    vk::UniquePipeline m_bin_pipeline;
+    vk::UniquePipeline m_raster_pipeline;
+    vk::UniqueShaderModule m_bin_shader;
+    vk::UniqueShaderModule m_raster_shader;
+    bool m_compute_supported = false;
 
     vk::UniqueImage m_fb_img;
     vk::UniqueImage m_resolved_img;
     vk::UniqueImageView m_fb_view;
     vk::UniqueImageView m_resolved_view;
-    vk::UniqueDeviceMemory m_fb_mem;
-    vk::UniqueDeviceMemory m_resolved_mem;
+    // m_resolved_img when multisampled, m_fb_img otherwise, all the levels
+    vk::UniqueImageView m_display_view;
+    Allocation m_fb_mem;
+    Allocation m_resolved_mem;
     vk::UniqueRenderPass m_renderpass;
     vk::UniqueFramebuffer m_framebuffer;
-    vk::AccessFlags m_fb_access_mask;
-    vk::ImageLayout m_fb_layout;
-
-    vk::UniqueCommandBuffer cmd_resolve;
+    // used by the thread recording the stroke passes only
+    ImageState m_fb_state;
+    ImageState m_resolved_state;
+    // levels 1.. of the displayed image, level 0 is in m_fb_state or
+    // m_resolved_state
+    uint32_t m_mip_levels = 1;
+    std::vector<ImageState> m_mip_states;
+    // one bit per tile written since the last add_update_pass(), row major.
+    // Used by the same thread as the states.
+    static constexpr int dirty_tile_size = 64;
+    glm::ivec2 m_tiles = { 0, 0 };
+    std::vector<uint64_t> m_dirty_tiles;
+    uint32_t m_dirty_count = 0;
 
     glm::ivec2 m_size;
     vk::SampleCountFlagBits m_samples;
     vk::Format m_format;
 
-    bool create(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev, int width, int height, vk::SampleCountFlagBits samples, vk::Format format);
-    bool create_resolver(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& cmd_pool, const vk::Queue& cmd_queue);
-    void to_layout(const vk::UniqueDevice& dev, const vk::UniqueCommandPool& cmd_pool, const vk::Queue& q,
-        vk::AccessFlags access_mask, vk::ImageLayout layout, vk::PipelineStageFlags src_stage, vk::PipelineStageFlags dst_stage);
-    void resolve(const vk::UniqueDevice& m_dev, const vk::UniqueCommandPool& cmd_pool, const vk::Queue& cmd_queue);
+    bool create(const vk::PhysicalDevice& pd, MemoryAllocator& allocator, const vk::UniqueDevice& dev, int width, int height, vk::SampleCountFlagBits samples, vk::Format format);
+    // fills the canvas with color, the resolved image and the mips too
+    void add_clear_pass(RenderGraph& graph, glm::vec4 color);
+    // canvas pixels written by a stroke pass
+    void mark_dirty(const DirtyRect& r);
+    bool needs_update() const { return m_dirty_count > 0; }
+    // brings the displayed image up to date for the dirty tiles only, as few
+    // rects as the rows allow: resolves them when multisampled, then blits
+    // them down the mip chain. Returns the bounds of what was updated, empty
+    // when nothing was dirty.
+    DirtyRect add_update_pass(RenderGraph& graph);
+    // the layout the display pass samples the canvas in
+    void add_display_pass(RenderGraph& graph);
+    vk::Format display_format() const
+    {
+        return m_samples != vk::SampleCountFlagBits::e1 ? vk::Format::eR8G8B8A8Unorm : m_format;
+    }
+    // copies level 0 of the displayed image to buffer, tightly packed texels
+    // the host reads once the submission is complete. Strokes get there with
+    // the update pass.
+    void add_copy_pass(RenderGraph& graph, vk::Buffer buffer);
 };
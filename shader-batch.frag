@@ -0,0 +1,53 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The canvas is never sampled here: the mix with the background is done by
+// the fixed function blender (src_alpha, one_minus_src_alpha) which keeps
+// the primitive order, so overlapping dabs of the same draw still mix in order.
+// one tip per layer, the mips follow the dab size on screen
+layout(binding = 0) uniform sampler2DArray tex_brush;
+
+// Single sample targets: the brush is supersampled over the pixel footprint
+// and the quad edges get an analytic coverage, in place of the MSAA resolve.
+layout(constant_id = 0) const bool ANALYTIC_AA = false;
+
+layout(location = 1) in vec2 ftex;
+layout(location = 2) in vec4 fcol;
+layout(location = 3) flat in uint ftip;
+
+layout(location = 0) out vec4 frag;
+
+// rotated grid, same pattern as the 4x MSAA standard sample positions
+const vec2 taps[4] = {
+    vec2( 0.125,  0.375),
+    vec2( 0.375, -0.125),
+    vec2(-0.125, -0.375),
+    vec2(-0.375,  0.125),
+};
+
+float edge_coverage(vec2 uv)
+{
+    // distance to the quad border in pixels, +0.5 centers the ramp on the edge
+    vec2 q = uv * 2.0 - 1.0;
+    vec2 c = clamp((1.0 - abs(q)) / max(fwidth(q), 1e-6) + 0.5, 0.0, 1.0);
+    return c.x * c.y;
+}
+
+void main()
+{
+    float brush_value;
+    if (ANALYTIC_AA)
+    {
+        vec2 dx = dFdx(ftex);
+        vec2 dy = dFdy(ftex);
+        float sum = 0.0;
+        for (int i = 0; i < 4; i++)
+            sum += texture(tex_brush, vec3(ftex + taps[i].x * dx + taps[i].y * dy, ftip)).r;
+        brush_value = (1.0 - sum * 0.25) * edge_coverage(ftex);
+    }
+    else
+    {
+        brush_value = 1.0 - texture(tex_brush, vec3(ftex, ftip)).r;
+    }
+    frag = vec4(fcol.rgb, fcol.a * brush_value);
+}
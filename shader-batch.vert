@@ -27,12 +27,19 @@ const vec2 vert_uvs[6] = {
     vec2(1.0, 0.0),
 };
 
-layout(binding = 0) uniform values { mat4 mvp; } ubo;
+// per-instance dab: xy = center in canvas space, z = scale, w = pressure
+layout(location = 0) in vec4 dab;
+layout(location = 1) in vec3 dab_col;
+layout(location = 2) in uint dab_tip;
 
 layout(location = 1) out vec2 ftex;
+layout(location = 2) out vec4 fcol;
+layout(location = 3) flat out uint ftip;
 
 void main()
 {
-    gl_Position = ubo.mvp * vec4(vert_pos[gl_VertexIndex], 0.0, 1.0);
+    gl_Position = vec4(dab.xy + vert_pos[gl_VertexIndex] * dab.z, 0.0, 1.0);
     ftex = vert_uvs[gl_VertexIndex];
+    fcol = vec4(dab_col, dab.w);
+    ftip = dab_tip;
 }
@@ -27,11 +27,11 @@ const vec2 vert_uvs[6] = {
     vec2(1.0, 0.0),
 };
 
-layout(binding = 0) uniform values { mat4 mvp; } ubo;
+layout(push_constant) uniform push_values { mat4 mvp; } push;
 layout(location = 1) out vec2 ftex;
 
 void main()
 {
-    gl_Position = ubo.mvp * vec4(vert_pos[gl_VertexIndex], 0.0, 1.0);
+    gl_Position = push.mvp * vec4(vert_pos[gl_VertexIndex], 0.0, 1.0);
     ftex = vert_uvs[gl_VertexIndex];
 }
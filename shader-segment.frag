@@ -0,0 +1,45 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Coverage of a tapered capsule from its signed distance, mixed with the
+// canvas by the blender like shader-batch.frag. Consecutive segments overlap
+// around their joint, blending both coverages there would darken the edge
+// into beads: the stroke gets the max of the two instead.
+layout(push_constant) uniform push_values { vec2 half_size; } push;
+
+layout(location = 1) in vec2 fpos;
+layout(location = 2) flat in vec4 fseg;
+layout(location = 3) flat in vec2 fradius;
+layout(location = 4) flat in vec4 fcol;
+layout(location = 5) flat in vec4 fprev;
+
+layout(location = 0) out vec4 frag;
+
+// distances in pixels so the edge is one pixel wide at any zoom
+float capsule(vec2 p, vec2 a, vec2 b, vec2 radius)
+{
+    vec2 ab = b - a;
+    float len2 = dot(ab, ab);
+    float t = len2 > 0.0 ? clamp(dot(p - a, ab) / len2, 0.0, 1.0) : 0.0;
+    float r = mix(radius.x, radius.y, t) * min(push.half_size.x, push.half_size.y);
+    float d = length(p - (a + ab * t)) - r;
+    return clamp(0.5 - d, 0.0, 1.0);
+}
+
+void main()
+{
+    vec2 p = fpos * push.half_size;
+    vec2 a = fseg.xy * push.half_size;
+    vec2 b = fseg.zw * push.half_size;
+    float coverage = capsule(p, a, b, fradius);
+    float alpha = fcol.a * coverage;
+    if (fprev.w > 0.0)
+    {
+        // the previous segment was blended with alpha * prev, this one only
+        // adds what brings the pixel to alpha * max(coverage, prev)
+        float prev = capsule(p, fprev.xy * push.half_size, a, vec2(fprev.z, fradius.x));
+        float under = 1.0 - fcol.a * prev;
+        alpha = under > 0.0 ? fcol.a * max(coverage - prev, 0.0) / under : 0.0;
+    }
+    frag = vec4(fcol.rgb, alpha);
+}
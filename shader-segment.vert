@@ -0,0 +1,52 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Quad covering a tapered capsule: x runs along the segment from a - r to
+// b + r, y across it by +-r, where r is the larger radius plus one pixel.
+const vec2 vert_pos[6] = {
+    // triangle ABC
+    vec2(0.0, 1.0),
+    vec2(0.0, 0.0),
+    vec2(1.0, 0.0),
+    // triangle ACD
+    vec2(0.0, 1.0),
+    vec2(1.0, 0.0),
+    vec2(1.0, 1.0),
+};
+
+// per-instance segment: xy = start, zw = end in canvas space
+layout(location = 0) in vec4 seg;
+// x = start radius, y = end radius in canvas space
+layout(location = 1) in vec2 seg_radius;
+layout(location = 2) in vec4 seg_col;
+// xy = start of the previous segment of the stroke, z = its radius there,
+// w = 0 for the first segment of a stroke
+layout(location = 3) in vec4 seg_prev;
+
+// pixels per canvas unit
+layout(push_constant) uniform push_values { vec2 half_size; } push;
+
+layout(location = 1) out vec2 fpos;
+layout(location = 2) flat out vec4 fseg;
+layout(location = 3) flat out vec2 fradius;
+layout(location = 4) flat out vec4 fcol;
+layout(location = 5) flat out vec4 fprev;
+
+void main()
+{
+    vec2 a = seg.xy;
+    vec2 b = seg.zw;
+    float len = length(b - a);
+    vec2 dir = len > 0.0 ? (b - a) / len : vec2(1.0, 0.0);
+    vec2 nrm = vec2(-dir.y, dir.x);
+    float r = max(seg_radius.x, seg_radius.y) + 1.0 / min(push.half_size.x, push.half_size.y);
+
+    vec2 q = vert_pos[gl_VertexIndex];
+    vec2 p = a + dir * mix(-r, len + r, q.x) + nrm * mix(-r, r, q.y);
+    gl_Position = vec4(p, 0.0, 1.0);
+    fpos = p;
+    fseg = seg;
+    fradius = seg_radius;
+    fcol = seg_col;
+    fprev = seg_prev;
+}
@@ -0,0 +1,49 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Display of the sparse canvas: the page of the fragment is looked up in the
+// page table, pages never painted show the paper color. The sampler filters
+// inside a page only, texels next to a page border are filtered here from
+// the texels of the neighbor pages.
+layout(constant_id = 0) const int PAGE_SIZE = 256;
+layout(constant_id = 1) const int PAGES_X = 64;
+layout(constant_id = 2) const int PAGES_Y = 64;
+
+layout(binding = 1) uniform sampler2DArray pool;
+layout(std430, binding = 2) readonly buffer pages_buffer { int page_slot[]; };
+
+layout(location = 1) in vec2 ftex;
+
+layout(location = 0) out vec4 frag;
+
+// canvas texel p, clamped to the edge of the canvas like the sampler
+vec4 texel(ivec2 p)
+{
+    p = clamp(p, ivec2(0), ivec2(PAGES_X, PAGES_Y) * PAGE_SIZE - 1);
+    ivec2 page = p / PAGE_SIZE;
+    int slot = page_slot[page.y * PAGES_X + page.x];
+    if (slot < 0)
+        return vec4(1.0);
+    return texelFetch(pool, ivec3(p - page * PAGE_SIZE, slot), 0);
+}
+
+void main()
+{
+    ivec2 pages = ivec2(PAGES_X, PAGES_Y);
+    vec2 pix = ftex * vec2(pages * PAGE_SIZE);
+    ivec2 page = clamp(ivec2(pix) / PAGE_SIZE, ivec2(0), pages - 1);
+    // the 2x2 texels of the bilinear filter
+    vec2 center = pix - 0.5;
+    ivec2 p0 = ivec2(floor(center));
+    ivec2 local = p0 - page * PAGE_SIZE;
+    if (all(greaterThanEqual(local, ivec2(0))) && all(lessThan(local, ivec2(PAGE_SIZE - 1))))
+    {
+        int slot = page_slot[page.y * PAGES_X + page.x];
+        vec2 uv = (pix - vec2(page * PAGE_SIZE)) / float(PAGE_SIZE);
+        frag = slot < 0 ? vec4(1.0) : texture(pool, vec3(uv, float(slot)));
+        return;
+    }
+    vec2 f = center - vec2(p0);
+    frag = mix(mix(texel(p0), texel(p0 + ivec2(1, 0)), f.x),
+        mix(texel(p0 + ivec2(0, 1)), texel(p0 + ivec2(1, 1)), f.x), f.y);
+}
@@ -0,0 +1,116 @@
+// Console test of SpscQueue without a window or a device: an ordering stress
+// run on a small ring that is full and empty all the time, then the
+// throughput with the app's ring size for a few push batch sizes.
+// Exits with 1 when an item is lost, duplicated or out of order.
+#include "spscqueue.h"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <random>
+#include <vector>
+
+// as large as a stroke sample, payload derived from seq to catch torn copies
+struct item_t
+{
+    uint64_t seq;
+    float payload[4];
+};
+
+static item_t make_item(uint64_t seq)
+{
+    float f = (float)(seq & 0xffff);
+    return { seq, { f, f + 1.f, f + 2.f, f + 3.f } };
+}
+
+static bool check_item(const item_t& item, uint64_t expected)
+{
+    item_t ref = make_item(expected);
+    return item.seq == ref.seq && std::equal(item.payload, item.payload + 4, ref.payload);
+}
+
+// the producer pushes count items in random batches, the consumer pops in
+// random batches and sleeps in wait() whenever the ring is empty. Returns
+// the items per second seen by the consumer, 0 on a mismatch.
+template<uint32_t N>
+static double run(uint64_t count, uint32_t max_push, uint32_t max_pop, bool random_batches)
+{
+    auto queue = std::make_unique<SpscQueue<item_t, N>>();
+    std::atomic_bool done = false;
+    std::atomic_bool ok = true;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&] {
+        std::mt19937 rng(2);
+        std::vector<item_t> popped(max_pop);
+        uint64_t expected = 0;
+        while (expected < count)
+        {
+            uint32_t max = random_batches ? rng() % max_pop + 1 : max_pop;
+            uint32_t n = queue->pop(popped.data(), max);
+            if (n == 0)
+            {
+                queue->wait([&] { return done.load(); });
+                continue;
+            }
+            for (uint32_t i = 0; i < n; i++, expected++)
+            {
+                if (!check_item(popped[i], expected))
+                {
+                    std::printf("mismatch at %llu: got seq %llu\n", (unsigned long long)expected,
+                        (unsigned long long)popped[i].seq);
+                    ok = false;
+                    done = true;
+                    return;
+                }
+            }
+        }
+    });
+
+    std::mt19937 rng(1);
+    uint64_t next = 0;
+    while (next < count && ok)
+    {
+        uint32_t batch = random_batches ? rng() % max_push + 1 : max_push;
+        batch = (uint32_t)std::min<uint64_t>(batch, count - next);
+        uint32_t n = queue->push(batch, [&](uint32_t i) { return make_item(next + i); });
+        next += n;
+        // full: the input thread would keep the rest for the next event
+        if (n < batch)
+            std::this_thread::yield();
+    }
+    done = true;
+    queue->wake();
+    consumer.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // nothing left behind the last item
+    item_t extra;
+    if (ok && queue->pop(&extra, 1) != 0)
+    {
+        std::printf("item past the end: seq %llu\n", (unsigned long long)extra.seq);
+        ok = false;
+    }
+    return ok ? count / elapsed.count() : 0.0;
+}
+
+int main()
+{
+    bool ok = true;
+
+    std::printf("stress: ordering with a 64 items ring\n");
+    for (uint32_t round = 0; round < 4 && ok; round++)
+        ok = run<64>(2'000'000, 48, 48, true) > 0.0;
+
+    std::printf("throughput: %u items ring\n", 1u << 16);
+    for (uint32_t batch : { 1u, 16u, 256u, 4096u })
+    {
+        if (!ok)
+            break;
+        double rate = run<1 << 16>(20'000'000, batch, 4096, false);
+        ok = rate > 0.0;
+        std::printf("  push batch %4u: %7.1f M items/s\n", batch, rate / 1e6);
+    }
+
+    std::printf(ok ? "passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+
+// Bounded single producer / single consumer queue with preallocated storage.
+// The producer and consumer indices live on separate cache lines and push()
+// never blocks or allocates. The consumer sleeps with WaitOnAddress on a
+// signal word that is bumped only when it announced it was waiting.
+// Self contained (Synchronization.lib), spscbench.cpp tests it alone.
+template<typename T, uint32_t N>
+class SpscQueue
+{
+    static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+    static constexpr size_t cache_line = 64;
+
+    // written by the producer
+    alignas(cache_line) std::atomic<uint32_t> m_tail{ 0 };
+    uint32_t m_head_cache = 0;
+    // written by the consumer
+    alignas(cache_line) std::atomic<uint32_t> m_head{ 0 };
+    std::atomic<uint32_t> m_waiting{ 0 };
+    std::atomic<uint32_t> m_signal{ 0 };
+    alignas(cache_line) std::array<T, N> m_items;
+public:
+    static constexpr uint32_t capacity = N;
+
+    // producer: pushes up to count items produced by get(i), returns how many
+    // fit, the caller keeps the rest for the next call
+    template<typename F>
+    uint32_t push(uint32_t count, F&& get)
+    {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if (N - (tail - m_head_cache) < count)
+            m_head_cache = m_head.load(std::memory_order_acquire);
+        uint32_t n = std::min(count, N - (tail - m_head_cache));
+        for (uint32_t i = 0; i < n; i++)
+            m_items[(tail + i) & (N - 1)] = get(i);
+        if (n == 0)
+            return 0;
+        // seq_cst pairs with the consumer store of m_waiting in wait()
+        m_tail.store(tail + n, std::memory_order_seq_cst);
+        if (m_waiting.load(std::memory_order_seq_cst))
+        {
+            m_signal.fetch_add(1, std::memory_order_seq_cst);
+            WakeByAddressSingle(&m_signal);
+        }
+        return n;
+    }
+
+    // consumer: pops up to max items in out, never blocks
+    uint32_t pop(T* out, uint32_t max)
+    {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        uint32_t tail = m_tail.load(std::memory_order_acquire);
+        uint32_t n = std::min(max, tail - head);
+        for (uint32_t i = 0; i < n; i++)
+            out[i] = m_items[(head + i) & (N - 1)];
+        m_head.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+    }
+
+    // consumer: sleeps until there is something to pop, or until wake() is
+    // called and stop() returns true, may also return spuriously
+    template<typename F>
+    void wait(F&& stop)
+    {
+        uint32_t signal = m_signal.load(std::memory_order_seq_cst);
+        m_waiting.store(1, std::memory_order_seq_cst);
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        uint32_t tail = m_tail.load(std::memory_order_seq_cst);
+        // WaitOnAddress returns at once if m_signal moved since it was read
+        if (tail == head && !stop())
+            WaitOnAddress(&m_signal, &signal, sizeof(signal), INFINITE);
+        m_waiting.store(0, std::memory_order_relaxed);
+    }
+
+    // any thread: wakes the consumer, set the stop condition first
+    void wake()
+    {
+        m_signal.fetch_add(1, std::memory_order_seq_cst);
+        WakeByAddressAll(&m_signal);
+    }
+};
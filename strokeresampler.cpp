@@ -0,0 +1,92 @@
+#include "pch.h"
+#include "strokeresampler.h"
+
+void StrokeSamples::append(const StrokeSamples& s)
+{
+    x.insert(x.end(), s.x.begin(), s.x.end());
+    y.insert(y.end(), s.y.begin(), s.y.end());
+    pressure.insert(pressure.end(), s.pressure.begin(), s.pressure.end());
+    start.insert(start.end(), s.start.begin(), s.start.end());
+}
+
+void StrokeSamples::erase_front(size_t n)
+{
+    x.erase(x.begin(), x.begin() + n);
+    y.erase(y.begin(), y.begin() + n);
+    pressure.erase(pressure.begin(), pressure.begin() + n);
+    start.erase(start.begin(), start.begin() + n);
+}
+
+void StrokeSamples::transform(size_t first, const glm::mat4& m)
+{
+    // plain loops over the arrays, the compiler vectorizes them
+    const float m00 = m[0][0], m01 = m[0][1], m10 = m[1][0], m11 = m[1][1], m30 = m[3][0], m31 = m[3][1];
+    float* px = x.data();
+    float* py = y.data();
+    const size_t n = x.size();
+    for (size_t i = first; i < n; i++)
+    {
+        float sx = px[i];
+        float sy = py[i];
+        px[i] = m00 * sx + m10 * sy + m30;
+        py[i] = m01 * sx + m11 * sy + m31;
+    }
+}
+
+void StrokeResampler::begin(glm::vec2 pos, float pressure, const glm::mat4& px_to_canvas, StrokeSamples& out)
+{
+    size_t first = out.size();
+    out.push_back(pos, pressure, true);
+    out.transform(first, px_to_canvas);
+    m_last = pos;
+    m_last_pressure = pressure;
+    m_carry = 0.f;
+    m_active = true;
+}
+
+void StrokeResampler::move(glm::vec2 pos, float pressure, const glm::mat4& px_to_canvas, StrokeSamples& out)
+{
+    if (!m_active)
+    {
+        begin(pos, pressure, px_to_canvas, out);
+        return;
+    }
+    // window pixels are square in canvas space, one axis gives the scale
+    float px_size = glm::length(glm::vec2(px_to_canvas[0]));
+    size_t first = out.size();
+    resample(pos, pressure, px_size, out);
+    out.transform(first, px_to_canvas);
+}
+
+void StrokeResampler::resample(glm::vec2 pos, float pressure, float px_size, StrokeSamples& out)
+{
+    if (m_segments)
+    {
+        // sub-pixel moves would only add degenerate segments
+        if (glm::distance(pos, m_last) < 1.f)
+            return;
+        out.push_back(pos, pressure);
+        m_last = pos;
+        m_last_pressure = pressure;
+        return;
+    }
+    // the walk is in canvas units, only the points are in window pixels
+    glm::vec2 d = pos - m_last;
+    float len = glm::length(d) * px_size;
+    float t = 0.f;
+    float p = m_last_pressure;
+    while (len > 0.f)
+    {
+        float step = std::max(m_spacing * 2.f * m_radius * p, m_min_step * m_radius);
+        float need = step - m_carry;
+        if (t + need > len)
+            break;
+        t += need;
+        m_carry = 0.f;
+        p = glm::mix(m_last_pressure, pressure, t / len);
+        out.push_back(m_last + d * (t / len), p);
+    }
+    m_carry += len - t;
+    m_last = pos;
+    m_last_pressure = pressure;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "utils.h"
+
+// One sample as it crosses the input -> canvas queue (SpscQueue)
+struct StrokeSample
+{
+    float x;
+    float y;
+    float pressure;
+    uint32_t start;
+};
+
+// Stroke samples in SoA layout: positions and pressure live in separate
+// arrays so whole ranges can be transformed with vectorized loops.
+struct StrokeSamples
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> pressure;
+    std::vector<uint8_t> start; // 1 on the first sample of a stroke
+
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    void clear() { x.clear(); y.clear(); pressure.clear(); start.clear(); }
+    void push_back(glm::vec2 pos, float p, bool first = false)
+    {
+        x.push_back(pos.x);
+        y.push_back(pos.y);
+        pressure.push_back(p);
+        start.push_back(first);
+    }
+    StrokeSample get(size_t i) const { return { x[i], y[i], pressure[i], start[i] }; }
+    void push_back(const StrokeSample& s) { push_back({ s.x, s.y }, s.pressure, s.start != 0); }
+    void append(const StrokeSamples& s);
+    // drops the first n samples, keeps the storage
+    void erase_front(size_t n);
+    // applies the 2D affine part of m to the samples from first to the end
+    void transform(size_t first, const glm::mat4& m);
+};
+
+// Turns pointer events into dabs spaced by a fraction of the dab diameter in
+// canvas space, so the dab count follows brush size rather than zoom and
+// screen pixels. Pressure is interpolated along each segment.
+class StrokeResampler
+{
+    glm::vec2 m_last{ 0 };
+    float m_last_pressure = 0.f;
+    float m_carry = 0.f; // canvas units travelled since the last dab
+    bool m_active = false;
+    void resample(glm::vec2 pos, float pressure, float px_size, StrokeSamples& out);
+public:
+    // dab distance over dab diameter
+    float m_spacing = 0.25f;
+    // dab radius at full pressure in canvas units
+    float m_radius = 0.01f;
+    // dab distance floor over m_radius, so very light pressure does not
+    // flood the queue
+    float m_min_step = 0.2f;
+    // emit the input points instead of dabs, they are the ends of capsule
+    // segments (CmdRenderStrokeSegments)
+    bool m_segments = false;
+
+    // pos is in window pixels, px_to_canvas maps window pixels to canvas
+    // units, the samples are appended to out in canvas units
+    void begin(glm::vec2 pos, float pressure, const glm::mat4& px_to_canvas, StrokeSamples& out);
+    void move(glm::vec2 pos, float pressure, const glm::mat4& px_to_canvas, StrokeSamples& out);
+    void end() { m_active = false; }
+};
@@ -0,0 +1,145 @@
+#include "pch.h"
+#include "submitcontext.h"
+#include "debug_message.h"
+
+std::atomic<uint32_t> SubmitContext::s_created_fences = 0;
+std::atomic<uint32_t> SubmitContext::s_created_semaphores = 0;
+std::atomic<uint32_t> SubmitContext::s_created_command_buffers = 0;
+
+bool SubmitContext::create(const vk::UniqueDevice& dev, QueueArbiter& queues, QueueKind kind)
+{
+    m_dev = *dev;
+    m_queues = &queues;
+    m_kind = kind;
+    auto pool_info = vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient |
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queues.family(kind));
+    m_pool = dev->createCommandPoolUnique(pool_info);
+    debug_name(m_pool, "SubmitContext::m_pool");
+    return true;
+}
+
+vk::CommandBuffer SubmitContext::begin()
+{
+    if (m_free_cmds.empty())
+        done(m_next_id - 1);
+    if (m_free_cmds.empty())
+    {
+        auto cmd_info = vk::CommandBufferAllocateInfo(*m_pool, vk::CommandBufferLevel::ePrimary, 1);
+        m_cmds.push_back(std::move(m_dev.allocateCommandBuffersUnique(cmd_info).front()));
+        m_free_cmds.push_back(*m_cmds.back());
+        s_created_command_buffers++;
+    }
+    vk::CommandBuffer cmd = m_free_cmds.back();
+    m_free_cmds.pop_back();
+    // the pool has eResetCommandBuffer, begin() resets implicitly
+    cmd.begin({ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+    return cmd;
+}
+
+vk::Semaphore SubmitContext::semaphore()
+{
+    if (m_free_semaphores.empty())
+        done(m_next_id - 1);
+    if (m_free_semaphores.empty())
+    {
+        m_semaphores.push_back(m_dev.createSemaphoreUnique(vk::SemaphoreCreateInfo()));
+        m_free_semaphores.push_back(*m_semaphores.back());
+        s_created_semaphores++;
+    }
+    vk::Semaphore sem = m_free_semaphores.back();
+    m_free_semaphores.pop_back();
+    m_pending_semaphores.push_back(sem);
+    return sem;
+}
+
+void SubmitContext::release_semaphore(vk::Semaphore sem)
+{
+    auto it = std::find(m_pending_semaphores.begin(), m_pending_semaphores.end(), sem);
+    if (it == m_pending_semaphores.end())
+        return;
+    m_pending_semaphores.erase(it);
+    m_free_semaphores.push_back(sem);
+}
+
+uint64_t SubmitContext::submit(vk::SubmitInfo si, vk::CommandBuffer cmd)
+{
+    if (m_free_fences.empty())
+        done(m_next_id - 1);
+    if (m_free_fences.empty())
+    {
+        m_fences.push_back(m_dev.createFenceUnique(vk::FenceCreateInfo()));
+        m_free_fences.push_back(*m_fences.back());
+        s_created_fences++;
+    }
+    inflight_t s;
+    s.id = m_next_id++;
+    s.fence = m_free_fences.back();
+    s.cmd = cmd;
+    s.semaphores = std::move(m_pending_semaphores);
+    m_pending_semaphores.clear();
+    m_free_fences.pop_back();
+
+    QueueArbiter::op_t op;
+    op.kind = m_kind;
+    op.fence = s.fence;
+    op.submitted = &m_submitted;
+    op.id = s.id;
+    assert(si.commandBufferCount <= op.cmds.size() && si.waitSemaphoreCount <= op.wait.size() &&
+        si.signalSemaphoreCount <= op.signal.size());
+    op.cmd_count = si.commandBufferCount;
+    std::copy_n(si.pCommandBuffers, si.commandBufferCount, op.cmds.begin());
+    op.wait_count = si.waitSemaphoreCount;
+    std::copy_n(si.pWaitSemaphores, si.waitSemaphoreCount, op.wait.begin());
+    std::copy_n(si.pWaitDstStageMask, si.waitSemaphoreCount, op.wait_stages.begin());
+    op.signal_count = si.signalSemaphoreCount;
+    std::copy_n(si.pSignalSemaphores, si.signalSemaphoreCount, op.signal.begin());
+    m_queues->submit(op);
+    m_inflight.push_back(std::move(s));
+    return m_inflight.back().id;
+}
+
+uint64_t SubmitContext::submit(vk::CommandBuffer cmd)
+{
+    cmd.end();
+    vk::SubmitInfo si;
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &cmd;
+    return submit(si, cmd);
+}
+
+void SubmitContext::release(inflight_t& s)
+{
+    m_dev.resetFences(s.fence);
+    m_free_fences.push_back(s.fence);
+    if (s.cmd)
+        m_free_cmds.push_back(s.cmd);
+    m_free_semaphores.insert(m_free_semaphores.end(), s.semaphores.begin(), s.semaphores.end());
+    s.semaphores.clear();
+    m_completed = s.id;
+}
+
+bool SubmitContext::done(uint64_t id)
+{
+    // submissions complete in order on one queue, retire from the front. The
+    // ones the arbiter is still submitting are left alone.
+    uint64_t submitted = m_submitted.load(std::memory_order_acquire);
+    while (!m_inflight.empty() && m_inflight.front().id <= submitted &&
+        m_dev.getFenceStatus(m_inflight.front().fence) == vk::Result::eSuccess)
+    {
+        release(m_inflight.front());
+        m_inflight.pop_front();
+    }
+    return id <= m_completed;
+}
+
+void SubmitContext::wait(uint64_t id)
+{
+    // the fence is waited on once the arbiter is done submitting it
+    while (!m_inflight.empty() && m_inflight.front().id <= id)
+    {
+        QueueArbiter::wait_submitted(m_submitted, m_inflight.front().id);
+        m_dev.waitForFences(m_inflight.front().fence, true, UINT64_MAX);
+        release(m_inflight.front());
+        m_inflight.pop_front();
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "utils.h"
+#include "queuearbiter.h"
+
+// Submissions of one thread: command buffers come from a pool owned by the
+// context, fences and binary semaphores are recycled once the submission
+// that used them is complete. In steady state nothing is created, the
+// s_created_* counters count every Vulkan object made by any context.
+class SubmitContext
+{
+    struct inflight_t
+    {
+        uint64_t id;
+        vk::Fence fence;
+        vk::CommandBuffer cmd; // owned one-shot buffer or null
+        std::vector<vk::Semaphore> semaphores;
+    };
+    vk::Device m_dev;
+    QueueArbiter* m_queues = nullptr;
+    QueueKind m_kind = QueueKind::graphics;
+    vk::UniqueCommandPool m_pool;
+    std::vector<vk::UniqueCommandBuffer> m_cmds;
+    std::vector<vk::UniqueFence> m_fences;
+    std::vector<vk::UniqueSemaphore> m_semaphores;
+    std::vector<vk::CommandBuffer> m_free_cmds;
+    std::vector<vk::Fence> m_free_fences;
+    std::vector<vk::Semaphore> m_free_semaphores;
+    // semaphores handed out since the last submit, released with it
+    std::vector<vk::Semaphore> m_pending_semaphores;
+    std::deque<inflight_t> m_inflight;
+    // the last id the arbiter submitted, the fences after it are not polled
+    std::atomic<uint64_t> m_submitted{ 0 };
+    uint64_t m_next_id = 1;
+    uint64_t m_completed = 0;
+    void release(inflight_t& s);
+public:
+    static std::atomic<uint32_t> s_created_fences;
+    static std::atomic<uint32_t> s_created_semaphores;
+    static std::atomic<uint32_t> s_created_command_buffers;
+
+    // submits to the queue of kind through the arbiter, the command buffers
+    // come from the family of that queue
+    bool create(const vk::UniqueDevice& dev, QueueArbiter& queues, QueueKind kind);
+    QueueKind kind() const { return m_kind; }
+    QueueArbiter& queues() const { return *m_queues; }
+    // a one-shot command buffer, already begun
+    vk::CommandBuffer begin();
+    // a binary semaphore valid until the next submit() completes
+    vk::Semaphore semaphore();
+    // gives back a semaphore() nothing signaled, e.g. after a failed acquire
+    void release_semaphore(vk::Semaphore sem);
+    // posts si with a recycled fence, cmd is a buffer from begin() that is
+    // recycled with it, returns the id to wait on. The arrays of si are
+    // copied, at most 4 command buffers and 2 wait/signal semaphores.
+    uint64_t submit(vk::SubmitInfo si, vk::CommandBuffer cmd = nullptr);
+    // ends and submits a buffer from begin()
+    uint64_t submit(vk::CommandBuffer cmd);
+    bool done(uint64_t id);
+    void wait(uint64_t id);
+    void wait_idle() { wait(last_id()); }
+    uint64_t last_id() const { return m_next_id - 1; }
+    // records with a one-shot buffer, submits and waits
+    template<typename F>
+    void run(F&& record)
+    {
+        vk::CommandBuffer cmd = begin();
+        record(cmd);
+        wait(submit(cmd));
+    }
+};
@@ -1,13 +1,23 @@
 #pragma once
 #include "utils.h"
 
+// A sampled image, its content is uploaded by TextureStreamer. layers 0 is a
+// plain 2D texture, 1 or more a 2D array (viewed as an array even with one).
 class Texture
 {
 public:
     vk::UniqueImage m_img;
     vk::UniqueImageView m_view;
-    vk::UniqueDeviceMemory m_mem;
+    Allocation m_mem;
+    glm::ivec2 m_size;
+    vk::Format m_format = vk::Format::eR8G8B8A8Unorm;
+    uint32_t m_levels = 1;
+    uint32_t m_layers = 0;
 
-    bool create(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev, const vk::Queue& q, 
-        const vk::UniqueCommandPool& cmd_pool, const std::filesystem::path& path);
+    bool create(MemoryAllocator& allocator, const vk::UniqueDevice& dev, glm::ivec2 size,
+        vk::Format format = vk::Format::eR8G8B8A8Unorm, uint32_t levels = 1, uint32_t layers = 0);
+    vk::ImageSubresourceRange range() const
+    {
+        return vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, m_levels, 0, std::max(m_layers, 1u));
+    }
 };
@@ -0,0 +1,409 @@
+#include "pch.h"
+#include "texturestreamer.h"
+#include "queuearbiter.h"
+#include "debug_message.h"
+
+bool TextureStreamer::create(MemoryAllocator& allocator, const vk::UniqueDevice& dev, QueueArbiter& queues,
+    QueueKind consumer, vk::DeviceSize ring_size, uint32_t decoders)
+{
+    m_allocator = &allocator;
+    m_dev = &dev;
+    m_upload.create(dev, queues, QueueKind::transfer);
+    m_consumer.create(dev, queues, consumer);
+
+    // staging ring, mapped for the whole lifetime of the streamer
+    m_ring_size = ring_size;
+    m_ring_head = m_ring_used = 0;
+    auto buf_info = vk::BufferCreateInfo({}, m_ring_size, vk::BufferUsageFlagBits::eTransferSrc);
+    m_ring_buffer = dev->createBufferUnique(buf_info);
+    debug_name(m_ring_buffer, "TextureStreamer::m_ring_buffer");
+    m_ring_memory = allocator.bind(m_ring_buffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+
+    if (decoders == 0)
+        decoders = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+    m_running = true;
+    for (uint32_t i = 0; i < decoders; i++)
+        m_decoders.emplace_back(&TextureStreamer::decoder_main, this);
+    m_uploader = std::thread(&TextureStreamer::uploader_main, this);
+
+    // one texel, the only load the caller waits for
+    m_placeholder = load({ 1, 1 }, { 255, 255, 255, 255 });
+    wait(m_placeholder);
+    return ready(m_placeholder);
+}
+
+void TextureStreamer::destroy()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+    m_jobs_cv.notify_all();
+    m_ring_cv.notify_all();
+    m_decoded_cv.notify_all();
+    for (auto& t : m_decoders)
+        t.join();
+    m_decoders.clear();
+    // finishes the batch in flight
+    m_uploader.join();
+
+    std::lock_guard lock(m_mutex);
+    for (auto& h : m_jobs)
+        h->state = State::failed;
+    for (auto& part : m_decoded)
+        part.h->state = State::failed;
+    m_jobs.clear();
+    m_decoded.clear();
+    m_ready_cv.notify_all();
+}
+
+TextureStreamer::handle_t TextureStreamer::load(const std::filesystem::path& path)
+{
+    auto h = std::make_shared<request_t>();
+    h->path = path;
+    return enqueue(std::move(h));
+}
+
+TextureStreamer::handle_t TextureStreamer::load(glm::ivec2 size, std::vector<uint8_t> pixels)
+{
+    auto h = std::make_shared<request_t>();
+    h->size = size;
+    h->pixels = std::move(pixels);
+    if (h->pixels.size() != size.x * size.y * 4ull)
+        throw std::runtime_error("TextureStreamer: rgba8 pixels do not match the size");
+    return enqueue(std::move(h));
+}
+
+TextureStreamer::handle_t TextureStreamer::load_raw(glm::ivec2 size, vk::Format format, uint32_t levels,
+    uint32_t layers, const uint8_t* data, size_t bytes)
+{
+    auto h = std::make_shared<request_t>();
+    h->size = size;
+    h->format = format;
+    h->levels = levels;
+    h->layers = layers;
+    h->data = data;
+    if (raw_layout(size, format, levels, layers, h->level_offsets) != bytes)
+        throw std::runtime_error("TextureStreamer: raw texels do not match the size");
+    return enqueue(std::move(h));
+}
+
+vk::DeviceSize TextureStreamer::texel_size(vk::Format format)
+{
+    switch (format)
+    {
+    case vk::Format::eR8G8B8A8Unorm:
+        return 4;
+    case vk::Format::eR8Unorm:
+        return 1;
+    default:
+        throw std::runtime_error("TextureStreamer: unsupported format " + vk::to_string(format));
+    }
+}
+
+vk::DeviceSize TextureStreamer::raw_layout(glm::ivec2 size, vk::Format format, uint32_t levels, uint32_t layers,
+    std::vector<vk::DeviceSize>& level_offsets)
+{
+    vk::DeviceSize texel = texel_size(format);
+    level_offsets.resize(levels);
+    vk::DeviceSize bytes = 0;
+    for (uint32_t level = 0; level < levels; level++)
+    {
+        glm::ivec2 sz = glm::max(size >> (int)level, glm::ivec2(1));
+        level_offsets[level] = bytes;
+        bytes += (sz.x * sz.y * std::max(layers, 1u) * texel + 15) / 16 * 16;
+    }
+    return bytes;
+}
+
+TextureStreamer::handle_t TextureStreamer::enqueue(handle_t h)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_running)
+        {
+            h->state = State::failed;
+            return h;
+        }
+        m_jobs.push_back(h);
+    }
+    m_jobs_cv.notify_one();
+    return h;
+}
+
+void TextureStreamer::fail(const handle_t& h, const std::string& why)
+{
+    std::cout << fmt::format("TextureStreamer: {}\n", why);
+    std::lock_guard lock(m_mutex);
+    h->state = State::failed;
+    m_ready_cv.notify_all();
+}
+
+bool TextureStreamer::stage(part_t part, const uint8_t* src, vk::DeviceSize bytes)
+{
+    // waits for the uploads to give the ring back
+    {
+        std::unique_lock lock(m_mutex);
+        m_ring_cv.wait(lock, [&] { return !m_running || ring_alloc(bytes, part.offset); });
+        if (!m_running)
+        {
+            part.h->state = State::failed;
+            m_ready_cv.notify_all();
+            return false;
+        }
+    }
+    std::copy_n(src, bytes, static_cast<uint8_t*>(m_ring_memory.m_ptr) + part.offset);
+    {
+        std::lock_guard lock(m_mutex);
+        m_decoded.push_back(std::move(part));
+    }
+    m_decoded_cv.notify_one();
+    return true;
+}
+
+void TextureStreamer::wait(const handle_t& h)
+{
+    std::unique_lock lock(m_mutex);
+    m_ready_cv.wait(lock, [&] { return h->state != State::pending; });
+}
+
+const vk::UniqueImageView& TextureStreamer::view(const handle_t& h) const
+{
+    return ready(h) ? h->tex.m_view : m_placeholder->tex.m_view;
+}
+
+bool TextureStreamer::ring_alloc(vk::DeviceSize bytes, vk::DeviceSize& offset)
+{
+    // offsets stay texel and optimalBufferCopyOffsetAlignment friendly
+    bytes = (bytes + 15) / 16 * 16;
+    vk::DeviceSize start = m_ring_head;
+    vk::DeviceSize pad = 0;
+    if (start + bytes > m_ring_size)
+    {
+        // does not fit before the end, wrap and skip the end
+        pad = m_ring_size - start;
+        start = 0;
+    }
+    if (m_ring_used + pad + bytes > m_ring_size)
+        return false;
+    m_ring_ranges.push_back({ start, pad + bytes, false });
+    m_ring_head = (start + bytes) % m_ring_size;
+    m_ring_used += pad + bytes;
+    offset = start;
+    return true;
+}
+
+void TextureStreamer::ring_free(vk::DeviceSize offset)
+{
+    // live ranges never share an offset
+    for (auto& r : m_ring_ranges)
+    {
+        if (!r.done && r.offset == offset)
+        {
+            r.done = true;
+            break;
+        }
+    }
+    while (!m_ring_ranges.empty() && m_ring_ranges.front().done)
+    {
+        m_ring_used -= m_ring_ranges.front().size;
+        m_ring_ranges.pop_front();
+    }
+    if (m_ring_ranges.empty())
+        m_ring_head = m_ring_used = 0;
+}
+
+void TextureStreamer::decoder_main()
+{
+    while (true)
+    {
+        handle_t h;
+        {
+            std::unique_lock lock(m_mutex);
+            m_jobs_cv.wait(lock, [&] { return !m_running || !m_jobs.empty(); });
+            if (!m_running)
+                return;
+            h = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        std::unique_ptr<uint8_t, decltype(&stbi_image_free)> decoded(nullptr, stbi_image_free);
+        const uint8_t* src = h->data;
+        if (!src && !h->pixels.empty())
+            src = h->pixels.data();
+        if (!src)
+        {
+            int comp;
+            decoded.reset(stbi_load(h->path.string().c_str(), &h->size.x, &h->size.y, &comp, 4));
+            src = decoded.get();
+            if (!src || glm::any(glm::equal(h->size, { 0, 0 })))
+            {
+                fail(h, fmt::format("could not load {}", h->path.string()));
+                continue;
+            }
+        }
+        vk::DeviceSize bytes = raw_layout(h->size, h->format, h->levels, h->layers, h->level_offsets);
+        uint32_t layers = std::max(h->layers, 1u);
+        if (bytes <= m_ring_size)
+        {
+            // decoded pixels lack the padding of the layout, which is a single level
+            vk::DeviceSize src_bytes = h->data ? bytes : h->size.x * h->size.y * 4ull;
+            if (!stage({ h, 0, 0, h->levels, 0, layers, true, true }, src, src_bytes))
+                return;
+            h->pixels = {};
+            continue;
+        }
+
+        // a level at a time, as many layers as half the ring holds: the
+        // upload of a part runs while the next one is copied
+        vk::DeviceSize texel = texel_size(h->format);
+        vk::DeviceSize largest = (vk::DeviceSize)h->size.x * h->size.y * texel;
+        if (!h->data || largest > m_ring_size / 2)
+        {
+            fail(h, fmt::format("{} is larger than the staging ring", h->path.string()));
+            continue;
+        }
+        bool stopped = false;
+        for (uint32_t level = 0; level < h->levels && !stopped; level++)
+        {
+            glm::ivec2 sz = glm::max(h->size >> (int)level, glm::ivec2(1));
+            vk::DeviceSize layer_bytes = sz.x * sz.y * texel;
+            uint32_t step = (uint32_t)std::min<vk::DeviceSize>(layers, m_ring_size / 2 / layer_bytes);
+            for (uint32_t first = 0; first < layers && !stopped; first += step)
+            {
+                uint32_t n = std::min(step, layers - first);
+                bool last = level + 1 == h->levels && first + n == layers;
+                const uint8_t* part_src = src + h->level_offsets[level] + first * layer_bytes;
+                stopped = !stage({ h, 0, level, 1, first, n, level == 0 && first == 0, last }, part_src,
+                    n * layer_bytes);
+            }
+        }
+        if (stopped)
+            return;
+    }
+}
+
+void TextureStreamer::uploader_main()
+{
+    std::vector<part_t> batch;
+    while (true)
+    {
+        {
+            std::unique_lock lock(m_mutex);
+            m_decoded_cv.wait(lock, [&] { return !m_running || !m_decoded.empty(); });
+            if (!m_running)
+                break;
+            // everything decoded while the previous batch was uploading
+            batch.swap(m_decoded);
+        }
+        upload(batch);
+        batch.clear();
+    }
+}
+
+void TextureStreamer::upload(const std::vector<part_t>& batch)
+{
+    std::vector<ImageHandoff> handoffs;
+    std::vector<vk::ImageMemoryBarrier> imbs;
+    handoffs.reserve(batch.size());
+    imbs.reserve(batch.size());
+    for (const auto& part : batch)
+    {
+        const auto& h = part.h;
+        // the parts of a texture after the first write it in the transfer
+        // layout it was left in, the last one hands it over
+        if (part.first)
+        {
+            h->tex.create(*m_allocator, *m_dev, h->size, h->format, h->levels, h->layers);
+            vk::ImageMemoryBarrier imb;
+            imb.srcAccessMask = vk::AccessFlags();
+            imb.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+            imb.oldLayout = vk::ImageLayout::eUndefined;
+            imb.newLayout = vk::ImageLayout::eTransferDstOptimal;
+            imb.srcQueueFamilyIndex = imb.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imb.image = *h->tex.m_img;
+            imb.subresourceRange = h->tex.range();
+            imbs.push_back(imb);
+        }
+        // both the raster and the compute strokes sample the brushes
+        if (part.last)
+        {
+            handoffs.emplace_back(m_upload.queues(), m_upload.kind(), m_consumer.kind(), *h->tex.m_img,
+                vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+                vk::AccessFlagBits::eTransferWrite, vk::PipelineStageFlagBits::eTransfer,
+                vk::AccessFlagBits::eShaderRead,
+                vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader,
+                h->tex.range());
+        }
+    }
+
+    vk::CommandBuffer cmd = m_upload.begin();
+    if (!imbs.empty())
+    {
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+            {}, 0, nullptr, 0, nullptr, (uint32_t)imbs.size(), imbs.data());
+    }
+    std::vector<vk::BufferImageCopy> copies;
+    for (const auto& part : batch)
+    {
+        const auto& h = part.h;
+        // one copy per level, all the layers of the part at once
+        copies.clear();
+        for (uint32_t level = part.level; level < part.level + part.levels; level++)
+        {
+            glm::ivec2 sz = glm::max(h->size >> (int)level, glm::ivec2(1));
+            vk::BufferImageCopy bic;
+            bic.bufferOffset = part.offset + h->level_offsets[level] - h->level_offsets[part.level];
+            bic.bufferRowLength = sz.x;
+            bic.bufferImageHeight = sz.y;
+            bic.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level,
+                part.first_layer, part.layers);
+            bic.imageOffset = vk::Offset3D();
+            bic.imageExtent = vk::Extent3D(sz.x, sz.y, 1);
+            copies.push_back(bic);
+        }
+        cmd.copyBufferToImage(*m_ring_buffer, *h->tex.m_img, vk::ImageLayout::eTransferDstOptimal, copies);
+    }
+    for (const auto& handoff : handoffs)
+        handoff.release(cmd);
+
+    if (handoffs.empty() || handoffs.front().same_family)
+    {
+        m_upload.wait(m_upload.submit(cmd));
+    }
+    else
+    {
+        cmd.end();
+        vk::Semaphore copied = m_upload.semaphore();
+        vk::SubmitInfo si;
+        si.commandBufferCount = 1;
+        si.pCommandBuffers = &cmd;
+        si.signalSemaphoreCount = 1;
+        si.pSignalSemaphores = &copied;
+        uint64_t upload_id = m_upload.submit(si, cmd);
+
+        vk::CommandBuffer acquire_cmd = m_consumer.begin();
+        for (const auto& handoff : handoffs)
+            handoff.acquire(acquire_cmd);
+        acquire_cmd.end();
+        vk::PipelineStageFlags wait_stage = handoffs.front().dst_stage;
+        si = vk::SubmitInfo(1, &copied, &wait_stage, 1, &acquire_cmd);
+        m_consumer.wait(m_consumer.submit(si, acquire_cmd));
+        m_upload.wait(upload_id);
+    }
+
+    {
+        std::lock_guard lock(m_mutex);
+        for (const auto& part : batch)
+        {
+            ring_free(part.offset);
+            if (part.last)
+                part.h->state = State::ready;
+        }
+    }
+    m_ring_cv.notify_all();
+    m_ready_cv.notify_all();
+}
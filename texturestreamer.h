@@ -0,0 +1,122 @@
+#pragma once
+#include "utils.h"
+#include "texture.h"
+#include "submitcontext.h"
+
+/*
+Loads textures without blocking the caller. Decoder threads run stbi_load and
+copy the pixels in a persistently mapped staging ring, the upload thread
+records everything decoded since its last batch in one command buffer on the
+transfer queue and hands the images to the consumer queue. load() returns at
+once with a handle to poll (ready()) or wait on, view() gives a 1x1 white
+placeholder until the texture is there or when loading failed. load_raw()
+takes texels already in their final format, mips and array layers included,
+e.g. from a memory mapped file: the decoders only copy them in the ring, and
+when they do not fit they go in parts of a level and a few layers, each
+uploaded as the ring has room for it.
+*/
+class TextureStreamer
+{
+public:
+    enum class State : uint32_t { pending, ready, failed };
+    struct request_t
+    {
+        std::filesystem::path path;
+        // raw rgba8 pixels instead of a file, see load(size, pixels)
+        std::vector<uint8_t> pixels;
+        // not owned, see load_raw()
+        const uint8_t* data = nullptr;
+        vk::Format format = vk::Format::eR8G8B8A8Unorm;
+        uint32_t levels = 1;
+        uint32_t layers = 0;
+        std::atomic<State> state{ State::pending };
+        // valid once ready
+        Texture tex;
+        glm::ivec2 size = { 0, 0 };
+        std::vector<vk::DeviceSize> level_offsets;
+    };
+    using handle_t = std::shared_ptr<request_t>;
+private:
+    // a staging ring range, from the decoder to the upload: the whole
+    // texture, or the layers [first_layer, first_layer + layers) of level
+    struct part_t
+    {
+        handle_t h;
+        vk::DeviceSize offset;
+        uint32_t level;
+        uint32_t levels;
+        uint32_t first_layer;
+        uint32_t layers;
+        // the upload creating the image, the one handing it to the consumer
+        bool first;
+        bool last;
+    };
+    struct range_t
+    {
+        vk::DeviceSize offset;
+        vk::DeviceSize size; // including the padding skipped to wrap
+        bool done;
+    };
+    MemoryAllocator* m_allocator = nullptr;
+    const vk::UniqueDevice* m_dev = nullptr;
+    SubmitContext m_upload;
+    SubmitContext m_consumer;
+
+    vk::UniqueBuffer m_ring_buffer;
+    Allocation m_ring_memory;
+    vk::DeviceSize m_ring_size = 0;
+    vk::DeviceSize m_ring_head = 0;
+    vk::DeviceSize m_ring_used = 0;
+    // in allocation order, the tail moves past the ranges done at the front
+    std::deque<range_t> m_ring_ranges;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobs_cv;
+    std::condition_variable m_ring_cv;
+    std::condition_variable m_decoded_cv;
+    std::condition_variable m_ready_cv;
+    std::deque<handle_t> m_jobs;
+    std::vector<part_t> m_decoded;
+    bool m_running = false;
+    std::vector<std::thread> m_decoders;
+    std::thread m_uploader;
+    handle_t m_placeholder;
+
+    handle_t enqueue(handle_t h);
+    void fail(const handle_t& h, const std::string& why);
+    // copies bytes of src in the ring as the part of h, false when stopped
+    bool stage(part_t part, const uint8_t* src, vk::DeviceSize bytes);
+    // under m_mutex
+    bool ring_alloc(vk::DeviceSize bytes, vk::DeviceSize& offset);
+    void ring_free(vk::DeviceSize offset);
+    void decoder_main();
+    void uploader_main();
+    void upload(const std::vector<part_t>& batch);
+public:
+    ~TextureStreamer() { destroy(); }
+
+    // consumer: the queue sampling the textures. decoders 0 picks from the
+    // number of cores.
+    bool create(MemoryAllocator& allocator, const vk::UniqueDevice& dev, QueueArbiter& queues,
+        QueueKind consumer, vk::DeviceSize ring_size = 32 << 20, uint32_t decoders = 0);
+    // pending requests fail, waits for the upload in flight
+    void destroy();
+
+    handle_t load(const std::filesystem::path& path);
+    handle_t load(glm::ivec2 size, std::vector<uint8_t> pixels);
+    // data is laid out as raw_layout() says and is not copied: the caller
+    // keeps it until the handle is ready or failed. Formats: rgba8 and r8.
+    handle_t load_raw(glm::ivec2 size, vk::Format format, uint32_t levels, uint32_t layers,
+        const uint8_t* data, size_t bytes);
+    // level by level from the largest, the layers of a level one after the
+    // other, every level 16 bytes aligned. Returns the total size.
+    static vk::DeviceSize raw_layout(glm::ivec2 size, vk::Format format, uint32_t levels, uint32_t layers,
+        std::vector<vk::DeviceSize>& level_offsets);
+    static vk::DeviceSize texel_size(vk::Format format);
+    static bool ready(const handle_t& h) { return h->state == State::ready; }
+    // blocks until h is ready or failed
+    void wait(const handle_t& h);
+    // the texture once ready, the placeholder before. The view stays valid
+    // as long as the handle.
+    const vk::UniqueImageView& view(const handle_t& h) const;
+};
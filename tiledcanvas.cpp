@@ -0,0 +1,453 @@
+#include "pch.h"
+#include "tiledcanvas.h"
+#include "utils.h"
+#include "debug_message.h"
+#include "CmdRenderStrokeCompute.h"
+#include "submitcontext.h"
+
+void TiledCanvas::create_pool(MemoryAllocator& allocator, const vk::UniqueDevice& dev, uint32_t slots)
+{
+    // pages pool, one layer per page
+    vk::ImageCreateInfo img_info;
+    img_info.imageType = vk::ImageType::e2D;
+    img_info.format = m_format;
+    img_info.extent = vk::Extent3D(page_size, page_size, 1);
+    img_info.mipLevels = 1;
+    img_info.arrayLayers = slots;
+    img_info.samples = vk::SampleCountFlagBits::e1;
+    img_info.tiling = vk::ImageTiling::eOptimal;
+    img_info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
+        vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc;
+    img_info.sharingMode = vk::SharingMode::eExclusive;
+    img_info.initialLayout = vk::ImageLayout::eUndefined;
+    m_pool_img = dev->createImageUnique(img_info);
+    debug_name(m_pool_img, "TiledCanvas::m_pool_img");
+    m_pool_mem = allocator.bind(m_pool_img, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    vk::ImageViewCreateInfo view_info;
+    view_info.image = *m_pool_img;
+    view_info.viewType = vk::ImageViewType::e2DArray;
+    view_info.format = img_info.format;
+    view_info.components = { cs::eR, cs::eG, cs::eB, cs::eA };
+    view_info.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, slots);
+    m_pool_view = dev->createImageViewUnique(view_info);
+    debug_name(m_pool_view, "TiledCanvas::m_pool_view");
+}
+
+bool TiledCanvas::create(MemoryAllocator& allocator, const vk::UniqueDevice& dev, SubmitContext& submit,
+    int width, int height, uint32_t max_layers, const vk::UniqueRenderPass& display_renderpass)
+{
+    m_size = { width, height };
+    m_pages = (m_size + glm::ivec2(page_size - 1)) / glm::ivec2(page_size);
+    m_max_slots = std::min(max_layers, (uint32_t)(m_pages.x * m_pages.y));
+    m_slots = std::min(pool_slots, m_max_slots);
+    create_pool(allocator, dev, m_slots);
+
+    // page table, written by the CPU when a page is allocated
+    vk::DeviceSize pages_bytes = sizeof(int32_t) * m_pages.x * m_pages.y;
+    auto buf_info = vk::BufferCreateInfo({}, pages_bytes, vk::BufferUsageFlagBits::eStorageBuffer);
+    m_pages_buffer = dev->createBufferUnique(buf_info);
+    debug_name(m_pages_buffer, "TiledCanvas::m_pages_buffer");
+    m_pages_mem = allocator.bind(m_pages_buffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    m_page_slot = static_cast<int32_t*>(m_pages_mem.m_ptr);
+    clear();
+
+    // the pool lives in eGeneral: written as storage image, sampled by the display
+    m_pool_state.reset(*m_pool_img, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, m_slots),
+        "TiledCanvas::m_pool_img");
+    RenderGraph graph;
+    auto init = RenderGraph::storage(m_pool_state);
+    init.discard = true;
+    graph.add_pass("pool init", { init });
+    submit.run([&](vk::CommandBuffer cmd) { graph.execute(cmd); });
+
+    vk::SamplerCreateInfo sampler_info;
+    sampler_info.magFilter = vk::Filter::eLinear;
+    sampler_info.minFilter = vk::Filter::eLinear;
+    sampler_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    sampler_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    sampler_info.maxLod = 0.f;
+    m_sampler = dev->createSamplerUnique(sampler_info);
+
+    create_compute_pipeline(dev);
+    create_display_pipeline(dev, display_renderpass);
+
+    return true;
+}
+
+bool TiledCanvas::fits(const DirtyRect& r)
+{
+    DirtyRect area = r.clamp(m_size);
+    if (area.empty())
+        return true;
+
+    std::lock_guard lock(m_mutex);
+    size_t missing = 0;
+    glm::ivec2 pmin = area.min / page_size;
+    glm::ivec2 pmax = (area.max - 1) / page_size;
+    for (int y = pmin.y; y <= pmax.y; y++)
+    {
+        for (int x = pmin.x; x <= pmax.x; x++)
+            missing += m_page_slot[y * m_pages.x + x] < 0;
+    }
+    return missing <= m_free_slots.size();
+}
+
+bool TiledCanvas::grow(MemoryAllocator& allocator, const vk::UniqueDevice& dev, SubmitContext& submit)
+{
+    uint32_t old_slots = m_slots;
+    uint32_t new_slots = std::min(old_slots * 2, m_max_slots);
+    if (new_slots <= old_slots)
+        return false;
+
+    vk::UniqueImage old_img = std::move(m_pool_img);
+    vk::UniqueImageView old_view = std::move(m_pool_view);
+    Allocation old_mem = std::move(m_pool_mem);
+    try
+    {
+        create_pool(allocator, dev, new_slots);
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cout << "canvas pages pool: " << e.what() << "\n";
+        m_pool_img = std::move(old_img);
+        m_pool_view = std::move(old_view);
+        m_pool_mem = std::move(old_mem);
+        return false;
+    }
+
+    // the layers keep their index, the page table stays valid
+    ImageState grown;
+    grown.reset(*m_pool_img, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, new_slots),
+        "TiledCanvas::m_pool_img");
+    auto dst = RenderGraph::use_t{ &grown, vk::ImageLayout::eGeneral, vk::AccessFlagBits::eTransferWrite,
+        vk::PipelineStageFlagBits::eTransfer, true };
+    auto src = RenderGraph::use_t{ &m_pool_state, vk::ImageLayout::eGeneral, vk::AccessFlagBits::eTransferRead,
+        vk::PipelineStageFlagBits::eTransfer };
+    vk::ImageCopy region(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, old_slots), {},
+        vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, old_slots), {},
+        vk::Extent3D(page_size, page_size, 1));
+    vk::Image old_pool = *old_img, new_pool = *m_pool_img;
+    RenderGraph graph;
+    graph.add_pass("pool grow", { src, dst }, [old_pool, new_pool, region](vk::CommandBuffer cmd) {
+        cmd.copyImage(old_pool, vk::ImageLayout::eGeneral, new_pool, vk::ImageLayout::eGeneral, region);
+    });
+    submit.run([&](vk::CommandBuffer cmd) { graph.execute(cmd); });
+    m_pool_state = grown;
+
+    // the free layers left are handed out before the new ones
+    std::vector<uint32_t> added(new_slots - old_slots);
+    for (uint32_t i = 0; i < added.size(); i++)
+        added[i] = new_slots - 1 - i;
+    std::lock_guard lock(m_mutex);
+    m_free_slots.insert(m_free_slots.begin(), added.begin(), added.end());
+    m_slots = new_slots;
+    m_used_slots.store(m_slots - (uint32_t)m_free_slots.size(), std::memory_order_relaxed);
+    return true;
+}
+
+bool TiledCanvas::touch(const DirtyRect& r)
+{
+    DirtyRect area = r.clamp(m_size);
+    if (area.empty())
+        return true;
+
+    std::lock_guard lock(m_mutex);
+    bool ok = true;
+    glm::ivec2 pmin = area.min / page_size;
+    glm::ivec2 pmax = (area.max - 1) / page_size;
+    for (int y = pmin.y; y <= pmax.y; y++)
+    {
+        for (int x = pmin.x; x <= pmax.x; x++)
+        {
+            int32_t& slot = m_page_slot[y * m_pages.x + x];
+            if (slot >= 0)
+                continue;
+            if (m_free_slots.empty())
+            {
+                ok = false;
+                continue;
+            }
+            slot = m_free_slots.back();
+            m_free_slots.pop_back();
+            m_pending_clear.push_back(slot);
+        }
+    }
+    m_used_slots.store(m_slots - (uint32_t)m_free_slots.size(), std::memory_order_relaxed);
+    return ok;
+}
+
+void TiledCanvas::record_clears(vk::CommandBuffer cmd)
+{
+    std::lock_guard lock(m_mutex);
+    if (m_pending_clear.empty())
+        return;
+
+    std::vector<vk::ImageSubresourceRange> ranges;
+    ranges.reserve(m_pending_clear.size());
+    for (uint32_t slot : m_pending_clear)
+        ranges.emplace_back(vk::ImageAspectFlagBits::eColor, 0, 1, slot, 1);
+    m_pending_clear.clear();
+
+    vk::ClearColorValue paper(std::array<float, 4>{ m_paper.r, m_paper.g, m_paper.b, m_paper.a });
+    cmd.clearColorImage(*m_pool_img, vk::ImageLayout::eGeneral, paper, ranges);
+
+    vk::MemoryBarrier mb;
+    mb.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    mb.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eFragmentShader,
+        {}, mb, nullptr, nullptr);
+}
+
+void TiledCanvas::add_display_pass(RenderGraph& graph)
+{
+    graph.add_pass("display", { { &m_pool_state, vk::ImageLayout::eGeneral,
+        vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eFragmentShader } });
+}
+
+void TiledCanvas::clear()
+{
+    std::lock_guard lock(m_mutex);
+    std::fill_n(m_page_slot, m_pages.x * m_pages.y, -1);
+    m_pending_clear.clear();
+    m_free_slots.resize(m_slots);
+    for (uint32_t i = 0; i < m_slots; i++)
+        m_free_slots[i] = m_slots - 1 - i;
+    m_used_slots.store(0, std::memory_order_relaxed);
+}
+
+bool TiledCanvas::painted_page(int32_t slot) const
+{
+    // allocated by touch() but not cleared yet, the layer holds garbage
+    return slot >= 0 && std::find(m_pending_clear.begin(), m_pending_clear.end(), (uint32_t)slot) ==
+        m_pending_clear.end();
+}
+
+DirtyRect TiledCanvas::painted()
+{
+    DirtyRect r;
+    std::lock_guard lock(m_mutex);
+    for (int y = 0; y < m_pages.y; y++)
+    {
+        for (int x = 0; x < m_pages.x; x++)
+        {
+            if (painted_page(m_page_slot[y * m_pages.x + x]))
+                r.add(glm::ivec2(x, y) * page_size, glm::ivec2(x + 1, y + 1) * page_size);
+        }
+    }
+    return r.clamp(m_size);
+}
+
+void TiledCanvas::add_copy_pass(RenderGraph& graph, vk::Buffer buffer, const DirtyRect& area)
+{
+    glm::ivec2 sz = area.max - area.min;
+    std::vector<vk::BufferImageCopy> regions;
+    {
+        std::lock_guard lock(m_mutex);
+        glm::ivec2 pmin = area.min / page_size;
+        glm::ivec2 pmax = (area.max - 1) / page_size;
+        for (int y = pmin.y; y <= pmax.y; y++)
+        {
+            for (int x = pmin.x; x <= pmax.x; x++)
+            {
+                int32_t slot = m_page_slot[y * m_pages.x + x];
+                if (!painted_page(slot))
+                    continue;
+                // the part of the page inside area, at its place in the rows
+                glm::ivec2 p0 = glm::max(glm::ivec2(x, y) * page_size, area.min);
+                glm::ivec2 p1 = glm::min(glm::ivec2(x + 1, y + 1) * page_size, area.max);
+                glm::ivec2 dst = p0 - area.min;
+                glm::ivec2 src = p0 - glm::ivec2(x, y) * page_size;
+                vk::BufferImageCopy bic;
+                bic.bufferOffset = ((vk::DeviceSize)dst.y * sz.x + dst.x) * 4;
+                bic.bufferRowLength = sz.x;
+                bic.bufferImageHeight = sz.y;
+                bic.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, slot, 1);
+                bic.imageOffset = vk::Offset3D(src.x, src.y, 0);
+                bic.imageExtent = vk::Extent3D(p1.x - p0.x, p1.y - p0.y, 1);
+                regions.push_back(bic);
+            }
+        }
+    }
+    glm::u8vec4 paper = glm::u8vec4(glm::round(glm::clamp(m_paper, 0.f, 1.f) * 255.f));
+    uint32_t fill;
+    std::memcpy(&fill, &paper, sizeof(fill));
+    vk::Image pool = *m_pool_img;
+    graph.add_pass("copy pages", { { &m_pool_state, vk::ImageLayout::eGeneral,
+        vk::AccessFlagBits::eTransferRead, vk::PipelineStageFlagBits::eTransfer } },
+        [pool, buffer, fill, regions](vk::CommandBuffer cmd) {
+            // the paper under the pages never painted, the copies overwrite the rest
+            cmd.fillBuffer(buffer, 0, VK_WHOLE_SIZE, fill);
+            vk::BufferMemoryBarrier fill_bmb(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferWrite,
+                VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, buffer, 0, VK_WHOLE_SIZE);
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer,
+                {}, nullptr, fill_bmb, nullptr);
+            if (!regions.empty())
+                cmd.copyImageToBuffer(pool, vk::ImageLayout::eGeneral, buffer, regions);
+            // the fence makes the copy available, not visible to the host
+            vk::BufferMemoryBarrier bmb(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead,
+                VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, buffer, 0, VK_WHOLE_SIZE);
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
+                {}, nullptr, bmb, nullptr);
+        });
+}
+
+bool TiledCanvas::create_compute_pipeline(const vk::UniqueDevice& dev)
+{
+    m_bin_shader = load_shader(dev, "shader-bin.comp.spv");
+    m_raster_shader = load_shader(dev, "shader-raster.comp.sparse.spv");
+
+    std::array<vk::DescriptorSetLayoutBinding, 5> pipeline_layout_bind = {
+        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageImage, // pages pool
+            1, vk::ShaderStageFlagBits::eCompute, nullptr),
+        vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eCombinedImageSampler, // tex_brush
+            1, vk::ShaderStageFlagBits::eCompute, nullptr),
+        // dynamic: the range of the slot is given when binding, see ComputeStrokeSet
+        vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBufferDynamic, // dabs
+            1, vk::ShaderStageFlagBits::eCompute, nullptr),
+        vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageBufferDynamic, // tiles mask
+            1, vk::ShaderStageFlagBits::eCompute, nullptr),
+        vk::DescriptorSetLayoutBinding(4, vk::DescriptorType::eStorageBuffer, // page table
+            1, vk::ShaderStageFlagBits::eCompute, nullptr),
+    };
+    vk::DescriptorSetLayoutCreateInfo descr_info;
+    descr_info.bindingCount = pipeline_layout_bind.size();
+    descr_info.pBindings = pipeline_layout_bind.data();
+    m_compute_descr_layout = dev->createDescriptorSetLayoutUnique(descr_info);
+    debug_name(m_compute_descr_layout, "TiledCanvas::m_compute_descr_layout");
+
+    vk::PushConstantRange push_range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CmdRenderStrokeCompute::push_t));
+    vk::PipelineLayoutCreateInfo layout_info;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &m_compute_descr_layout.get();
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    m_compute_layout = dev->createPipelineLayoutUnique(layout_info);
+    debug_name(m_compute_layout, "TiledCanvas::m_compute_layout");
+
+    std::array<uint32_t, 4> spec_values = { CmdRenderStrokeCompute::tile_size, CmdRenderStrokeCompute::mask_words,
+        (uint32_t)page_size, (uint32_t)m_pages.x };
+    std::array<vk::SpecializationMapEntry, 4> spec_entries = {
+        vk::SpecializationMapEntry(0, 0, sizeof(uint32_t)), // TILE_SIZE
+        vk::SpecializationMapEntry(1, sizeof(uint32_t), sizeof(uint32_t)), // MASK_WORDS
+        vk::SpecializationMapEntry(2, sizeof(uint32_t) * 2, sizeof(uint32_t)), // PAGE_SIZE
+        vk::SpecializationMapEntry(3, sizeof(uint32_t) * 3, sizeof(uint32_t)), // PAGES_X
+    };
+    vk::SpecializationInfo spec_info;
+    spec_info.mapEntryCount = spec_entries.size();
+    spec_info.pMapEntries = spec_entries.data();
+    spec_info.dataSize = sizeof(spec_values);
+    spec_info.pData = spec_values.data();
+
+    vk::ComputePipelineCreateInfo info;
+    info.layout = *m_compute_layout;
+    info.stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *m_bin_shader, "main", &spec_info);
+    m_bin_pipeline = dev->createComputePipelineUnique(nullptr, info);
+    debug_name(m_bin_pipeline, "TiledCanvas::m_bin_pipeline");
+
+    info.stage = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, *m_raster_shader, "main", &spec_info);
+    m_raster_pipeline = dev->createComputePipelineUnique(nullptr, info);
+    debug_name(m_raster_pipeline, "TiledCanvas::m_raster_pipeline");
+
+    return true;
+}
+
+bool TiledCanvas::create_display_pipeline(const vk::UniqueDevice& dev, const vk::UniqueRenderPass& renderpass)
+{
+    m_display_vert = load_shader(dev, "shader-fill.vert.spv");
+    m_display_frag = load_shader(dev, "shader-sparse.frag.spv");
+
+    std::array<uint32_t, 3> spec_values = { (uint32_t)page_size, (uint32_t)m_pages.x, (uint32_t)m_pages.y };
+    std::array<vk::SpecializationMapEntry, 3> spec_entries = {
+        vk::SpecializationMapEntry(0, 0, sizeof(uint32_t)), // PAGE_SIZE
+        vk::SpecializationMapEntry(1, sizeof(uint32_t), sizeof(uint32_t)), // PAGES_X
+        vk::SpecializationMapEntry(2, sizeof(uint32_t) * 2, sizeof(uint32_t)), // PAGES_Y
+    };
+    vk::SpecializationInfo spec_info;
+    spec_info.mapEntryCount = spec_entries.size();
+    spec_info.pMapEntries = spec_entries.data();
+    spec_info.dataSize = sizeof(spec_values);
+    spec_info.pData = spec_values.data();
+    std::array<vk::PipelineShaderStageCreateInfo, 2> stages = {
+        vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eVertex, *m_display_vert, "main"),
+        vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eFragment, *m_display_frag, "main", &spec_info),
+    };
+
+    // same bindings as App::m_descr_layout plus the page table, mvp is a push constant
+    std::array<vk::DescriptorSetLayoutBinding, 2> pipeline_layout_bind = {
+        vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eCombinedImageSampler, // pages pool
+            1, vk::ShaderStageFlagBits::eFragment, nullptr),
+        vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBuffer, // page table
+            1, vk::ShaderStageFlagBits::eFragment, nullptr),
+    };
+    vk::DescriptorSetLayoutCreateInfo descr_info;
+    descr_info.bindingCount = pipeline_layout_bind.size();
+    descr_info.pBindings = pipeline_layout_bind.data();
+    m_display_descr_layout = dev->createDescriptorSetLayoutUnique(descr_info);
+    debug_name(m_display_descr_layout, "TiledCanvas::m_display_descr_layout");
+
+    vk::PushConstantRange push_range(vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4));
+    vk::PipelineLayoutCreateInfo layout_info;
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &m_display_descr_layout.get();
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_range;
+    m_display_layout = dev->createPipelineLayoutUnique(layout_info);
+    debug_name(m_display_layout, "TiledCanvas::m_display_layout");
+
+    vk::PipelineVertexInputStateCreateInfo vertex_input;
+    vk::PipelineInputAssemblyStateCreateInfo input_assembly;
+    input_assembly.topology = vk::PrimitiveTopology::eTriangleList;
+
+    vk::PipelineViewportStateCreateInfo viewport;
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+
+    vk::PipelineRasterizationStateCreateInfo rasterization;
+    rasterization.polygonMode = vk::PolygonMode::eFill;
+    rasterization.cullMode = vk::CullModeFlagBits::eBack;
+    rasterization.frontFace = vk::FrontFace::eClockwise;
+    rasterization.lineWidth = 1.f;
+
+    vk::PipelineMultisampleStateCreateInfo multisample;
+    multisample.rasterizationSamples = vk::SampleCountFlagBits::e1;
+
+    vk::PipelineColorBlendAttachmentState blend_color;
+    blend_color.blendEnable = false;
+    blend_color.colorWriteMask = cc::eR | cc::eG | cc::eB | cc::eA;
+    vk::PipelineColorBlendStateCreateInfo blend;
+    blend.logicOpEnable = false;
+    blend.logicOp = vk::LogicOp::eCopy;
+    blend.attachmentCount = 1;
+    blend.pAttachments = &blend_color;
+
+    std::array<vk::DynamicState, 2> dyn_states = {
+        vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor,
+    };
+    vk::PipelineDynamicStateCreateInfo dyn;
+    dyn.dynamicStateCount = dyn_states.size();
+    dyn.pDynamicStates = dyn_states.data();
+
+    vk::GraphicsPipelineCreateInfo info;
+    info.stageCount = stages.size();
+    info.pStages = stages.data();
+    info.pVertexInputState = &vertex_input;
+    info.pInputAssemblyState = &input_assembly;
+    info.pViewportState = &viewport;
+    info.pRasterizationState = &rasterization;
+    info.pMultisampleState = &multisample;
+    info.pColorBlendState = &blend;
+    info.pDynamicState = &dyn;
+    info.layout = *m_display_layout;
+    info.renderPass = *renderpass;
+    info.subpass = 0;
+    m_display_pipeline = dev->createGraphicsPipelineUnique(nullptr, info);
+    debug_name(m_display_pipeline, "TiledCanvas::m_display_pipeline");
+
+    return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "utils.h"
+#include "rendergraph.h"
+
+class SubmitContext;
+
+/*
+Sparse canvas: the document is split in pages of page_size pixels, a page gets
+a layer of the pool image the first time a dab touches it. The page table maps
+page coordinates to pool layers (-1 = never painted) and is read by both the
+stroke compute pass and the display pass, so memory follows the painted area.
+*/
+class TiledCanvas
+{
+    // the page holds paint: allocated and cleared to the paper, call with m_mutex held
+    bool painted_page(int32_t slot) const;
+    // the pool image and view with slots layers, the old ones are replaced
+    void create_pool(MemoryAllocator& allocator, const vk::UniqueDevice& dev, uint32_t slots);
+    bool create_compute_pipeline(const vk::UniqueDevice& dev);
+    bool create_display_pipeline(const vk::UniqueDevice& dev, const vk::UniqueRenderPass& renderpass);
+public:
+    static constexpr int page_size = 256;
+    // layers of the pool at creation, it doubles when the pages need more
+    static constexpr uint32_t pool_slots = 256;
+
+    glm::ivec2 m_size;
+    glm::ivec2 m_pages;
+    vk::Format m_format = vk::Format::eR8G8B8A8Unorm;
+    glm::vec4 m_paper = glm::vec4(1);
+
+    vk::UniqueImage m_pool_img;
+    vk::UniqueImageView m_pool_view;
+    Allocation m_pool_mem;
+    // used by the thread recording the stroke passes only
+    ImageState m_pool_state;
+    vk::UniqueBuffer m_pages_buffer;
+    Allocation m_pages_mem;
+    int32_t* m_page_slot = nullptr;
+    std::vector<uint32_t> m_free_slots;
+    std::vector<uint32_t> m_pending_clear;
+    std::mutex m_mutex;
+    // layers of the pool and m_slots - m_free_slots.size(), read without
+    // m_mutex by the title
+    std::atomic<uint32_t> m_slots{ 0 };
+    std::atomic<uint32_t> m_used_slots{ 0 };
+    // the pool stops growing there: one layer per page, or the device limit
+    uint32_t m_max_slots = 0;
+
+    // stroke compute pipelines, see CmdRenderStrokeCompute
+    vk::UniqueDescriptorSetLayout m_compute_descr_layout;
+    vk::UniquePipelineLayout m_compute_layout;
+    vk::UniquePipeline m_bin_pipeline;
+    vk::UniquePipeline m_raster_pipeline;
+    vk::UniqueShaderModule m_bin_shader;
+    vk::UniqueShaderModule m_raster_shader;
+
+    // display pipeline, used by CmdRenderToScreen
+    vk::UniqueDescriptorSetLayout m_display_descr_layout;
+    vk::UniquePipelineLayout m_display_layout;
+    vk::UniquePipeline m_display_pipeline;
+    vk::UniqueShaderModule m_display_vert;
+    vk::UniqueShaderModule m_display_frag;
+    vk::UniqueSampler m_sampler;
+
+    // max_layers: maxImageArrayLayers of the device
+    bool create(MemoryAllocator& allocator, const vk::UniqueDevice& dev, SubmitContext& submit,
+        int width, int height, uint32_t max_layers, const vk::UniqueRenderPass& display_renderpass);
+    // the free layers are enough for the pages overlapping r
+    bool fits(const DirtyRect& r);
+    // doubles the pool layers, the painted ones are copied. No submission may
+    // use the pool, the descriptor sets of m_pool_view have to be written
+    // again. Returns false at m_max_slots or out of device memory.
+    bool grow(MemoryAllocator& allocator, const vk::UniqueDevice& dev, SubmitContext& submit);
+    // allocates the pages overlapping r, returns false when the pool is exhausted
+    bool touch(const DirtyRect& r);
+    // clears the layers allocated since the last call to the paper color
+    void record_clears(vk::CommandBuffer cmd);
+    // the pool never leaves eGeneral, the display samples it there
+    void add_display_pass(RenderGraph& graph);
+    // releases all the pages
+    void clear();
+    uint32_t slots() const { return m_slots.load(std::memory_order_relaxed); }
+    uint32_t used_slots() const { return m_used_slots.load(std::memory_order_relaxed); }
+    // bounding box of the painted pages, empty for a blank canvas
+    DirtyRect painted();
+    // copies area to buffer as tightly packed rgba8 rows, row 0 at the
+    // bottom. The pages not painted yet read as the paper.
+    void add_copy_pass(RenderGraph& graph, vk::Buffer buffer, const DirtyRect& area);
+};
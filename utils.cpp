@@ -2,16 +2,6 @@
 #include "utils.h"
 #include "debug_message.h"
 
-int find_memory(const vk::PhysicalDevice& pd, const vk::MemoryRequirements& req, vk::MemoryPropertyFlags flags)
-{
-    vk::PhysicalDeviceMemoryProperties mp = pd.getMemoryProperties();
-    for (int mem_i = 0; mem_i < mp.memoryTypeCount; mem_i++)
-        if ((1 << mem_i) & req.memoryTypeBits && (mp.memoryTypes[mem_i].propertyFlags & flags) == flags)
-            return mem_i;
-    throw std::runtime_error("find_memory failed");
-    return -1;
-}
-
 std::vector<glm::uint8_t> read_file(const std::filesystem::path& path)
 {
     std::ifstream ifs(path, std::ios::binary | std::ios::ate);
@@ -23,6 +13,45 @@ std::vector<glm::uint8_t> read_file(const std::filesystem::path& path)
     return buffer;
 }
 
+bool MappedFile::open(const std::filesystem::path& path)
+{
+    close();
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+    m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mapping)
+        m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data)
+    {
+        close();
+        return false;
+    }
+    m_size = (size_t)size.QuadPart;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+    m_data = nullptr;
+    m_size = 0;
+    m_mapping = NULL;
+    m_file = INVALID_HANDLE_VALUE;
+}
+
 vk::UniqueShaderModule load_shader(const vk::UniqueDevice& dev, const std::filesystem::path& path)
 {
     auto code = read_file(path);
@@ -32,8 +61,8 @@ vk::UniqueShaderModule load_shader(const vk::UniqueDevice& dev, const std::files
     return m;
 }
 
-std::tuple<vk::UniqueImage, vk::UniqueImageView, vk::UniqueDeviceMemory>
-create_depth(const vk::PhysicalDevice& pd, vk::Device const& dev, int width, int height)
+std::tuple<vk::UniqueImage, vk::UniqueImageView, Allocation>
+create_depth(const vk::PhysicalDevice& pd, MemoryAllocator& allocator, vk::Device const& dev, int width, int height)
 {
     auto depth_format_props = pd.getFormatProperties(vk::Format::eD16Unorm);
     vk::ImageTiling depth_tiling;
@@ -47,10 +76,8 @@ create_depth(const vk::PhysicalDevice& pd, vk::Device const& dev, int width, int
         vk::Extent3D(width, height, 1), 1, 1, vk::SampleCountFlagBits::e1,
         depth_tiling, vk::ImageUsageFlagBits::eDepthStencilAttachment);
     auto depth_image = dev.createImageUnique(depth_create_info);
-    auto depth_mem_req = dev.getImageMemoryRequirements(*depth_image);
-    int depth_memtype_idx = find_memory(pd, depth_mem_req, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    auto depth_mem = dev.allocateMemoryUnique({ depth_mem_req.size, (size_t)depth_memtype_idx });
-    dev.bindImageMemory(*depth_image, *depth_mem, 0);
+    auto depth_mem = allocator.bind(depth_image, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        MemoryAllocator::Strategy::free_list, depth_tiling);
     auto depth_view_info = vk::ImageViewCreateInfo({}, *depth_image, vk::ImageViewType::e2D, vk::Format::eD16Unorm,
         { cs::eR, cs::eG, cs::eB, cs::eA }, { vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1 });
     auto depth_view = dev.createImageViewUnique(depth_view_info);
@@ -62,23 +89,25 @@ vk::UniqueSampler create_sampler(const vk::UniqueDevice& dev, vk::Filter filter)
     vk::SamplerCreateInfo info;
     info.magFilter = filter;
     info.minFilter = filter;
-    info.mipmapMode = vk::SamplerMipmapMode::eLinear;
-    info.addressModeU = vk::SamplerAddressMode::eRepeat;
-    info.addressModeV = vk::SamplerAddressMode::eRepeat;
-    info.addressModeW = vk::SamplerAddressMode::eRepeat;
+    // trilinear when linear, the zoomed out canvas reads its mips
+    info.mipmapMode = filter == vk::Filter::eLinear ? vk::SamplerMipmapMode::eLinear : vk::SamplerMipmapMode::eNearest;
+    // the low mips would pull in the opposite border when repeating
+    info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
     info.mipLodBias = 0.f;
     info.anisotropyEnable = true;
     info.maxAnisotropy = 1.f;
     info.compareEnable = false;
     info.compareOp = vk::CompareOp::eAlways;
     info.minLod = 0.f;
-    info.maxLod = 0.f;
+    info.maxLod = VK_LOD_CLAMP_NONE;
     info.borderColor = vk::BorderColor::eIntOpaqueBlack;
     info.unnormalizedCoordinates = false;
     return dev->createSamplerUnique(info);
 }
 
-auto create_triangle(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev)
+auto create_triangle(MemoryAllocator& allocator, const vk::UniqueDevice& dev)
 {
     constexpr std::array<vertex_t, 4> triangle = {
         vertex_t{{-1.f, 1.f, 0.f}, {1.0f, 1.0f, 1.0f}, {0, 1}},
@@ -89,31 +118,17 @@ auto create_triangle(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev)
     auto vbo_info = vk::BufferCreateInfo({}, sizeof(triangle), vk::BufferUsageFlagBits::eVertexBuffer,
         vk::SharingMode::eExclusive, 0, nullptr);
     auto vbo_buffer = dev->createBufferUnique(vbo_info);
-    auto vbo_mem_req = dev->getBufferMemoryRequirements(*vbo_buffer);
-    auto vbo_mem_idx = find_memory(pd, vbo_mem_req,
+    auto vbo_mem = allocator.bind(vbo_buffer,
         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-    auto vbo_mem = dev->allocateMemoryUnique(vk::MemoryAllocateInfo(vbo_mem_req.size, vbo_mem_idx));
-    dev->bindBufferMemory(*vbo_buffer, *vbo_mem, 0);
-    if (auto vbo_map = static_cast<vertex_t*>(dev->mapMemory(*vbo_mem, 0, sizeof(triangle))))
-    {
-        std::copy(triangle.begin(), triangle.end(), vbo_map);
-        dev->unmapMemory(*vbo_mem);
-    }
+    std::copy(triangle.begin(), triangle.end(), static_cast<vertex_t*>(vbo_mem.m_ptr));
 
     constexpr std::array<uint32_t, 6> indices = { 0, 1, 2, 0, 2, 3 };
     auto ibo_info = vk::BufferCreateInfo({}, sizeof(indices), vk::BufferUsageFlagBits::eIndexBuffer,
         vk::SharingMode::eExclusive, 0, nullptr);
     auto ibo_buffer = dev->createBufferUnique(ibo_info);
-    auto ibo_mem_req = dev->getBufferMemoryRequirements(*ibo_buffer);
-    auto ibo_mem_idx = find_memory(pd, ibo_mem_req,
+    auto ibo_mem = allocator.bind(ibo_buffer,
         vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-    auto ibo_mem = dev->allocateMemoryUnique(vk::MemoryAllocateInfo(ibo_mem_req.size, ibo_mem_idx));
-    dev->bindBufferMemory(*ibo_buffer, *ibo_mem, 0);
-    if (auto ibo_map = static_cast<uint32_t*>(dev->mapMemory(*ibo_mem, 0, sizeof(indices))))
-    {
-        std::copy(indices.begin(), indices.end(), ibo_map);
-        dev->unmapMemory(*ibo_mem);
-    }
+    std::copy(indices.begin(), indices.end(), static_cast<uint32_t*>(ibo_mem.m_ptr));
 
     return std::tuple(std::move(vbo_buffer), std::move(vbo_mem),
         std::move(ibo_buffer), std::move(ibo_mem), indices.size());
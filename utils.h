@@ -1,4 +1,5 @@
 #pragma once
+#include "memoryallocator.h"
 
 using cs = vk::ComponentSwizzle;
 using cc = vk::ColorComponentFlagBits;
@@ -12,50 +13,57 @@ struct vertex_t
     constexpr vertex_t(glm::vec3 p, glm::vec3 c, glm::vec2 t) : pos(p), col(c), tex(t) {}
 };
 
-int find_memory(const vk::PhysicalDevice& pd, const vk::MemoryRequirements& req, vk::MemoryPropertyFlags flags);
-std::vector<uint8_t> read_file(const std::filesystem::path& path);
-vk::UniqueShaderModule load_shader(const vk::UniqueDevice& dev, const std::filesystem::path& path);
-
-std::tuple<vk::UniqueImage, vk::UniqueImageView, vk::UniqueDeviceMemory> 
-    create_depth(const vk::PhysicalDevice& pd, vk::Device const& dev, int width, int height);
-vk::UniqueSampler create_sampler(const vk::UniqueDevice& dev, vk::Filter filter);
-auto create_triangle(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev);
-
-template<typename T>
-class UBO
+// Pixel bounding box of the canvas region touched by a batch, max is exclusive
+struct DirtyRect
 {
-public:
-    vk::UniqueBuffer m_buffer;
-    vk::UniqueDeviceMemory m_memory;
-    T m_value;
-    bool create(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev)
-    {
-        auto info = vk::BufferCreateInfo({}, sizeof(T), vk::BufferUsageFlagBits::eUniformBuffer);
-        m_buffer = dev->createBufferUnique(info);
-        auto mem_req = dev->getBufferMemoryRequirements(*m_buffer);
-        auto mem_idx = find_memory(pd, mem_req,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-        m_memory = dev->allocateMemoryUnique({ mem_req.size, (uint32_t)mem_idx });
-        dev->bindBufferMemory(*m_buffer, *m_memory, 0);
-        return true;
-    }
-    void update(const vk::UniqueDevice& dev)
+    glm::ivec2 min{ std::numeric_limits<int>::max() };
+    glm::ivec2 max{ std::numeric_limits<int>::min() };
+
+    void clear() { *this = DirtyRect(); }
+    bool empty() const { return glm::any(glm::greaterThanEqual(min, max)); }
+    void add(glm::ivec2 pmin, glm::ivec2 pmax) { min = glm::min(min, pmin); max = glm::max(max, pmax); }
+    void add(const DirtyRect& r) { if (!r.empty()) add(r.min, r.max); }
+    DirtyRect clamp(glm::ivec2 size) const
     {
-        if (auto uniform_map = static_cast<T*>(dev->mapMemory(*m_memory, 0, VK_WHOLE_SIZE)))
-        {
-            std::copy_n(&m_value, 1, uniform_map);
-            dev->unmapMemory(*m_memory);
-        }
+        DirtyRect r;
+        r.min = glm::clamp(min, glm::ivec2(0), size);
+        r.max = glm::clamp(max, glm::ivec2(0), size);
+        return r;
     }
-    static UBO<T> create_static(const vk::PhysicalDevice& pd, const vk::UniqueDevice& dev)
+    vk::Rect2D rect() const
     {
-        UBO<T> ubo;
-        if (!ubo.create(pd, dev))
-            throw std::runtime_error("UBO creation failed");
-        return ubo;
+        if (empty())
+            return vk::Rect2D();
+        return vk::Rect2D({ min.x, min.y }, { (uint32_t)(max.x - min.x), (uint32_t)(max.y - min.y) });
     }
 };
 
+std::vector<uint8_t> read_file(const std::filesystem::path& path);
+
+// A whole file mapped read only, pages are read on first access
+class MappedFile
+{
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = NULL;
+public:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+    // false when the file does not exist or is empty
+    bool open(const std::filesystem::path& path);
+    void close();
+};
+vk::UniqueShaderModule load_shader(const vk::UniqueDevice& dev, const std::filesystem::path& path);
+
+std::tuple<vk::UniqueImage, vk::UniqueImageView, Allocation>
+    create_depth(const vk::PhysicalDevice& pd, MemoryAllocator& allocator, vk::Device const& dev, int width, int height);
+vk::UniqueSampler create_sampler(const vk::UniqueDevice& dev, vk::Filter filter);
+auto create_triangle(MemoryAllocator& allocator, const vk::UniqueDevice& dev);
+
 inline void* aligned_malloc(size_t size, size_t align) {
     void* result;
 #ifdef _MSC_VER 